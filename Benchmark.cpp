@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "Simulation.cpp"
+
+// Two-sided 95% quantiles of Student's t distribution for 1 to 30 degrees of freedom. With more, the normal
+// quantile is close enough.
+const double T_QUANTILES_95[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+
+// Mean of independent trials and the half width of its 95% confidence interval. A single trial has no spread to
+// estimate, its interval stays zero.
+struct TrialSummary {
+    double mean{}, ci{};
+};
+
+TrialSummary summarizeTrials(const std::vector<double> &values) {
+    TrialSummary summary;
+
+    if (values.empty())
+        return summary;
+
+    for (double value: values)
+        summary.mean += value;
+
+    summary.mean /= static_cast<double>(values.size());
+
+    if (values.size() < 2)
+        return summary;
+
+    double squares = 0.0;
+
+    for (double value: values)
+        squares += (value - summary.mean) * (value - summary.mean);
+
+    const std::size_t freedom = values.size() - 1;
+    const double t = freedom <= std::size(T_QUANTILES_95) ? T_QUANTILES_95[freedom - 1] : 1.960;
+    summary.ci = t * std::sqrt(squares / static_cast<double>(freedom) / static_cast<double>(values.size()));
+    return summary;
+}
+
+// Whether two measurements differ by more than their intervals explain.
+inline bool significantlyDifferent(const TrialSummary &a, const TrialSummary &b) {
+    return std::abs(a.mean - b.mean) > std::hypot(a.ci, b.ci);
+}
+
+// A throughput measurement of the simulation alone: every trial steps a fresh forest of the given size, warmup
+// steps untimed and then steps timed ones.
+struct BenchmarkSettings {
+    int width{}, height{}, warmup{}, steps{}, trials{};
+};
+
+struct BenchmarkResult {
+    // The step parameters the trials ran with, see describeParams, so a baseline is only compared to the same.
+    std::string configuration;
+    int width{}, height{}, steps{}, trials{};
+    TrialSummary generationsPerSecond, cellsPerSecond;
+};
+
+// Everything in params that changes the cost of a step, the seed aside.
+std::string describeParams(const StepParams &params) {
+    char text[160];
+    std::snprintf(text, sizeof(text), "%s %s %s %s %s k=%llu p=%g g=%g", NEIGHBORHOOD_NAMES[params.logic],
+                  STEP_KERNEL_NAMES[params.kernel], SAMPLING_NAMES[params.skipSampling],
+                  BURN_NAMES[params.instantBurn], BOUNDARY_NAMES[params.boundary],
+                  static_cast<unsigned long long>(params.stepLength()), params.p, params.g);
+    return text;
+}
+
+// One line per result, the configuration first as it contains no commas.
+bool saveBaseline(const char *path, const std::vector<BenchmarkResult> &results) {
+    std::FILE *out = std::fopen(path, "w");
+
+    if (out == nullptr)
+        return false;
+
+    std::fprintf(out, "configuration,width,height,steps,trials,generations_per_second,generations_ci,"
+                      "cells_per_second,cells_ci\n");
+
+    for (const auto &r: results)
+        std::fprintf(out, "%s,%d,%d,%d,%d,%.6e,%.6e,%.6e,%.6e\n", r.configuration.c_str(), r.width, r.height,
+                     r.steps, r.trials, r.generationsPerSecond.mean, r.generationsPerSecond.ci,
+                     r.cellsPerSecond.mean, r.cellsPerSecond.ci);
+
+    return std::fclose(out) == 0;
+}
+
+// Empty if there is no baseline. Lines that do not parse are skipped.
+std::vector<BenchmarkResult> loadBaseline(const char *path) {
+    std::vector<BenchmarkResult> results;
+    std::FILE *in = std::fopen(path, "r");
+
+    if (in == nullptr)
+        return results;
+
+    char line[512];
+
+    while (std::fgets(line, sizeof(line), in)) {
+        char configuration[256];
+        BenchmarkResult r;
+
+        if (std::sscanf(line, "%255[^,],%d,%d,%d,%d,%lf,%lf,%lf,%lf", configuration, &r.width, &r.height, &r.steps,
+                        &r.trials, &r.generationsPerSecond.mean, &r.generationsPerSecond.ci, &r.cellsPerSecond.mean,
+                        &r.cellsPerSecond.ci) != 9)
+            continue;
+
+        r.configuration = configuration;
+        results.push_back(r);
+    }
+
+    std::fclose(in);
+    return results;
+}
+
+// Measured with the same configuration on the same grid size, so the two compare.
+inline bool sameMeasurement(const BenchmarkResult &a, const BenchmarkResult &b) {
+    return a.configuration == b.configuration && a.width == b.width && a.height == b.height;
+}
+
+// The baseline of the configuration and grid size of result, if there is one.
+const BenchmarkResult *findBaseline(const std::vector<BenchmarkResult> &baseline, const BenchmarkResult &result) {
+    for (const auto &r: baseline)
+        if (sameMeasurement(r, result))
+            return &r;
+
+    return nullptr;
+}
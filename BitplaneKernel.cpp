@@ -0,0 +1,327 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define FOREST_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#include <omp.h>
+
+#include "ForestGrid.cpp"
+#include "Random.cpp"
+#include "SkipSampling.cpp"
+#include "Tracing.cpp"
+
+// TREE and FIRE bitplanes of the current generation, 64 cells per word. Every row is padded with a word on both
+// sides and the planes with a row above and below, so neighbor shifts never need bounds checks. The tree padding is
+// zero, the fire padding is set by wrapFire. Like the grid, the planes are first touched in the partition of the row
+// loops that pack and read them.
+struct Bitplanes {
+    void resize(int newWidth, int newHeight) {
+        if (newWidth == width && newHeight == height)
+            return;
+
+        width = newWidth;
+        height = newHeight;
+        words = (width + 63) / 64;
+        stride = words + 2;
+        tree.reset(new std::uint64_t[static_cast<std::size_t>(stride) * (height + 2)]);
+        fire.reset(new std::uint64_t[static_cast<std::size_t>(stride) * (height + 2)]);
+
+#pragma omp parallel for schedule(static) default(none)
+        for (int y = -1; y <= height; ++y) {
+            std::fill_n(treeRow(y) - 1, stride, 0);
+            std::fill_n(fireRow(y) - 1, stride, 0);
+        }
+    }
+
+    std::uint64_t *treeRow(int y) {
+        return tree.get() + static_cast<std::size_t>(y + 1) * stride + 1;
+    }
+
+    std::uint64_t *fireRow(int y) {
+        return fire.get() + static_cast<std::size_t>(y + 1) * stride + 1;
+    }
+
+    // Fills the padding of the packed fire plane with what lies beyond each edge: nothing for a fixed boundary, the
+    // fire of the opposite edge for a periodic one. When a row does not fill its last word, the ghost cell to its
+    // right is the first unused bit of that word, which the shifts pick up like any other neighbor.
+    void wrapFire(bool periodic) {
+        for (int y = 0; y < height; ++y) {
+            std::uint64_t *row = fireRow(y);
+            std::uint64_t first = periodic ? row[0] & 1 : 0;
+            std::uint64_t last = periodic ? (row[(width - 1) / 64] >> ((width - 1) % 64)) & 1 : 0;
+
+            row[-1] = last << 63;
+            row[words] = (width % 64) ? 0 : first;
+
+            if (width % 64)
+                row[words - 1] |= first << (width % 64);
+        }
+
+        if (periodic) {
+            std::copy_n(fireRow(height - 1) - 1, stride, fireRow(-1) - 1);
+            std::copy_n(fireRow(0) - 1, stride, fireRow(height) - 1);
+        } else {
+            std::fill_n(fireRow(-1) - 1, stride, 0);
+            std::fill_n(fireRow(height) - 1, stride, 0);
+        }
+    }
+
+public:
+    int width{}, height{};
+    int words{}, stride{};
+    std::unique_ptr<std::uint64_t[]> tree, fire;
+};
+
+using PackRowFn = void (*)(const CellState *, int, std::uint64_t *, std::uint64_t *);
+using UnpackRowFn = void (*)(const std::uint64_t *, const std::uint64_t *, int, CellState *);
+
+static void packRowScalar(const CellState *cells, int width, std::uint64_t *tree, std::uint64_t *fire) {
+    for (int w = 0; w * 64 < width; ++w) {
+        std::uint64_t treeBits = 0, fireBits = 0;
+        int count = std::min(64, width - w * 64);
+
+        for (int b = 0; b < count; ++b) {
+            treeBits |= static_cast<std::uint64_t>(cells[w * 64 + b] == TREE) << b;
+            fireBits |= static_cast<std::uint64_t>(cells[w * 64 + b] == FIRE) << b;
+        }
+
+        tree[w] = treeBits;
+        fire[w] = fireBits;
+    }
+}
+
+static void unpackRowScalar(const std::uint64_t *tree, const std::uint64_t *fire, int width, CellState *cells) {
+    for (int x = 0; x < width; ++x) {
+        auto treeBit = (tree[x / 64] >> (x % 64)) & 1;
+        auto fireBit = (fire[x / 64] >> (x % 64)) & 1;
+        cells[x] = static_cast<CellState>(EMPTY - 2 * treeBit - fireBit);
+    }
+}
+
+#ifdef FOREST_X86_SIMD
+
+__attribute__((target("avx2"))) static void packRowAvx2(const CellState *cells, int width, std::uint64_t *tree,
+                                                        std::uint64_t *fire) {
+    const __m256i treeValue = _mm256_set1_epi8(TREE), fireValue = _mm256_set1_epi8(FIRE);
+    int w = 0;
+
+    for (; (w + 1) * 64 <= width; ++w) {
+        auto lo = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(cells + w * 64));
+        auto hi = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(cells + w * 64 + 32));
+
+        tree[w] = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, treeValue))) |
+                  static_cast<std::uint64_t>(static_cast<std::uint32_t>(
+                          _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, treeValue)))) << 32;
+        fire[w] = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, fireValue))) |
+                  static_cast<std::uint64_t>(static_cast<std::uint32_t>(
+                          _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, fireValue)))) << 32;
+    }
+
+    if (w * 64 < width)
+        packRowScalar(cells + w * 64, width - w * 64, tree + w, fire + w);
+}
+
+// Spreads 32 bits over 32 bytes, 0xFF where the bit is set.
+__attribute__((target("avx2"))) static inline __m256i expandBits(std::uint32_t bits) {
+    const __m256i shuffle = _mm256_setr_epi64x(0x0000000000000000, 0x0101010101010101,
+                                               0x0202020202020202, 0x0303030303030303);
+    const __m256i select = _mm256_set1_epi64x(static_cast<long long>(0x8040201008040201ull));
+    auto bytes = _mm256_shuffle_epi8(_mm256_set1_epi32(static_cast<int>(bits)), shuffle);
+    return _mm256_cmpeq_epi8(_mm256_and_si256(bytes, select), select);
+}
+
+__attribute__((target("avx2"))) static void unpackRowAvx2(const std::uint64_t *tree, const std::uint64_t *fire,
+                                                          int width, CellState *cells) {
+    const __m256i emptyValue = _mm256_set1_epi8(EMPTY), two = _mm256_set1_epi8(2), one = _mm256_set1_epi8(1);
+    int w = 0;
+
+    for (; (w + 1) * 64 <= width; ++w) {
+        for (int half = 0; half < 2; ++half) {
+            auto treeBytes = expandBits(static_cast<std::uint32_t>(tree[w] >> (32 * half)));
+            auto fireBytes = expandBits(static_cast<std::uint32_t>(fire[w] >> (32 * half)));
+            auto state = _mm256_sub_epi8(_mm256_sub_epi8(emptyValue, _mm256_and_si256(treeBytes, two)),
+                                         _mm256_and_si256(fireBytes, one));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(cells + w * 64 + 32 * half), state);
+        }
+    }
+
+    if (w * 64 < width)
+        unpackRowScalar(tree + w, fire + w, width - w * 64, cells + w * 64);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static void packRowAvx512(const CellState *cells, int width,
+                                                                      std::uint64_t *tree, std::uint64_t *fire) {
+    const __m512i treeValue = _mm512_set1_epi8(TREE), fireValue = _mm512_set1_epi8(FIRE);
+
+    for (int w = 0; w * 64 < width; ++w) {
+        int count = std::min(64, width - w * 64);
+        __mmask64 valid = count == 64 ? ~0ull : (1ull << count) - 1;
+        auto v = _mm512_maskz_loadu_epi8(valid, cells + w * 64);
+
+        tree[w] = _mm512_cmpeq_epi8_mask(v, treeValue) & valid;
+        fire[w] = _mm512_cmpeq_epi8_mask(v, fireValue) & valid;
+    }
+}
+
+__attribute__((target("avx512f,avx512bw"))) static void unpackRowAvx512(const std::uint64_t *tree,
+                                                                        const std::uint64_t *fire, int width,
+                                                                        CellState *cells) {
+    for (int w = 0; w * 64 < width; ++w) {
+        int count = std::min(64, width - w * 64);
+        __mmask64 valid = count == 64 ? ~0ull : (1ull << count) - 1;
+        auto state = _mm512_mask_mov_epi8(_mm512_set1_epi8(EMPTY), tree[w], _mm512_set1_epi8(TREE));
+        state = _mm512_mask_mov_epi8(state, fire[w], _mm512_set1_epi8(FIRE));
+
+        _mm512_mask_storeu_epi8(cells + w * 64, valid, state);
+    }
+}
+
+#endif
+
+enum BitplaneIsa {
+    ISA_SCALAR, ISA_AVX2, ISA_AVX512
+};
+
+const char *BITPLANE_ISA_NAMES[] = {"scalar", "AVX2", "AVX-512"};
+
+BitplaneIsa detectBitplaneIsa() {
+    static const BitplaneIsa isa = [] {
+#ifdef FOREST_X86_SIMD
+        if (__builtin_cpu_supports("avx512bw"))
+            return ISA_AVX512;
+        if (__builtin_cpu_supports("avx2"))
+            return ISA_AVX2;
+#endif
+        return ISA_SCALAR;
+    }();
+
+    return isa;
+}
+
+static void selectBitplaneIsa(BitplaneIsa isa, PackRowFn &pack, UnpackRowFn &unpack) {
+    pack = packRowScalar;
+    unpack = unpackRowScalar;
+#ifdef FOREST_X86_SIMD
+    if (isa == ISA_AVX512) {
+        pack = packRowAvx512;
+        unpack = unpackRowAvx512;
+    } else if (isa == ISA_AVX2) {
+        pack = packRowAvx2;
+        unpack = unpackRowAvx2;
+    }
+#endif
+}
+
+// Cells of word w with fire in their neighborhood, from the fire words of the rows above, at and below. Bit b is
+// cell x = 64w + b, so the fire of x - 1 arrives by shifting left and the fire of x + 1 by shifting right, carrying
+// across the neighboring words, which have to exist.
+static inline std::uint64_t fireNearbyWord(const std::uint64_t *above, const std::uint64_t *fire,
+                                           const std::uint64_t *below, int w, bool moore) {
+    auto vertical = above[w] | below[w];
+    auto row = fire[w];
+
+    if (moore)
+        row |= vertical;
+
+    auto nearby = vertical | (row << 1) | (fire[w - 1] >> 63) | (row >> 1) | (fire[w + 1] << 63);
+
+    if (moore)
+        nearby |= (above[w - 1] >> 63) | (below[w - 1] >> 63) | (above[w + 1] << 63) | (below[w + 1] << 63);
+
+    return nearby;
+}
+
+// Same rule as the per-cell kernel: burning cells burn out, trees next to fire or hit by lightning ignite, empty
+// cells grow a tree. "Fire nearby" is computed for 64 cells at once from shifted fire words of the rows above,
+// at and below the current one.
+void stepBitplane(ForestGrid &grid, const StepParams &params, std::uint64_t step,
+                  BitplaneIsa isa = detectBitplaneIsa(), StepStats *stats = nullptr) {
+    thread_local Bitplanes threadPlanes;
+    Bitplanes &planes = threadPlanes;
+    PackRowFn pack;
+    UnpackRowFn unpack;
+
+    selectBitplaneIsa(isa, pack, unpack);
+    planes.resize(grid.width, grid.height);
+
+    const int width = grid.width, height = grid.height, words = planes.words;
+    const bool moore = params.logic == MOORE, periodic = params.boundary == PERIODIC_BOUNDARY;
+    const std::uint64_t seed = params.seed;
+    const auto igniteThreshold = params.igniteThreshold(), growThreshold = params.growThreshold();
+    const std::uint64_t lastMask = (width % 64) ? (1ull << (width % 64)) - 1 : ~0ull;
+    std::uint64_t fires = 0, struck = 0, grown = 0;
+
+#pragma omp parallel default(none) shared(grid, params, planes, pack, unpack, width, height, words, moore, periodic, igniteThreshold, growThreshold, lastMask, seed, step) reduction(+ : fires, struck, grown)
+    {
+        std::vector<std::uint64_t> nextTree(words), nextFire(words);
+
+#pragma omp for
+        for (int y = 0; y < height; ++y)
+            pack(grid.row(y), width, planes.treeRow(y), planes.fireRow(y));
+
+#pragma omp single
+        planes.wrapFire(periodic);
+
+        TraceScope work("bitplane rows");
+
+#pragma omp for nowait
+        for (int y = 0; y < height; ++y) {
+            const std::uint64_t *tree = planes.treeRow(y);
+            const std::uint64_t *above = planes.fireRow(y - 1), *fire = planes.fireRow(y), *below = planes.fireRow(y + 1);
+
+            for (int w = 0; w < words; ++w) {
+                auto nearby = fireNearbyWord(above, fire, below, w, moore);
+                auto valid = (w == words - 1) ? lastMask : ~0ull;
+                auto spread = tree[w] & nearby;
+                auto empty = ~tree[w] & ~fire[w] & valid;
+                auto candidates = (igniteThreshold ? tree[w] & ~spread : 0) | (growThreshold ? empty : 0);
+                std::uint64_t ignite = 0, grow = 0;
+
+                if (candidates) {
+                    std::uint32_t draws[RANDOM_BATCH];
+                    int count = (w == words - 1) ? width - w * 64 : 64;
+
+                    cellRandomRange(seed, step, grid.index(w * 64, y), count, draws);
+
+                    for (int b = 0; b < count; ++b) {
+                        ignite |= static_cast<std::uint64_t>(draws[b] < igniteThreshold) << b;
+                        grow |= static_cast<std::uint64_t>(draws[b] < growThreshold) << b;
+                    }
+                }
+
+                nextFire[w] = spread | (tree[w] & ignite);
+                nextTree[w] = (tree[w] & ~nextFire[w]) | (empty & grow);
+
+                fires += std::popcount(nextFire[w]);
+                struck += std::popcount(nextFire[w] & ~spread);
+                grown += std::popcount(nextTree[w] & ~tree[w]);
+            }
+
+            unpack(nextTree.data(), nextFire.data(), width, grid.nextRow(y));
+        }
+
+        work.end();
+
+#pragma omp barrier
+
+        if (params.skipSampling) {
+            auto events = sampleEvents(grid, grid.cells, grid.nextCells, params, step, [](std::uint64_t) {});
+            fires += events.struck;
+            struck += events.struck;
+            grown += events.grown;
+        }
+    }
+
+    grid.swap();
+
+    if (stats)
+        *stats = {0, fires, struck, grown};
+}
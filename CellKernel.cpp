@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstdint>
+
+#include <omp.h>
+
+#include "ForestGrid.cpp"
+#include "Random.cpp"
+#include "SkipSampling.cpp"
+#include "Tracing.cpp"
+
+// Fire in the neighborhood of a cell on the edge of the grid, where neighbors may be missing or wrap around.
+template<NeighborhoodLogic Logic, BoundaryMode Boundary>
+static bool edgeFireNearby(const ForestGrid &grid, int x, int y) {
+    bool nearby = false;
+
+    forEachNeighbor<Boundary>(grid.width, grid.height, x, y, Logic == MOORE, [&](std::size_t index) {
+        nearby |= grid.cells[index] == FIRE;
+    });
+
+    return nearby;
+}
+
+// Fire in the neighborhood of a cell away from the edge, where every neighbor exists: no bounds checks, no branches.
+template<NeighborhoodLogic Logic>
+static inline bool interiorFireNearby(const CellState *above, const CellState *row, const CellState *below, int x) {
+    bool nearby = (row[x - 1] == FIRE) | (row[x + 1] == FIRE) | (above[x] == FIRE) | (below[x] == FIRE);
+
+    if constexpr (Logic == MOORE)
+        nearby |= (above[x - 1] == FIRE) | (above[x + 1] == FIRE) | (below[x - 1] == FIRE) | (below[x + 1] == FIRE);
+
+    return nearby;
+}
+
+// Cells x0 to x1 of rows y0 to y1 of the per-cell kernel, on the calling thread alone. Cells on the edge of the grid go
+// through the edge check, everything else through the interior one. Without per-cell draws, the loop over the interior
+// is left with nothing but the rule. Cells draw as the cell indexOffset further on, so a grid that is a strip of a
+// larger one draws like the cells of that one.
+template<NeighborhoodLogic Logic, BoundaryMode Boundary, bool Drawn>
+static void stepCellBlock(ForestGrid &grid, const StepParams &params, std::uint64_t step, StepStats &counts, int x0,
+                          int y0, int x1, int y1, std::uint64_t indexOffset) {
+    const auto igniteThreshold = params.igniteThreshold(), growThreshold = params.growThreshold();
+    const int width = grid.width, height = grid.height;
+    std::uint64_t fires = 0, struck = 0, grown = 0;
+
+    auto update = [&](CellState cell, bool nearby, CellDraws &draws, std::size_t index) {
+        std::uint32_t draw = 0;
+
+        if constexpr (Drawn)
+            draw = draws(index + indexOffset);
+
+        bool tree = cell == TREE;
+        bool strike = tree & !nearby & (draw < igniteThreshold);
+        bool ignite = tree & (nearby | strike);
+        bool grow = (cell == EMPTY) & (draw < growThreshold);
+
+        fires += ignite;
+        struck += strike;
+        grown += grow;
+
+        // Computed instead of selected, a random forest would mispredict every other branch.
+        return static_cast<CellState>(EMPTY - 2 * ((tree & !ignite) | grow) - ignite);
+    };
+
+    for (int y = y0; y < y1; ++y) {
+        CellDraws draws(params.seed, step);
+        const CellState *current = grid.row(y);
+        CellState *next = grid.nextRow(y);
+
+        if (y == 0 || y == height - 1 || width < 3) {
+            for (int x = x0; x < x1; ++x)
+                next[x] = update(current[x], edgeFireNearby<Logic, Boundary>(grid, x, y), draws, grid.index(x, y));
+            continue;
+        }
+
+        const CellState *above = grid.row(y - 1), *below = grid.row(y + 1);
+        const int begin = x0 == 0 ? 1 : x0, end = x1 == width ? width - 1 : x1;
+
+        if (x0 == 0)
+            next[0] = update(current[0], edgeFireNearby<Logic, Boundary>(grid, 0, y), draws, grid.index(0, y));
+
+        for (int x = begin; x < end; ++x)
+            next[x] = update(current[x], interiorFireNearby<Logic>(above, current, below, x), draws,
+                             grid.index(x, y));
+
+        if (x1 == width)
+            next[width - 1] = update(current[width - 1], edgeFireNearby<Logic, Boundary>(grid, width - 1, y), draws,
+                                     grid.index(width - 1, y));
+    }
+
+    counts.fires += fires;
+    counts.struck += struck;
+    counts.grown += grown;
+}
+
+// Rows begin to end of the per-cell kernel, to be called by every thread of an enclosing parallel region.
+template<NeighborhoodLogic Logic, BoundaryMode Boundary, bool Drawn>
+static void stepCellRows(ForestGrid &grid, const StepParams &params, std::uint64_t step, StepStats &counts, int begin,
+                         int end, std::uint64_t indexOffset) {
+    StepStats rows{};
+
+    // Only the rows of this thread, not the wait for the others, so an uneven split shows in the trace.
+    TraceScope work("cell rows");
+
+#pragma omp for nowait
+    for (int y = begin; y < end; ++y)
+        stepCellBlock<Logic, Boundary, Drawn>(grid, params, step, rows, 0, y, grid.width, y + 1, indexOffset);
+
+    work.end();
+
+#pragma omp barrier
+
+    counts.fires += rows.fires;
+    counts.struck += rows.struck;
+    counts.grown += rows.grown;
+}
+
+using CellBlockFn = void (*)(ForestGrid &, const StepParams &, std::uint64_t, StepStats &, int, int, int, int,
+                             std::uint64_t);
+using CellRowsFn = void (*)(ForestGrid &, const StepParams &, std::uint64_t, StepStats &, int, int, std::uint64_t);
+
+// Indexed by NeighborhoodLogic, BoundaryMode and whether there are per-cell draws, so the instantiation is picked
+// once per step, not per cell.
+static constexpr CellBlockFn CELL_BLOCKS[2][2][2] = {
+        {{stepCellBlock<MOORE, FIXED_BOUNDARY, false>, stepCellBlock<MOORE, FIXED_BOUNDARY, true>},
+         {stepCellBlock<MOORE, PERIODIC_BOUNDARY, false>, stepCellBlock<MOORE, PERIODIC_BOUNDARY, true>}},
+        {{stepCellBlock<VON_NEUMANN, FIXED_BOUNDARY, false>, stepCellBlock<VON_NEUMANN, FIXED_BOUNDARY, true>},
+         {stepCellBlock<VON_NEUMANN, PERIODIC_BOUNDARY, false>, stepCellBlock<VON_NEUMANN, PERIODIC_BOUNDARY, true>}}};
+
+static constexpr CellRowsFn CELL_ROWS[2][2][2] = {
+        {{stepCellRows<MOORE, FIXED_BOUNDARY, false>, stepCellRows<MOORE, FIXED_BOUNDARY, true>},
+         {stepCellRows<MOORE, PERIODIC_BOUNDARY, false>, stepCellRows<MOORE, PERIODIC_BOUNDARY, true>}},
+        {{stepCellRows<VON_NEUMANN, FIXED_BOUNDARY, false>, stepCellRows<VON_NEUMANN, FIXED_BOUNDARY, true>},
+         {stepCellRows<VON_NEUMANN, PERIODIC_BOUNDARY, false>, stepCellRows<VON_NEUMANN, PERIODIC_BOUNDARY, true>}}};
+
+void stepCells(ForestGrid &grid, const StepParams &params, std::uint64_t step, StepStats *stats = nullptr) {
+    const bool drawn = params.igniteThreshold() || params.growThreshold();
+    const CellRowsFn stepRows = CELL_ROWS[params.logic][params.boundary][drawn];
+    std::uint64_t fires = 0, struck = 0, grown = 0;
+
+#pragma omp parallel default(none) shared(grid, params, step, stepRows) reduction(+ : fires, struck, grown)
+    {
+        StepStats counts{};
+        stepRows(grid, params, step, counts, 0, grid.height, 0);
+
+        fires += counts.fires;
+        struck += counts.struck;
+        grown += counts.grown;
+
+        if (params.skipSampling) {
+            auto events = sampleEvents(grid, grid.cells, grid.nextCells, params, step, [](std::uint64_t) {});
+            fires += events.struck;
+            struck += events.struck;
+            grown += events.grown;
+        }
+    }
+
+    grid.swap();
+
+    if (stats)
+        *stats = {0, fires, struck, grown};
+}
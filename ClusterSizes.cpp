@@ -0,0 +1,434 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+#include <utility>
+#include <vector>
+
+#include <omp.h>
+
+#include "BitplaneKernel.cpp"
+#include "ForestGrid.cpp"
+
+// Tiles labeled independently of each other. Local labels of a tile are 16 bit, so a tile has at most 2^16 cells,
+// and its rows are packed into whole 64 bit words.
+const int CLUSTER_TILE = 128;
+
+static_assert(CLUSTER_TILE * CLUSTER_TILE <= 65536 && CLUSTER_TILE % 64 == 0);
+
+// Bin b counts the clusters of 2^b to 2^(b+1) - 1 trees.
+const int CLUSTER_BINS = 33;
+
+// Log-binned tree cluster size distribution of one generation.
+struct ClusterHistogram {
+    std::array<std::uint64_t, CLUSTER_BINS> bins{};
+    std::uint64_t cells{}, trees{}, clusters{}, largest{};
+    // Tiles that had to be labeled again, out of all tiles.
+    int relabeledTiles{}, tiles{};
+};
+
+// Connected components of the TREE cells, under 4-connectivity for the von Neumann and 8-connectivity for the Moore
+// neighborhood, on the bounded grid also when the simulation wraps around: a cluster crossing a periodic edge is
+// counted as two. Every tile is labeled on its own with a sequential union-find over the runs of consecutive trees in
+// its rows, which numbers the clusters within the tile and leaves every tree with the number of its local cluster.
+// Numbered consecutively over all tiles, the local clusters are then merged across tile edges with a lock-free
+// union-find that always links the larger number to the smaller one, and their sizes are summed up per cluster.
+// Only the labels of the trees on the edges of a tile are kept, which is all the merge needs, so it only ever
+// touches arrays much smaller than the grid.
+//
+// Labeling is incremental: a tile in which no cell became or stopped being a tree since the last update keeps its
+// local labels, so only the tiles a fire or regrowth touched are labeled again. The merge across edges touches only
+// edge cells and local clusters, so a step in which little changed costs a fraction of a full labeling. That takes a
+// forest that stands still, without growth or while paused and edited: any growth changes every tile every step.
+struct ClusterLabeling {
+    ClusterHistogram update(const ForestGrid &grid, NeighborhoodLogic logic) {
+        const bool resized = grid.width != width || grid.height != height;
+        const bool full = resized || stale || logic != labeledLogic;
+
+        if (resized) {
+            width = grid.width;
+            height = grid.height;
+            columns = (width + CLUSTER_TILE - 1) / CLUSTER_TILE;
+            rows = (height + CLUSTER_TILE - 1) / CLUSTER_TILE;
+            edges.assign(static_cast<std::size_t>(columns) * rows, {});
+            trees.assign(static_cast<std::size_t>(columns) * rows * TILE_ROW_WORDS * CLUSTER_TILE, 0);
+            localSizes.assign(edges.size(), {});
+            firstCluster.assign(edges.size() + 1, 0);
+        }
+
+        stale = false;
+        labeledLogic = logic;
+
+        const int tiles = columns * rows;
+        const bool moore = logic == MOORE;
+        ClusterHistogram histogram;
+        int relabeled = 0;
+
+        histogram.cells = grid.size();
+        histogram.tiles = tiles;
+
+        PackRowFn pack;
+        UnpackRowFn unpack;
+        selectBitplaneIsa(detectBitplaneIsa(), pack, unpack);
+
+#pragma omp parallel for schedule(dynamic) default(none) shared(grid, full, tiles, moore, pack) reduction(+ : relabeled)
+        for (int tile = 0; tile < tiles; ++tile)
+            if (copyTrees(grid, tile, pack) || full) {
+                labelTile(tile, moore);
+                relabeled++;
+            }
+
+        for (int tile = 0; tile < tiles; ++tile)
+            firstCluster[tile + 1] = firstCluster[tile] + static_cast<std::uint32_t>(localSizes[tile].size());
+
+        parents.resize(firstCluster[tiles]);
+        sizes.resize(firstCluster[tiles]);
+
+#pragma omp parallel default(none) shared(tiles, moore, histogram)
+        {
+            const auto clusters = static_cast<std::int64_t>(parents.size());
+
+#pragma omp for
+            for (int tile = 0; tile < tiles; ++tile)
+                for (std::uint32_t i = 0; i < localSizes[tile].size(); ++i) {
+                    parents[firstCluster[tile] + i] = firstCluster[tile] + i;
+                    sizes[firstCluster[tile] + i] = localSizes[tile][i];
+                }
+
+#pragma omp for schedule(dynamic)
+            for (int tile = 0; tile < tiles; ++tile)
+                mergeEdges(tile, moore);
+
+            // Only the few local clusters that were merged into another one add up, all others are complete.
+#pragma omp for schedule(dynamic)
+            for (int tile = 0; tile < tiles; ++tile)
+                for (std::uint32_t i = firstCluster[tile]; i < firstCluster[tile + 1]; ++i)
+                    if (parents[i] != i)
+                        std::atomic_ref<std::uint32_t>(sizes[find(i)]).fetch_add(sizes[i], std::memory_order_relaxed);
+
+            ClusterHistogram local;
+
+#pragma omp for nowait
+            for (std::int64_t i = 0; i < clusters; ++i) {
+                if (parents[i] != i)
+                    continue;
+
+                local.bins[std::bit_width(sizes[i]) - 1]++;
+                local.trees += sizes[i];
+                local.clusters++;
+                local.largest = std::max<std::uint64_t>(local.largest, sizes[i]);
+            }
+
+#pragma omp critical
+            {
+                for (int b = 0; b < CLUSTER_BINS; ++b)
+                    histogram.bins[b] += local.bins[b];
+
+                histogram.trees += local.trees;
+                histogram.clusters += local.clusters;
+                histogram.largest = std::max(histogram.largest, local.largest);
+            }
+        }
+
+        histogram.relabeledTiles = relabeled;
+        return histogram;
+    }
+
+    // The next update labels every tile again, as if nothing was labeled before.
+    void invalidate() {
+        stale = true;
+    }
+
+private:
+    static constexpr int TILE_ROW_WORDS = CLUSTER_TILE / 64;
+    static constexpr std::uint16_t NO_LABEL = 0xFFFF;
+    static constexpr std::uint32_t NO_CLUSTER = ~0u;
+
+    enum TileEdge {
+        TOP_EDGE, BOTTOM_EDGE, LEFT_EDGE, RIGHT_EDGE
+    };
+
+    // Local cluster numbers of the cells along the four edges of a tile, NO_LABEL where there is no tree.
+    using EdgeLabels = std::array<std::array<std::uint16_t, CLUSTER_TILE>, 4>;
+
+    // Packs the trees of a tile into its tree mask and reports whether they changed since the last update.
+    bool copyTrees(const ForestGrid &grid, int tile, PackRowFn pack) {
+        int x0, y0, x1, y1;
+        bounds(tile, x0, y0, x1, y1);
+        std::uint64_t *mask = treeMask(tile);
+        std::uint64_t changed = 0;
+
+        for (int y = y0; y < y1; ++y, mask += TILE_ROW_WORDS) {
+            std::uint64_t words[TILE_ROW_WORDS] = {}, fires[TILE_ROW_WORDS];
+            pack(grid.row(y) + x0, x1 - x0, words, fires);
+
+            for (int w = 0; w < TILE_ROW_WORDS; ++w) {
+                changed |= mask[w] ^ words[w];
+                mask[w] = words[w];
+            }
+        }
+
+        return changed != 0;
+    }
+
+    // Sequential union-find over the runs of consecutive trees in the rows of one tile. Runs of neighboring rows are
+    // joined where they touch, which is found for a whole row at once with bit operations: at the start of every
+    // stretch where both rows have trees, and under the Moore neighborhood also where a run only touches one of the
+    // row above diagonally. The runs at such a cell are found by counting run starts up to it, so there are no
+    // branches per run besides those of the union-find.
+    void labelTile(int tile, bool moore) {
+        struct Run {
+            std::uint16_t begin, end;
+        };
+
+        // At most every other cell of a row starts a run.
+        thread_local std::array<Run, CLUSTER_TILE * CLUSTER_TILE / 2> runs;
+        thread_local std::array<std::uint16_t, CLUSTER_TILE * CLUSTER_TILE / 2> parent, number;
+        thread_local std::array<std::array<std::uint64_t, TILE_ROW_WORDS>, CLUSTER_TILE> starts;
+        thread_local std::array<int, CLUSTER_TILE + 1> firstRun;
+
+        int x0, y0, x1, y1;
+        bounds(tile, x0, y0, x1, y1);
+        const int w = x1 - x0, h = y1 - y0;
+        const std::uint64_t *mask = treeMask(tile);
+        int count = 0;
+
+        // Parents are always smaller run indices, so roots are the first run of their local cluster.
+        auto find = [&](std::uint16_t run) {
+            while (parent[run] != run) {
+                parent[run] = parent[parent[run]];
+                run = parent[run];
+            }
+            return run;
+        };
+
+        // Index of the run of row y that cell x belongs to.
+        auto runAt = [&](int y, int x) {
+            int before = 0;
+
+            for (int word = 0; word < x / 64; ++word)
+                before += std::popcount(starts[y][word]);
+
+            return firstRun[y] + before + std::popcount(starts[y][x / 64] & (~std::uint64_t{0} >> (63 - x % 64))) - 1;
+        };
+
+        // Bit x of the row words shifted by one cell: left holds cell x - 1, right holds cell x + 1.
+        auto left = [](const std::uint64_t *row, int word) {
+            return row[word] << 1 | (word > 0 ? row[word - 1] >> 63 : 0);
+        };
+        auto right = [](const std::uint64_t *row, int word) {
+            return row[word] >> 1 | (word + 1 < TILE_ROW_WORDS ? row[word + 1] << 63 : 0);
+        };
+
+        for (int y = 0; y < h; ++y) {
+            const std::uint64_t *row = mask + y * TILE_ROW_WORDS;
+            firstRun[y] = count;
+
+            // Runs start at trees without a tree to their left and end at the first cell after them that is none.
+            int ends = count;
+
+            for (int word = 0; word < TILE_ROW_WORDS; ++word) {
+                starts[y][word] = row[word] & ~left(row, word);
+
+                for (auto bits = starts[y][word]; bits != 0; bits &= bits - 1) {
+                    parent[count] = static_cast<std::uint16_t>(count);
+                    runs[count++].begin = static_cast<std::uint16_t>(word * 64 + std::countr_zero(bits));
+                }
+                for (auto bits = ~row[word] & left(row, word); bits != 0; bits &= bits - 1)
+                    runs[ends++].end = static_cast<std::uint16_t>(word * 64 + std::countr_zero(bits));
+            }
+
+            if (ends < count)
+                runs[ends].end = CLUSTER_TILE;
+
+            if (y == 0)
+                continue;
+
+            const std::uint64_t *above = row - TILE_ROW_WORDS;
+
+            auto join = [&](std::uint64_t cells, int offset, int word) {
+                for (; cells != 0; cells &= cells - 1) {
+                    int x = word * 64 + std::countr_zero(cells);
+                    auto a = find(static_cast<std::uint16_t>(runAt(y, x)));
+                    auto b = find(static_cast<std::uint16_t>(runAt(y - 1, x + offset)));
+
+                    if (a < b)
+                        parent[b] = a;
+                    else if (b < a)
+                        parent[a] = b;
+                }
+            };
+
+            for (int word = 0; word < TILE_ROW_WORDS; ++word) {
+                auto both = row[word] & above[word];
+                join(both & ~(left(row, word) & left(above, word)), 0, word);
+
+                if (moore) {
+                    join(row[word] & right(above, word) & ~above[word], 1, word);
+                    join(row[word] & left(above, word) & ~above[word], -1, word);
+                }
+            }
+        }
+
+        firstRun[h] = count;
+
+        auto &clusterSizes = localSizes[tile];
+        // Every parent is a smaller run of the same cluster, so it is numbered already and no find is needed. Without
+        // branches, as roots and other runs alternate unpredictably.
+        clusterSizes.assign(count, 0);
+        std::uint16_t clusters = 0;
+
+        for (int run = 0; run < count; ++run) {
+            auto up = parent[run];
+            bool root = up == run;
+
+            number[run] = root ? clusters : number[up];
+            clusters += root;
+            clusterSizes[number[run]] += runs[run].end - runs[run].begin;
+        }
+
+        clusterSizes.resize(clusters);
+
+        auto &edge = edges[tile];
+
+        for (auto &cells: edge)
+            cells.fill(NO_LABEL);
+
+        for (auto [side, y]: {std::pair{TOP_EDGE, 0}, std::pair{BOTTOM_EDGE, h - 1}})
+            for (int run = firstRun[y]; run < firstRun[y + 1]; ++run)
+                std::fill(edge[side].begin() + runs[run].begin, edge[side].begin() + runs[run].end, number[run]);
+
+        for (int y = 0; y < h; ++y) {
+            if (firstRun[y] == firstRun[y + 1])
+                continue;
+
+            if (runs[firstRun[y]].begin == 0)
+                edge[LEFT_EDGE][y] = number[firstRun[y]];
+            if (runs[firstRun[y + 1] - 1].end == w)
+                edge[RIGHT_EDGE][y] = number[firstRun[y + 1] - 1];
+        }
+    }
+
+    std::uint64_t *treeMask(int tile) {
+        return trees.data() + static_cast<std::size_t>(tile) * TILE_ROW_WORDS * CLUSTER_TILE;
+    }
+
+    // Number of the local cluster of a cell on the given edge of its tile over all tiles, NO_CLUSTER if it is no
+    // tree.
+    [[nodiscard]] std::uint32_t cluster(int x, int y, TileEdge side) const {
+        int tile = (y / CLUSTER_TILE) * columns + x / CLUSTER_TILE;
+        auto label = edges[tile][side][side == TOP_EDGE || side == BOTTOM_EDGE ? x % CLUSTER_TILE : y % CLUSTER_TILE];
+
+        return label == NO_LABEL ? NO_CLUSTER : firstCluster[tile] + label;
+    }
+
+    // Roots only ever get linked to smaller numbers, so this terminates while other threads are linking.
+    [[nodiscard]] std::uint32_t find(std::uint32_t cluster) const {
+        auto parent = std::atomic_ref<const std::uint32_t>(parents[cluster]).load(std::memory_order_relaxed);
+
+        while (parent != cluster) {
+            cluster = parent;
+            parent = std::atomic_ref<const std::uint32_t>(parents[cluster]).load(std::memory_order_relaxed);
+        }
+
+        return cluster;
+    }
+
+    // Lock-free union of two clusters of different tiles.
+    void unite(std::uint32_t a, std::uint32_t b) {
+        while (true) {
+            a = find(a);
+            b = find(b);
+
+            if (a == b)
+                return;
+
+            if (a < b)
+                std::swap(a, b);
+
+            auto expected = a;
+
+            if (std::atomic_ref<std::uint32_t>(parents[a]).compare_exchange_weak(expected, b,
+                                                                                  std::memory_order_relaxed))
+                return;
+        }
+    }
+
+    // Joins the trees on the right and bottom edge of a tile with their neighbors in the adjacent tiles.
+    void mergeEdges(int tile, bool moore) {
+        int x0, y0, x1, y1;
+        bounds(tile, x0, y0, x1, y1);
+
+        // The neighbors to the right are on the left edge of their tile, those below on its top edge.
+        auto join = [&](int x, int y, TileEdge side, int nx, int ny, TileEdge otherSide) {
+            if (nx < 0 || nx >= width || ny < 0 || ny >= height)
+                return;
+
+            auto a = cluster(x, y, side), b = cluster(nx, ny, otherSide);
+
+            if (a != NO_CLUSTER && b != NO_CLUSTER)
+                unite(a, b);
+        };
+
+        if (x1 < width)
+            for (int y = y0; y < y1; ++y) {
+                join(x1 - 1, y, RIGHT_EDGE, x1, y, LEFT_EDGE);
+
+                if (moore) {
+                    join(x1 - 1, y, RIGHT_EDGE, x1, y - 1, LEFT_EDGE);
+                    join(x1 - 1, y, RIGHT_EDGE, x1, y + 1, LEFT_EDGE);
+                }
+            }
+
+        if (y1 < height)
+            for (int x = x0; x < x1; ++x) {
+                join(x, y1 - 1, BOTTOM_EDGE, x, y1, TOP_EDGE);
+
+                if (moore) {
+                    join(x, y1 - 1, BOTTOM_EDGE, x - 1, y1, TOP_EDGE);
+                    join(x, y1 - 1, BOTTOM_EDGE, x + 1, y1, TOP_EDGE);
+                }
+            }
+    }
+
+    void bounds(int tile, int &x0, int &y0, int &x1, int &y1) const {
+        x0 = (tile % columns) * CLUSTER_TILE;
+        y0 = (tile / columns) * CLUSTER_TILE;
+        x1 = std::min(x0 + CLUSTER_TILE, width);
+        y1 = std::min(y0 + CLUSTER_TILE, height);
+    }
+
+    int width{}, height{}, columns{}, rows{};
+    NeighborhoodLogic labeledLogic{VON_NEUMANN};
+    bool stale{true};
+    // Tile by tile: the trees of the last update, one bit per cell, to find the tiles that changed, and the local
+    // cluster numbers along its edges.
+    std::vector<std::uint64_t> trees;
+    std::vector<EdgeLabels> edges;
+    // Per tile, the trees in each of its local clusters, and the number of its first local cluster over all tiles.
+    std::vector<std::vector<std::uint32_t>> localSizes;
+    std::vector<std::uint32_t> firstCluster;
+    // Per local cluster over all tiles: its parent in the merge, and at roots the trees of the whole cluster.
+    std::vector<std::uint32_t> parents, sizes;
+};
+
+// One line per non-empty bin: the size range, the number of clusters and n(s), the clusters per cell and per unit
+// of cluster size, which is what the scaling plots of forest-fire models show.
+void writeClusterHistogram(std::FILE *out, const ClusterHistogram &histogram, std::uint64_t generation) {
+    for (int b = 0; b < CLUSTER_BINS; ++b) {
+        if (histogram.bins[b] == 0)
+            continue;
+
+        auto from = std::uint64_t{1} << b, to = (std::uint64_t{2} << b) - 1;
+        double density = static_cast<double>(histogram.bins[b]) / static_cast<double>(histogram.cells) /
+                         static_cast<double>(to - from + 1);
+
+        std::fprintf(out, "%llu,%llu,%llu,%llu,%.6e\n", static_cast<unsigned long long>(generation),
+                     static_cast<unsigned long long>(from), static_cast<unsigned long long>(to),
+                     static_cast<unsigned long long>(histogram.bins[b]), density);
+    }
+}
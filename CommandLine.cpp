@@ -0,0 +1,112 @@
+#pragma once
+
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+// Comma separated list, every item converted with parse.
+template<typename T, typename Parse>
+std::vector<T> parseList(const char *text, Parse parse) {
+    std::vector<T> values;
+    std::string item;
+
+    for (const char *c = text;; ++c) {
+        if (*c == ',' || *c == '\0') {
+            if (!item.empty())
+                values.push_back(parse(item));
+            item.clear();
+            if (*c == '\0')
+                break;
+        } else {
+            item += *c;
+        }
+    }
+
+    return values;
+}
+
+// A number that makes up all of text. False for anything else, like "1k" or "", which leaves value as it was.
+template<typename T>
+bool parseNumber(std::string_view text, T &value) {
+    T parsed{};
+    const char *end = text.data() + text.size();
+    auto [last, error] = std::from_chars(text.data(), end, parsed);
+
+    if (text.empty() || error != std::errc() || last != end)
+        return false;
+
+    value = parsed;
+    return true;
+}
+
+// Comma separated list of numbers. False if any item is not one, which leaves values as they were.
+template<typename T>
+bool parseNumbers(const char *text, std::vector<T> &values) {
+    std::vector<T> parsed;
+
+    for (const auto &item: parseList<std::string>(text, [](const std::string &s) { return s; }))
+        if (!parseNumber(item, parsed.emplace_back()))
+            return false;
+
+    values = parsed;
+    return true;
+}
+
+// Comma separated list of numbers, where an item of the form from:to:count expands to count evenly spaced values
+// and from:to:count:log to count logarithmically spaced ones, which suits probabilities spanning decades. False if
+// any item is malformed, which leaves values as they were.
+bool parseRange(const char *text, std::vector<double> &values) {
+    std::vector<double> parsed;
+
+    for (const auto &item: parseList<std::string>(text, [](const std::string &s) { return s; })) {
+        std::vector<std::string_view> fields;
+        std::string_view rest = item;
+
+        for (auto colon = rest.find(':'); colon != std::string_view::npos; colon = rest.find(':')) {
+            fields.push_back(rest.substr(0, colon));
+            rest.remove_prefix(colon + 1);
+        }
+
+        fields.push_back(rest);
+
+        if (fields.size() == 1) {
+            if (!parseNumber(fields[0], parsed.emplace_back()))
+                return false;
+
+            continue;
+        }
+
+        double from, to;
+        int count;
+        const bool logarithmic = fields.size() == 4 && fields[3] == "log";
+
+        if (fields.size() < 3 || fields.size() > 4 || (fields.size() == 4 && !logarithmic) ||
+            !parseNumber(fields[0], from) || !parseNumber(fields[1], to) || !parseNumber(fields[2], count) ||
+            count < 1 || (logarithmic && (from <= 0.0 || to <= 0.0)))
+            return false;
+
+        for (int i = 0; i < count; ++i) {
+            double t = count > 1 ? static_cast<double>(i) / (count - 1) : 0.0;
+            parsed.push_back(logarithmic ? from * std::pow(to / from, t) : from + (to - from) * t);
+        }
+    }
+
+    values = parsed;
+    return true;
+}
+
+// Index of name in one of the name tables of the simulation, exits on names it does not know.
+template<std::size_t N>
+int parseName(const std::string &name, const char *(&names)[N]) {
+    for (std::size_t i = 0; i < N; ++i)
+        if (name == names[i])
+            return static_cast<int>(i);
+
+    std::fprintf(stderr, "unknown value: %s\n", name.c_str());
+    std::exit(EXIT_FAILURE);
+}
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <utility>
+
+#include <omp.h>
+
+#include "ForestGrid.cpp"
+#include "Random.cpp"
+#include "Simulation.cpp"
+#include "SkipSampling.cpp"
+
+// Rows y0 to y1 of a forest of width x height cells, the share of one process of a run that is split into horizontal
+// strips. The local grid holds them with a halo row above and below: the last row of the strip above and the first
+// row of the one below, wrapping around for a periodic boundary. With a fixed one, the halos at the edges of the forest
+// stay EMPTY, which burns nothing, like the neighbors that are missing there.
+struct ForestStrip {
+    ForestStrip(int width, int height, int y0, int y1) : width(width), height(height), y0(y0), y1(y1),
+                                                         local(width, y1 - y0 + 2) {}
+
+    [[nodiscard]] int rows() const {
+        return y1 - y0;
+    }
+
+    // Row y of the forest, which has to be one of the strip.
+    [[nodiscard]] const CellState *row(int y) const {
+        return local.row(y - y0 + 1);
+    }
+
+    CellState *row(int y) {
+        return local.row(y - y0 + 1);
+    }
+
+    CellState *haloAbove() {
+        return local.row(0);
+    }
+
+    CellState *haloBelow() {
+        return local.row(rows() + 1);
+    }
+
+    // Index in the forest of the first cell of the local grid, the halo above, modulo 2^64, so it wraps around for
+    // the first strip. Only the cells of the strip itself ever draw with it.
+    [[nodiscard]] std::uint64_t indexOffset() const {
+        return (static_cast<std::uint64_t>(y0) - 1) * static_cast<std::uint64_t>(width);
+    }
+
+public:
+    int width, height, y0, y1;
+    ForestGrid local;
+};
+
+// Rows of strip rank out of ranks. Every strip starts at a multiple of align, so views downsampled by align split at
+// the same rows, and the blocks of align rows are dealt out as evenly as they go.
+inline std::pair<int, int> stripRows(int height, int ranks, int rank, int align = 1) {
+    const std::int64_t blocks = (height + align - 1) / align;
+    const int begin = static_cast<int>(blocks * rank / ranks) * align;
+    const int end = std::min(height, static_cast<int>(blocks * (rank + 1) / ranks) * align);
+    return {begin, end};
+}
+
+// The rows of the strip as initGrid starts the whole forest.
+void initStrip(ForestStrip &strip, std::uint64_t seed) {
+    const auto treeThreshold = probabilityThreshold(START_GROWTH);
+
+#pragma omp parallel for default(none) shared(strip, seed, treeThreshold)
+    for (int y = strip.y0; y < strip.y1; ++y) {
+        CellDraws draws(seed, INIT_STREAM);
+        CellState *row = strip.row(y);
+
+        for (int x = 0; x < strip.width; ++x)
+            row[x] = draws(static_cast<std::uint64_t>(y) * strip.width + x) < treeThreshold ? TREE : EMPTY;
+    }
+
+    strip.local.markEdited();
+}
+
+// Skip-sampled lightning and growth of the rows of the strip, to be called by every thread of an enclosing parallel
+// region. The hits are those sampleEvents finds in the whole forest: every chunk that overlaps the strip is sampled
+// from its start, and only the hits inside the strip are kept.
+StepStats sampleStripEvents(ForestStrip &strip, const StepParams &params, std::uint64_t step) {
+    const auto width = static_cast<std::uint64_t>(strip.width);
+    const std::uint64_t first = strip.y0 * width, last = strip.y1 * width, cells = strip.height * width;
+    const auto firstChunk = static_cast<std::int64_t>(first / SKIP_CHUNK);
+    const auto lastChunk = static_cast<std::int64_t>((last + SKIP_CHUNK - 1) / SKIP_CHUNK);
+    const CellState *current = strip.local.cells;
+    CellState *next = strip.local.nextCells;
+    StepStats events;
+    TraceScope work("skip sampling");
+
+#pragma omp for schedule(dynamic) nowait
+    for (std::int64_t chunk = firstChunk; chunk < lastChunk; ++chunk) {
+        auto begin = static_cast<std::uint64_t>(chunk) * SKIP_CHUNK, end = std::min(begin + SKIP_CHUNK, cells);
+
+        forEachHit(params.p, params.seed ^ IGNITION_STREAM, step, chunk, begin, end, [&](std::uint64_t index) {
+            auto local = index - first + width;
+
+            if (index >= first && index < last && current[local] == TREE && next[local] == TREE) {
+                next[local] = FIRE;
+                events.struck++;
+            }
+        });
+
+        forEachHit(params.g, params.seed ^ GROWTH_STREAM, step, chunk, begin, end, [&](std::uint64_t index) {
+            auto local = index - first + width;
+
+            if (index >= first && index < last && current[local] == EMPTY) {
+                next[local] = TREE;
+                events.grown++;
+            }
+        });
+    }
+
+    work.end();
+
+#pragma omp barrier
+
+    return events;
+}
+
+// One generation of the strip, the rows of the forest that the per-cell kernel would compute for it. The rows that do
+// not border on a halo are stepped first, while the calling thread waits in waitForHalos for the halos of the current
+// generation to arrive, so their exchange overlaps with most of the step. Returns the statistics of the strip alone.
+template<typename WaitForHalos>
+StepStats stepStrip(ForestStrip &strip, const StepParams &params, std::uint64_t step, WaitForHalos waitForHalos) {
+    const bool drawn = params.igniteThreshold() || params.growThreshold();
+    const CellRowsFn stepRows = CELL_ROWS[params.logic][params.boundary][drawn];
+    const int rows = strip.rows();
+    const std::uint64_t offset = strip.indexOffset();
+    std::uint64_t fires = 0, struck = 0, grown = 0;
+
+#pragma omp parallel default(none) shared(strip, params, step, stepRows, rows, offset, waitForHalos) reduction(+ : fires, struck, grown)
+    {
+        StepStats counts{};
+        stepRows(strip.local, params, step, counts, 2, rows, offset);
+
+        // The thread that called, so a waitForHalos that calls MPI only needs MPI_THREAD_FUNNELED.
+#pragma omp master
+        waitForHalos();
+
+#pragma omp barrier
+
+        stepRows(strip.local, params, step, counts, 1, 2, offset);
+
+        if (rows > 1)
+            stepRows(strip.local, params, step, counts, rows, rows + 1, offset);
+
+        fires += counts.fires;
+        struck += counts.struck;
+        grown += counts.grown;
+
+        if (params.skipSampling) {
+            auto events = sampleStripEvents(strip, params, step);
+            fires += events.struck;
+            struck += events.struck;
+            grown += events.grown;
+        }
+    }
+
+    strip.local.swap();
+    return {0, fires, struck, grown};
+}
+
+// Cells per side of a view of a forest side of size, downsampled by factor.
+inline int viewSize(int size, int factor) {
+    return (size + factor - 1) / factor;
+}
+
+// Downsamples the rows of the strip by factor into out, viewSize(width, factor) cells per row and one row per block
+// of factor rows, so the strip has to start at a multiple of factor. A block burns if any of its cells does, and
+// otherwise is a tree if at least half of its cells are, so a fire stays visible at every scale.
+void downsampleStrip(const ForestStrip &strip, int factor, CellState *out) {
+    const int columns = viewSize(strip.width, factor), blockRows = viewSize(strip.rows(), factor);
+
+#pragma omp parallel for default(none) shared(strip, factor, out, columns, blockRows)
+    for (int by = 0; by < blockRows; ++by) {
+        const int y0 = strip.y0 + by * factor, y1 = std::min(y0 + factor, strip.y1);
+
+        for (int bx = 0; bx < columns; ++bx) {
+            const int x0 = bx * factor, x1 = std::min(x0 + factor, strip.width);
+            int trees = 0;
+            bool fire = false;
+
+            for (int y = y0; y < y1; ++y)
+                for (int x = x0; x < x1; ++x) {
+                    trees += strip.row(y)[x] == TREE;
+                    fire |= strip.row(y)[x] == FIRE;
+                }
+
+            out[static_cast<std::size_t>(by) * columns + bx] =
+                    fire ? FIRE : 2 * trees >= (x1 - x0) * (y1 - y0) ? TREE : EMPTY;
+        }
+    }
+}
+
+// Exchanges the halos of strips that live in the same process, as the processes of a split run do by message.
+void copyHalos(std::deque<ForestStrip> &strips, bool periodic) {
+    const int count = static_cast<int>(strips.size());
+
+    for (int i = 0; i < count; ++i) {
+        auto &strip = strips[i];
+
+        if (i > 0 || periodic) {
+            const auto &above = strips[(i + count - 1) % count];
+            std::memcpy(strip.haloAbove(), above.row(above.y1 - 1), strip.width);
+        }
+
+        if (i < count - 1 || periodic) {
+            const auto &below = strips[(i + 1) % count];
+            std::memcpy(strip.haloBelow(), below.row(below.y0), strip.width);
+        }
+    }
+}
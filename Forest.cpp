@@ -1,15 +1,29 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <random>
-#include <queue>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include <omp.h>
 
-const int SIZE = 1;
+#include "Benchmark.cpp"
+#include "CommandLine.cpp"
+#include "Simulation.cpp"
+#include "SimulationWorker.cpp"
+#include "Tracing.cpp"
+#include "Viewport.cpp"
+
 const int WIDTH = 1024;
 const int HEIGHT = 1024;
+const int MIN_GRID_SIDE = 64;
+const int MAX_GRID_SIDE = 32768;
+
+const int WINDOW_WIDTH = 1024;
+const int WINDOW_HEIGHT = 1024;
 
-const double START_GROWTH = 0.5;
 const float DEFAULT_FIRE = 0.0001;
 const float DEFAULT_GROWTH = 0.03;
 
@@ -22,7 +36,18 @@ const ImVec4 CLEAR_COLOR = {0.94f, 0.94f, 0.94f, 1.00f};
 const SDL_Color DEFAULT_TREE_COLOR = {0, 128, 0, 255};
 const SDL_Color DEFAULT_FIRE_COLOR = {200, 0, 0, 255};
 
-const int MEASUREMENT_STEPS[] = {1, 10, 100, 1000, 10000};
+// Grid sizes a benchmark runs by default, a square per number or width x height.
+const char *DEFAULT_BENCHMARK_SIZES = "512,1024";
+const int DEFAULT_BENCHMARK_WARMUP = 20;
+const int DEFAULT_BENCHMARK_STEPS = 100;
+const int DEFAULT_BENCHMARK_TRIALS = 5;
+
+const char *STATISTICS_FILE = "forest_statistics.csv";
+const char *CLUSTERS_FILE = "forest_clusters.csv";
+const char *RECORDING_FILE = "forest_run.frec";
+const char *CAPTURE_PATH = "forest_capture";
+const char *TRACE_FILE = "forest_trace.json";
+const char *BASELINE_FILE = "forest_baseline.csv";
 
 const ImVec4 RESET_TREE_COLOR = {static_cast<float>(DEFAULT_TREE_COLOR.r / 255.0), static_cast<float>(DEFAULT_TREE_COLOR.g / 255.0),
                                  static_cast<float>(DEFAULT_TREE_COLOR.b / 255.0), static_cast<float>(DEFAULT_TREE_COLOR.a / 255.0)};
@@ -30,134 +55,196 @@ const ImVec4 RESET_TREE_COLOR = {static_cast<float>(DEFAULT_TREE_COLOR.r / 255.0
 const ImVec4 RESET_FIRE_COLOR = {static_cast<float>(DEFAULT_FIRE_COLOR.r / 255.0), static_cast<float>(DEFAULT_FIRE_COLOR.g / 255.0),
                                  static_cast<float>(DEFAULT_FIRE_COLOR.b / 255.0), static_cast<float>(DEFAULT_FIRE_COLOR.a / 255.0)};
 
-enum CellState {
-    TREE, FIRE, EMPTY
-};
-
-enum NeighborhoodLogic {
-    MOORE,
-    VON_NEUMANN
-};
-
 SDL_Window *window = nullptr;
 SDL_Renderer *renderer = nullptr;
 
 NeighborhoodLogic currentLogic{VON_NEUMANN};
+StepKernel currentKernel{CELL_KERNEL};
+bool skipSampling{false};
+bool instantBurn{false};
+int blockDepth{8};
+BoundaryMode currentBoundary{FIXED_BOUNDARY};
 
 bool running{true};
 bool startMeasure{false};
 
 bool settingsWindow{false};
 bool measurementWindow{false};
+bool statisticsWindow{false};
 bool colorWindow{false};
+bool traceWindow{false};
 
-int currentStep{0};
-int maxSteps{0};
-
-float progressAllSteps(11111.0);
+float progressAllSteps{1.0};
 float progressCurrentStep{0.0};
 
+char benchmarkSizes[128]{};
+int benchmarkWarmup{DEFAULT_BENCHMARK_WARMUP};
+int benchmarkSteps{DEFAULT_BENCHMARK_STEPS};
+int benchmarkTrials{DEFAULT_BENCHMARK_TRIALS};
+// Results of the last benchmark and the saved ones the compare view diffs them against.
+std::vector<BenchmarkResult> benchmarkResults;
+std::vector<BenchmarkResult> baselineResults;
+bool compareBaseline{false};
+
 float fire{DEFAULT_FIRE};
 float growth{DEFAULT_GROWTH};
 
-int currentSize{SIZE};
 int currentWidth{WIDTH};
 int currentHeight{HEIGHT};
 
+Viewport viewport;
+// Set whenever the grid changes size, the next frame then fits the whole grid into the window.
+bool fitViewport{true};
+
+// Where runs are recorded to and replayed from.
+char recordingFile[512]{};
+// Follow the events of the worker, which may stop a recording or close a replay on its own.
+bool recording{false};
+bool replaying{false};
+std::uint64_t replayFirst{}, replayLast{};
+
+// Prefix of captured images, or the video with .y4m appended. The palette follows the colors the forest is drawn in.
+char captureFile[512]{};
+CaptureFormat captureFormat{CAPTURE_PNG};
+CapturePolicy capturePolicy{CAPTURE_DROP};
+int captureInterval{1};
+CapturePalette capturePalette{DEFAULT_CAPTURE_PALETTE};
+bool capturing{false};
+
+// Steps between two cluster size measurements, 0 measures on request only.
+int clusterInterval{0};
+
 float currentSpeed{FPS_LIMIT};
 bool limitAnimation{SPEED_CONTROL};
 
 bool stepwiseAnimation{STEP_ANIMATION};
 bool animationStep{STEP_ANIMATION};
 
-unsigned int lastFrame, lastUpdate;
-
 ImVec4 clearColor{CLEAR_COLOR};
 
-std::vector<std::vector<CellState>> forest(currentWidth, std::vector<CellState>(currentHeight, EMPTY));
+std::uint64_t simulationSeed{std::random_device{}()};
 
-std::priority_queue<int, std::vector<int>, std::greater<>> measureSteps;
+SimulationWorker simulation;
 
-void initForest() {
-    std::mt19937 initRng(std::chrono::high_resolution_clock::now().time_since_epoch().count());
-    std::uniform_real_distribution<double> dist(0.0, 1.0);
+// Spans of the frame phases and of the simulation, collected every frame while tracing is on.
+TraceLog traceLog;
 
-#pragma omp parallel for collapse(2) default(none) shared(forest, START_GROWTH, currentWidth, currentHeight) private(dist, initRng)
-    for (int i = 0; i < currentWidth; ++i)
-        for (int j = 0; j < currentHeight; ++j)
-            forest[i][j] = (dist(initRng) < START_GROWTH) ? TREE : EMPTY;
+StepParams currentParams() {
+    return {fire, growth, currentLogic, currentKernel, simulationSeed, skipSampling, instantBurn, blockDepth,
+            currentBoundary};
 }
 
+SimulationPace currentPace() {
+    if (stepwiseAnimation)
+        return STEPWISE;
 
-void drawSquare(int x, int y, SDL_Color color) {
-    SDL_Rect fillRect = {x * currentSize, y * currentSize, currentSize, currentSize};
-    SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
-    SDL_RenderFillRect(renderer, &fillRect);
+    return limitAnimation ? LIMITED_RATE : FREE_RUNNING;
 }
 
-bool isFireNearby(int x, int y, NeighborhoodLogic logic) {
-    // Von Neumann neighborhood: up, down, left, right
-    if ((x > 0 && forest[x - 1][y] == FIRE) ||
-        (y > 0 && forest[x][y - 1] == FIRE) ||
-        (x < currentWidth - 1 && forest[x + 1][y] == FIRE) ||
-        (y < currentHeight - 1 && forest[x][y + 1] == FIRE))
-        return true;
+void initForest() {
+    SimulationCommand command{RESET_FOREST};
+    command.params.seed = simulationSeed;
+    simulation.send(command);
+}
 
-    // If Moore neighborhood is not selected, or we found fire in Von Neumann neighborhood, no need to check further.
-    if (logic == VON_NEUMANN)
-        return false;
+// Starts recording every generation from the current one on, or stops the recording in progress. A reset or resize
+// of the grid stops it as well.
+void toggleRecording() {
+    SimulationCommand command{STOP_RECORDING};
 
-    // Moore neighborhood: also consider diagonals
-    return (x > 0 && y > 0 && forest[x - 1][y - 1] == FIRE) ||
-           (x < currentWidth - 1 && y > 0 && forest[x + 1][y - 1] == FIRE) ||
-           (x > 0 && y < currentHeight - 1 && forest[x - 1][y + 1] == FIRE) ||
-           (x < currentWidth - 1 && y < currentHeight - 1 && forest[x + 1][y + 1] == FIRE);
+    if (!recording) {
+        command.type = START_RECORDING;
+        command.path = recordingFile;
+    }
+
+    simulation.send(command);
 }
 
-void stepForest(double p, double g) {
-    std::vector<std::vector<CellState>> newForest = forest;
+// Starts capturing every captureInterval-th generation from the current one on, the simulation and replays alike, or
+// stops the capture in progress. A resize of the grid stops it as well.
+void toggleCapture() {
+    SimulationCommand command{STOP_CAPTURE};
+
+    if (!capturing) {
+        command.type = START_CAPTURE;
+        command.capture.path = captureFile;
+        command.capture.format = captureFormat;
+        command.capture.policy = capturePolicy;
+        command.capture.interval = captureInterval;
+        command.capture.palette = capturePalette;
+
+        if (captureFormat == CAPTURE_Y4M && !command.capture.path.ends_with(".y4m"))
+            command.capture.path += ".y4m";
+    }
+
+    simulation.send(command);
+}
 
-    // Prepare RNGs for each thread
-    auto maxThreads = omp_get_max_threads();
-    std::vector<std::mt19937> randomGens;
-    std::random_device rd;
+// Shows the first recorded generation, the simulation pauses until the replay is closed.
+void openReplay() {
+    SimulationCommand command{OPEN_REPLAY};
+    command.path = recordingFile;
+    simulation.send(command);
+}
 
-    for (int i = 0; i < maxThreads; ++i)
-        randomGens.emplace_back(rd());
+// Queues a benchmark of the current settings for every grid size in benchmarkSizes. False if none of them is valid.
+bool startBenchmark() {
+    auto sizes = parseList<std::pair<int, int>>(benchmarkSizes, [](const std::string &item) {
+        int width = 0, height = 0;
+        int fields = std::sscanf(item.c_str(), "%dx%d", &width, &height);
+        return std::pair{width, fields == 2 ? height : width};
+    });
 
-    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    benchmarkResults.clear();
+    progressAllSteps = 0.0f;
 
-#pragma omp parallel for collapse(2) default(none) shared(forest, newForest, currentLogic, p, g, randomGens, currentWidth, currentHeight) private(dist)
-    for (int x = 0; x < currentWidth; ++x) {
-        for (int y = 0; y < currentHeight; ++y) {
-            std::mt19937 &rngLocal = randomGens[omp_get_thread_num()];
+    for (auto [width, height]: sizes) {
+        if (width < MIN_GRID_SIDE || width > MAX_GRID_SIDE || height < MIN_GRID_SIDE || height > MAX_GRID_SIDE)
+            continue;
 
-            if (forest[x][y] == FIRE) {
-                newForest[x][y] = EMPTY;
-            } else if (forest[x][y] == TREE) {
-                bool fireNearby = isFireNearby(x, y, currentLogic);
+        SimulationCommand command{MEASURE_STEPS};
+        command.benchmark = {width, height, benchmarkWarmup, benchmarkSteps, benchmarkTrials};
 
-                if (fireNearby || dist(rngLocal) < p)
-                    newForest[x][y] = FIRE;
-            } else if (forest[x][y] == EMPTY) {
-                if (dist(rngLocal) < g)
-                    newForest[x][y] = TREE;
-            }
-        }
+        if (simulation.send(command))
+            progressAllSteps += static_cast<float>((benchmarkWarmup + benchmarkSteps) * benchmarkTrials);
     }
 
-    forest = newForest;
+    return progressAllSteps > 0.0f;
+}
+
+// Replaces the baseline of every configuration and size the last benchmark measured and keeps the others.
+bool saveBenchmarkBaseline() {
+    for (const auto &result: benchmarkResults) {
+        auto saved = std::find_if(baselineResults.begin(), baselineResults.end(), [&](const BenchmarkResult &r) {
+            return sameMeasurement(r, result);
+        });
+
+        if (saved != baselineResults.end())
+            *saved = result;
+        else
+            baselineResults.push_back(result);
+    }
+
+    return saveBaseline(BASELINE_FILE, baselineResults);
 }
 
 void resetMeasure() {
     startMeasure = false;
-    currentStep = 0;
     progressCurrentStep = 0;
-    maxSteps = 0;
 }
 
-void nextSteps() {
-    currentStep = 0;
-    maxSteps = measureSteps.top();
-    measureSteps.pop();
+// Appends the histogram to CLUSTERS_FILE, which gets a header when it is new.
+bool saveClusters(const ClusterResult &result) {
+    std::FILE *out = std::fopen(CLUSTERS_FILE, "a");
+
+    if (out == nullptr)
+        return false;
+
+    std::fseek(out, 0, SEEK_END);
+
+    if (std::ftell(out) == 0)
+        std::fprintf(out, "generation,size_from,size_to,clusters,density\n");
+
+    writeClusterHistogram(out, result.histogram, result.generation);
+    return std::fclose(out) == 0;
 }
\ No newline at end of file
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <utility>
+
+#include <omp.h>
+
+#include "Placement.cpp"
+#include "Random.cpp"
+
+const std::size_t CELL_ALIGNMENT = 64;
+
+enum CellState : std::uint8_t {
+    TREE, FIRE, EMPTY
+};
+
+enum NeighborhoodLogic {
+    MOORE,
+    VON_NEUMANN
+};
+
+// What lies beyond the edge of the grid: nothing that could burn, or the opposite edge, which makes the grid a torus
+// and the forest free of edge effects.
+enum BoundaryMode {
+    FIXED_BOUNDARY,
+    PERIODIC_BOUNDARY
+};
+
+enum StepKernel {
+    CELL_KERNEL,
+    BITPLANE_KERNEL,
+    FRONTIER_KERNEL,
+    TILED_KERNEL,
+    TEMPORAL_KERNEL
+};
+
+// Generations the temporal kernel may advance a tile by in one pass, as many as its halo is cells wide.
+const int MAX_BLOCK_DEPTH = 64;
+
+// Everything a step kernel needs besides the grid and the generation it computes.
+struct StepParams {
+    // Per-cell draw thresholds. Zero when lightning and growth are skip-sampled after the deterministic part of
+    // the step instead of drawn for every cell.
+    [[nodiscard]] std::uint64_t igniteThreshold() const {
+        return skipSampling ? 0 : probabilityThreshold(p);
+    }
+
+    [[nodiscard]] std::uint64_t growThreshold() const {
+        return skipSampling ? 0 : probabilityThreshold(g);
+    }
+
+    // Generations one step advances the grid by, and so the step indices it uses up: blockDepth for the temporal
+    // kernel, one otherwise. A step of instant burning lasts until the next strike, but only uses up one index.
+    [[nodiscard]] std::uint64_t stepLength() const {
+        return kernel == TEMPORAL_KERNEL && !instantBurn ? std::clamp(blockDepth, 1, MAX_BLOCK_DEPTH) : 1;
+    }
+
+    bool operator==(const StepParams &) const = default;
+
+public:
+    double p{}, g{};
+    NeighborhoodLogic logic{VON_NEUMANN};
+    StepKernel kernel{CELL_KERNEL};
+    std::uint64_t seed{};
+    bool skipSampling{false};
+    // Burn the whole cluster of a struck tree within the step, see stepInstantBurn.
+    bool instantBurn{false};
+    // Generations the temporal kernel advances every tile by while it is in cache.
+    int blockDepth{8};
+    BoundaryMode boundary{FIXED_BOUNDARY};
+};
+
+// Observables of one step, counted by the kernel while it computes the step, so they cost no extra pass over the
+// grid. Every cell burning in the new generation was ignited by this step, struck is the part ignited by lightning.
+// A step is one generation, except for instant burning, where it runs up to the next lightning strike.
+struct StepStats {
+    std::uint64_t trees{}, fires{}, struck{}, grown{}, generations{1};
+};
+
+// Row-major grid with one byte per cell and two generations. The step kernels read the current generation,
+// write every cell of the next one and then swap() the pointers, so no generation is ever copied.
+struct ForestGrid {
+    ForestGrid(int width, int height) {
+        resize(width, height);
+    }
+
+    ~ForestGrid() {
+        release();
+    }
+
+    ForestGrid(const ForestGrid &) = delete;
+    ForestGrid &operator=(const ForestGrid &) = delete;
+
+    // Keeps the overlapping region of the current generation, new cells start out EMPTY. Both generations are first
+    // touched row by row in the static partition of the row loops of the step kernels, so on a NUMA host the pages
+    // of the rows a thread steps are on its own node.
+    void resize(int newWidth, int newHeight) {
+        if (newWidth == width && newHeight == height)
+            return;
+
+        const std::size_t newAlignment = placedAlignment(static_cast<std::size_t>(newWidth) * newHeight,
+                                                         CELL_ALIGNMENT);
+        auto newCells = allocate(static_cast<std::size_t>(newWidth) * newHeight, newAlignment);
+        auto newNext = allocate(static_cast<std::size_t>(newWidth) * newHeight, newAlignment);
+        const int keptHeight = std::min(height, newHeight), keptWidth = std::min(width, newWidth);
+
+#pragma omp parallel for schedule(static) default(none) shared(newCells, newNext, newWidth, newHeight, keptHeight, keptWidth)
+        for (int y = 0; y < newHeight; ++y) {
+            CellState *cellsRow = newCells + static_cast<std::size_t>(y) * newWidth;
+            const int kept = y < keptHeight ? keptWidth : 0;
+
+            if (kept > 0)
+                std::memcpy(cellsRow, row(y), kept);
+
+            std::memset(cellsRow + kept, EMPTY, newWidth - kept);
+            std::memset(newNext + static_cast<std::size_t>(y) * newWidth, EMPTY, newWidth);
+        }
+
+        release();
+
+        cells = newCells;
+        nextCells = newNext;
+        alignment = newAlignment;
+        width = newWidth;
+        height = newHeight;
+        markEdited();
+    }
+
+    // Must be called after cells were changed outside a step kernel. Kernels that keep state derived from the grid
+    // (like the fire front) compare this stamp to find out they have to rebuild it. Stamps are unique across grids.
+    void markEdited() {
+        static std::atomic<std::uint64_t> stamps{0};
+        editStamp = ++stamps;
+    }
+
+    void swap() {
+        std::swap(cells, nextCells);
+    }
+
+    [[nodiscard]] std::size_t size() const {
+        return static_cast<std::size_t>(width) * height;
+    }
+
+    [[nodiscard]] std::size_t index(int x, int y) const {
+        return static_cast<std::size_t>(y) * width + x;
+    }
+
+    [[nodiscard]] CellState at(int x, int y) const {
+        return cells[index(x, y)];
+    }
+
+    CellState &at(int x, int y) {
+        return cells[index(x, y)];
+    }
+
+    CellState &next(int x, int y) {
+        return nextCells[index(x, y)];
+    }
+
+    [[nodiscard]] const CellState *row(int y) const {
+        return cells + static_cast<std::size_t>(y) * width;
+    }
+
+    CellState *row(int y) {
+        return cells + static_cast<std::size_t>(y) * width;
+    }
+
+    CellState *nextRow(int y) {
+        return nextCells + static_cast<std::size_t>(y) * width;
+    }
+
+public:
+    int width{}, height{};
+    CellState *cells{};
+    CellState *nextCells{};
+    std::uint64_t editStamp{};
+
+private:
+    static CellState *allocate(std::size_t count, std::size_t alignment) {
+        // Rounded up so vectorized loops may always touch whole cache lines.
+        return static_cast<CellState *>(allocatePlaced(count, alignment));
+    }
+
+    void release() {
+        releasePlaced(cells, alignment);
+        releasePlaced(nextCells, alignment);
+        cells = nextCells = nullptr;
+    }
+
+    // Of both generations, as they were allocated with.
+    std::size_t alignment{CELL_ALIGNMENT};
+};
+
+// Calls visit(index) for every neighbor of cell (x, y). With a fixed boundary, neighbors beyond the edge do not
+// exist, with a periodic one they wrap around to the opposite edge.
+template<BoundaryMode Boundary, typename Visit>
+inline void forEachNeighbor(int width, int height, int x, int y, bool moore, Visit visit) {
+    int left = x - 1, right = x + 1, up = y - 1, down = y + 1;
+
+    if constexpr (Boundary == PERIODIC_BOUNDARY) {
+        left = left < 0 ? width - 1 : left;
+        right = right == width ? 0 : right;
+        up = up < 0 ? height - 1 : up;
+        down = down == height ? 0 : down;
+    }
+
+    bool hasLeft = left >= 0, hasRight = right < width, hasUp = up >= 0, hasDown = down < height;
+    auto index = [width](int nx, int ny) { return static_cast<std::size_t>(ny) * width + nx; };
+
+    if (hasLeft)
+        visit(index(left, y));
+    if (hasRight)
+        visit(index(right, y));
+    if (hasUp)
+        visit(index(x, up));
+    if (hasDown)
+        visit(index(x, down));
+
+    if (moore) {
+        if (hasUp && hasLeft)
+            visit(index(left, up));
+        if (hasUp && hasRight)
+            visit(index(right, up));
+        if (hasDown && hasLeft)
+            visit(index(left, down));
+        if (hasDown && hasRight)
+            visit(index(right, down));
+    }
+}
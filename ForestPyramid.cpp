@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+#include <omp.h>
+
+#include "ForestGrid.cpp"
+
+// Side of the square tiles, in cells of their level, in which the pyramid tracks what changed.
+const int PYRAMID_TILE = 64;
+
+// Part of one level of the pyramid, in cells of that level. Level 0 is the grid itself.
+struct ViewRegion {
+    bool operator==(const ViewRegion &) const = default;
+
+public:
+    int level{}, x{}, y{}, width{}, height{};
+};
+
+// Cells per side of a level: every cell of level l covers a block of 2^l x 2^l grid cells, the last ones in a row
+// or column possibly fewer.
+inline int levelSize(int gridSize, int level) {
+    return static_cast<int>((static_cast<std::int64_t>(gridSize) + (1ll << level) - 1) >> level);
+}
+
+// Highest level worth keeping: the one at which the whole grid is a single tile.
+inline int topLevel(int width, int height) {
+    int level = 0;
+
+    while (levelSize(std::max(width, height), level) > PYRAMID_TILE)
+        level++;
+
+    return level;
+}
+
+// Downsampled copies of the grid for views that are zoomed out below one cell per pixel. A cell of level l + 1 is
+// FIRE if any of the four cells below it burns, so a fire stays visible at every zoom, and otherwise TREE if at least
+// two of them are trees. Levels are brought up to date incrementally and only under the view: a tile of level 1 is
+// recomputed once the grid changed since it last was, a tile of every higher level once a tile below it changed.
+struct ForestPyramid {
+    // Brings the tiles under view, on its level and every level from 1 up to it, up to date with generation step of
+    // the grid. Every other tile is left as it is, and caught up with once it is under the view again.
+    void update(const ForestGrid &grid, std::uint64_t step, const ViewRegion &view) {
+        const int level = std::min(view.level, topLevel(grid.width, grid.height));
+        const bool resized = grid.width != width || grid.height != height;
+
+        if (resized) {
+            width = grid.width;
+            height = grid.height;
+            levels.assign(topLevel(width, height) + 1, {});
+
+            for (int l = 1; l < static_cast<int>(levels.size()); ++l)
+                levels[l].resize(levelSize(width, l), levelSize(height, l));
+        }
+
+        if (resized || grid.editStamp != editStamp || step != updatedStep)
+            gridVersion++;
+
+        editStamp = grid.editStamp;
+        updatedStep = step;
+
+        if (level < 1 || view.width <= 0 || view.height <= 0)
+            return;
+
+        // The tiles under the view on its level, then the tiles below those on every level down to 1. A view on a
+        // level above the top one covers 2^shift cells of the top level per cell.
+        std::vector<TileRange> ranges(level + 1);
+        const int shift = view.level - level;
+        ranges[level] = {(view.x << shift) / PYRAMID_TILE, (view.y << shift) / PYRAMID_TILE,
+                         (((view.x + view.width) << shift) + PYRAMID_TILE - 1) / PYRAMID_TILE,
+                         (((view.y + view.height) << shift) + PYRAMID_TILE - 1) / PYRAMID_TILE};
+
+        for (int l = level - 1; l >= 1; --l) {
+            const auto &above = ranges[l + 1];
+            ranges[l] = {2 * above.x0, 2 * above.y0, 2 * above.x1, 2 * above.y1};
+        }
+
+        for (int l = 1; l <= level; ++l) {
+            auto &current = levels[l];
+            auto &range = ranges[l];
+            range.x1 = std::min(range.x1, current.columns);
+            range.y1 = std::min(range.y1, current.rows);
+
+            if (range.x0 >= range.x1 || range.y0 >= range.y1)
+                return;
+
+            const int columns = range.x1 - range.x0, tiles = columns * (range.y1 - range.y0);
+            const std::uint64_t version = gridVersion;
+
+#pragma omp parallel for schedule(dynamic) default(none) shared(grid, current, range, columns, tiles, version, l)
+            for (int tile = 0; tile < tiles; ++tile) {
+                int column = range.x0 + tile % columns, row = range.y0 + tile / columns;
+                auto index = static_cast<std::size_t>(row) * current.columns + column;
+                std::uint64_t source = l == 1 ? version : levels[l - 1].lastChange(2 * column, 2 * row);
+
+                if (current.computed[index] >= source)
+                    continue;
+
+                if (downsampleTile(grid, l, column, row))
+                    current.changed[index] = version;
+
+                current.computed[index] = version;
+            }
+        }
+    }
+
+    [[nodiscard]] const CellState *row(int level, int y) const {
+        return levels[level].cells.data() + static_cast<std::size_t>(y) * levels[level].width;
+    }
+
+private:
+    // Tiles from (x0, y0) up to (x1, y1), not including those.
+    struct TileRange {
+        int x0{}, y0{}, x1{}, y1{};
+    };
+
+    struct Level {
+        void resize(int newWidth, int newHeight) {
+            width = newWidth;
+            height = newHeight;
+            columns = (width + PYRAMID_TILE - 1) / PYRAMID_TILE;
+            rows = (height + PYRAMID_TILE - 1) / PYRAMID_TILE;
+            cells.assign(static_cast<std::size_t>(width) * height, EMPTY);
+            computed.assign(static_cast<std::size_t>(columns) * rows, 0);
+            changed.assign(computed.size(), 0);
+        }
+
+        // The latest version of the grid at which any of the up to four tiles from (column, row) to (column + 1,
+        // row + 1) changed.
+        [[nodiscard]] std::uint64_t lastChange(int column, int row) const {
+            std::uint64_t latest = 0;
+
+            for (int r = row; r < std::min(row + 2, rows); ++r)
+                for (int c = column; c < std::min(column + 2, columns); ++c)
+                    latest = std::max(latest, changed[static_cast<std::size_t>(r) * columns + c]);
+
+            return latest;
+        }
+
+    public:
+        int width{}, height{}, columns{}, rows{};
+        std::vector<CellState> cells;
+        // Per tile, the version of the grid it was last computed from, and the one at which its cells last changed.
+        std::vector<std::uint64_t> computed, changed;
+    };
+
+    // Recomputes one tile of level from the level below and reports whether any of its cells changed. A level below
+    // with an odd size has its last row or column count twice.
+    bool downsampleTile(const ForestGrid &grid, int level, int column, int row) {
+        auto &target = levels[level];
+        const int belowWidth = level == 1 ? grid.width : levels[level - 1].width;
+        const int belowHeight = level == 1 ? grid.height : levels[level - 1].height;
+        const int x0 = column * PYRAMID_TILE, x1 = std::min(x0 + PYRAMID_TILE, target.width);
+        const int y0 = row * PYRAMID_TILE, y1 = std::min(y0 + PYRAMID_TILE, target.height);
+        const int pairs = std::min(x1, belowWidth / 2);
+        bool changed = false;
+
+        for (int y = y0; y < y1; ++y) {
+            int upperY = 2 * y, lowerY = std::min(2 * y + 1, belowHeight - 1);
+            const CellState *upper = level == 1 ? grid.row(upperY) : this->row(level - 1, upperY);
+            const CellState *lower = level == 1 ? grid.row(lowerY) : this->row(level - 1, lowerY);
+            CellState *out = target.cells.data() + static_cast<std::size_t>(y) * target.width;
+            std::uint8_t differs = 0;
+
+            // Branch-free on the values of CellState, so the loop over the pairs vectorizes: only FIRE is odd and
+            // only TREE is zero, and with at most two trees among four cells, three or four of them are not trees.
+            static_assert(TREE == 0 && FIRE == 1 && EMPTY == 2);
+            auto combine = [](CellState a, CellState b, CellState c, CellState d) {
+                unsigned fire = (a | b | c | d) & 1u;
+                unsigned others = ((a | a >> 1) & 1u) + ((b | b >> 1) & 1u) + ((c | c >> 1) & 1u) + ((d | d >> 1) & 1u);
+                unsigned empty = ((others + 5u) >> 3) & ~fire;
+                return static_cast<CellState>(fire | empty << 1);
+            };
+
+            for (int x = x0; x < pairs; ++x) {
+                auto cell = combine(upper[2 * x], upper[2 * x + 1], lower[2 * x], lower[2 * x + 1]);
+                differs |= out[x] != cell;
+                out[x] = cell;
+            }
+
+            for (int x = std::max(x0, pairs); x < x1; ++x) {
+                int right = std::min(2 * x + 1, belowWidth - 1);
+                auto cell = combine(upper[2 * x], upper[right], lower[2 * x], lower[right]);
+                differs |= out[x] != cell;
+                out[x] = cell;
+            }
+
+            changed |= differs != 0;
+        }
+
+        return changed;
+    }
+
+    int width{}, height{};
+    // Counts the changes of the grid: every edit, step or resize seen by update.
+    std::uint64_t editStamp{}, updatedStep{}, gridVersion{};
+    std::vector<Level> levels;
+};
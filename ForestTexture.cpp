@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#include <SDL_render.h>
+
+// Streaming texture holding one pixel per cell of the snapshot, which is the visible part of one level of the
+// pyramid. Every frame the latest snapshot is converted to RGBA through a three entry palette straight into the locked
+// texture, which is then drawn once, placed and scaled by the viewport. The texture only grows, to the next power of
+// two, so panning and zooming do not recreate it every frame.
+struct ForestTexture {
+    void update(SDL_Renderer *target, const ForestSnapshot &snapshot, SDL_Color treeColor, SDL_Color fireColor,
+                SDL_Color emptyColor) {
+        width = snapshot.region.width;
+        height = snapshot.region.height;
+
+        if (width == 0 || height == 0)
+            return;
+
+        if (texture == nullptr || width > capacityWidth || height > capacityHeight) {
+            destroy();
+            capacityWidth = std::max(static_cast<int>(std::bit_ceil(static_cast<unsigned>(width))), capacityWidth);
+            capacityHeight = std::max(static_cast<int>(std::bit_ceil(static_cast<unsigned>(height))), capacityHeight);
+            texture = SDL_CreateTexture(target, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, capacityWidth,
+                                        capacityHeight);
+        }
+
+        if (texture == nullptr)
+            return;
+
+        // Indexed by CellState
+        const Uint32 palette[] = {packColor(treeColor), packColor(fireColor), packColor(emptyColor)};
+
+        SDL_Rect area = {0, 0, width, height};
+        void *pixels;
+        int pitch;
+
+        if (SDL_LockTexture(texture, &area, &pixels, &pitch) != 0)
+            return;
+
+#pragma omp parallel for default(none) shared(snapshot, palette, pixels, pitch)
+        for (int y = 0; y < snapshot.region.height; ++y) {
+            const CellState *row = snapshot.row(y);
+            auto *dst = reinterpret_cast<Uint32 *>(static_cast<Uint8 *>(pixels) + static_cast<std::size_t>(y) * pitch);
+
+            for (int x = 0; x < snapshot.region.width; ++x)
+                dst[x] = palette[row[x]];
+        }
+
+        SDL_UnlockTexture(texture);
+
+        region = snapshot.region;
+        gridWidth = snapshot.gridWidth;
+        gridHeight = snapshot.gridHeight;
+    }
+
+    // The cells of the last row and column of a level may cover less than a full block of the grid, the drawn
+    // rectangle ends at the edge of the grid all the same.
+    void draw(SDL_Renderer *target, const Viewport &viewport, int windowWidth, int windowHeight) const {
+        if (texture == nullptr || width == 0 || height == 0)
+            return;
+
+        auto toGrid = [this](int position, int size) {
+            return std::min(static_cast<double>(position) * (1 << region.level), static_cast<double>(size));
+        };
+
+        double left = viewport.windowX(toGrid(region.x, gridWidth), windowWidth);
+        double top = viewport.windowY(toGrid(region.y, gridHeight), windowHeight);
+        double right = viewport.windowX(toGrid(region.x + region.width, gridWidth), windowWidth);
+        double bottom = viewport.windowY(toGrid(region.y + region.height, gridHeight), windowHeight);
+
+        SDL_Rect source = {0, 0, width, height};
+        SDL_FRect destination = {static_cast<float>(left), static_cast<float>(top), static_cast<float>(right - left),
+                                 static_cast<float>(bottom - top)};
+        SDL_RenderCopyF(target, texture, &source, &destination);
+    }
+
+    void destroy() {
+        if (texture != nullptr)
+            SDL_DestroyTexture(texture);
+        texture = nullptr;
+    }
+
+private:
+    // SDL_PIXELFORMAT_RGBA32 is laid out R, G, B, A in memory on every platform.
+    static Uint32 packColor(SDL_Color color) {
+        Uint32 packed;
+        const Uint8 bytes[] = {color.r, color.g, color.b, color.a};
+        std::memcpy(&packed, bytes, sizeof(packed));
+        return packed;
+    }
+
+    SDL_Texture *texture{};
+    int width{}, height{}, capacityWidth{}, capacityHeight{};
+    ViewRegion region;
+    int gridWidth{}, gridHeight{};
+};
+
+static ForestTexture forestTexture;
@@ -0,0 +1,454 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ForestGrid.cpp"
+#include "SpscQueue.cpp"
+#include "Tracing.cpp"
+
+// Numbered PPM or PNG images, one per captured generation, or a single raw Y4M video.
+enum CaptureFormat {
+    CAPTURE_PPM,
+    CAPTURE_PNG,
+    CAPTURE_Y4M
+};
+
+const char *CAPTURE_FORMAT_NAMES[] = {"ppm", "png", "y4m"};
+
+// What happens to a generation that is due while every frame buffer waits for an encoder: it is dropped, or it is
+// dropped and the capture interval doubles until the encoders have caught up again, which keeps the captured
+// generations evenly spaced. Neither makes the stepping thread wait.
+enum CapturePolicy {
+    CAPTURE_DROP,
+    CAPTURE_THROTTLE
+};
+
+const char *CAPTURE_POLICY_NAMES[] = {"drop", "throttle"};
+
+// Frame buffers of every encoder thread.
+const int CAPTURE_BUFFERS = 4;
+
+const int MAX_CAPTURE_WORKERS = 16;
+
+// Longest interval the throttle policy backs off to, in generations.
+const int MAX_CAPTURE_INTERVAL = 1 << 16;
+
+// RGB of TREE, FIRE and EMPTY, the cell states in that order.
+using CapturePalette = std::array<std::array<std::uint8_t, 3>, 3>;
+
+// The default colors of the viewer.
+const CapturePalette DEFAULT_CAPTURE_PALETTE = {{{0, 128, 0}, {200, 0, 0}, {239, 239, 239}}};
+
+struct CaptureSettings {
+    // Prefix of the numbered images, path_000000.png and on, or the file of the Y4M video.
+    std::string path;
+    CaptureFormat format{CAPTURE_PNG};
+    CapturePolicy policy{CAPTURE_DROP};
+    // Generations from one captured generation to the next.
+    int interval{1};
+    int workers{2};
+    // Frame rate written into the Y4M header.
+    int framesPerSecond{30};
+    CapturePalette palette{DEFAULT_CAPTURE_PALETTE};
+};
+
+// CRC-32 of PNG chunks, table driven.
+inline std::uint32_t pngCrc(const std::uint8_t *data, std::size_t size, std::uint32_t crc = 0) {
+    static const auto table = [] {
+        std::array<std::uint32_t, 256> entries{};
+
+        for (std::uint32_t n = 0; n < 256; ++n) {
+            std::uint32_t c = n;
+
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+
+            entries[n] = c;
+        }
+
+        return entries;
+    }();
+
+    crc = ~crc;
+
+    for (std::size_t i = 0; i < size; ++i)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+inline void appendBigEndian(std::vector<std::uint8_t> &out, std::uint32_t value) {
+    out.insert(out.end(), {static_cast<std::uint8_t>(value >> 24), static_cast<std::uint8_t>(value >> 16),
+                           static_cast<std::uint8_t>(value >> 8), static_cast<std::uint8_t>(value)});
+}
+
+// Starts a chunk of the given type, whose data the caller appends to out before calling endPngChunk.
+inline std::size_t beginPngChunk(std::vector<std::uint8_t> &out, const char *type) {
+    const std::size_t start = out.size();
+    appendBigEndian(out, 0);
+    out.insert(out.end(), type, type + 4);
+    return start;
+}
+
+// Fills in the length of the chunk that starts at start and appends its CRC.
+inline void endPngChunk(std::vector<std::uint8_t> &out, std::size_t start) {
+    const auto length = static_cast<std::uint32_t>(out.size() - start - 8);
+
+    for (int i = 0; i < 4; ++i)
+        out[start + i] = static_cast<std::uint8_t>(length >> (24 - 8 * i));
+
+    appendBigEndian(out, pngCrc(out.data() + start + 4, length + 4));
+}
+
+// An indexed PNG with two bits per cell, which are the cell states themselves, so a frame needs no palette lookup and
+// a quarter of the bytes of RGB. The image data goes into stored deflate blocks: no compression, but nothing to
+// search either, so an encoder keeps up with the simulation. raw is scratch for the filtered rows.
+void encodePng(const CellState *cells, int width, int height, const CapturePalette &palette,
+               std::vector<std::uint8_t> &raw, std::vector<std::uint8_t> &out) {
+    static_assert(TREE == 0 && FIRE == 1 && EMPTY == 2);
+    const std::size_t rowBytes = (static_cast<std::size_t>(width) + 3) / 4 + 1;
+
+    raw.assign(rowBytes * height, 0);
+
+    for (int y = 0; y < height; ++y) {
+        std::uint8_t *row = raw.data() + rowBytes * y + 1;
+        const CellState *source = cells + static_cast<std::size_t>(y) * width;
+
+        for (int x = 0; x < width; ++x)
+            row[x / 4] |= static_cast<std::uint8_t>(source[x] << (6 - 2 * (x % 4)));
+    }
+
+    out.assign({0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'});
+
+    auto chunk = beginPngChunk(out, "IHDR");
+    appendBigEndian(out, width);
+    appendBigEndian(out, height);
+    out.insert(out.end(), {2, 3, 0, 0, 0});
+    endPngChunk(out, chunk);
+
+    chunk = beginPngChunk(out, "PLTE");
+
+    for (const auto &color: palette)
+        out.insert(out.end(), color.begin(), color.end());
+
+    endPngChunk(out, chunk);
+
+    // A zlib stream of stored blocks of at most 65535 bytes, then the Adler-32 of the data.
+    chunk = beginPngChunk(out, "IDAT");
+    out.insert(out.end(), {0x78, 0x01});
+    std::uint32_t a = 1, b = 0;
+
+    for (std::size_t offset = 0;; offset += 65535) {
+        const auto length = static_cast<std::uint16_t>(std::min<std::size_t>(65535, raw.size() - offset));
+        const bool last = offset + length == raw.size();
+
+        out.insert(out.end(), {static_cast<std::uint8_t>(last), static_cast<std::uint8_t>(length),
+                               static_cast<std::uint8_t>(length >> 8), static_cast<std::uint8_t>(~length),
+                               static_cast<std::uint8_t>(~length >> 8)});
+        out.insert(out.end(), raw.begin() + static_cast<std::ptrdiff_t>(offset),
+                   raw.begin() + static_cast<std::ptrdiff_t>(offset + length));
+
+        for (std::size_t i = offset; i < offset + length; ++i) {
+            a = (a + raw[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+
+        if (last)
+            break;
+    }
+
+    appendBigEndian(out, b << 16 | a);
+    endPngChunk(out, chunk);
+    endPngChunk(out, beginPngChunk(out, "IEND"));
+}
+
+// A binary PPM, RGB through the palette.
+void encodePpm(const CellState *cells, int width, int height, const CapturePalette &palette,
+               std::vector<std::uint8_t> &out) {
+    char header[64];
+    int length = std::snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+    const std::size_t count = static_cast<std::size_t>(width) * height;
+
+    out.resize(length + 3 * count);
+    std::memcpy(out.data(), header, length);
+    std::uint8_t *pixel = out.data() + length;
+
+    for (std::size_t i = 0; i < count; ++i, pixel += 3)
+        std::memcpy(pixel, palette[cells[i]].data(), 3);
+}
+
+// One Y4M frame in 4:2:0 with full range BT.601 colors, chroma averaged over every 2 x 2 block of cells, or what is
+// left of it at an odd edge.
+void encodeY4mFrame(const CellState *cells, int width, int height, const CapturePalette &palette,
+                    std::vector<std::uint8_t> &out) {
+    std::array<std::array<int, 3>, 3> yuv{};
+
+    for (int state = 0; state < 3; ++state) {
+        const double r = palette[state][0], g = palette[state][1], b = palette[state][2];
+        yuv[state] = {static_cast<int>(0.299 * r + 0.587 * g + 0.114 * b + 0.5),
+                      static_cast<int>(128.0 - 0.168736 * r - 0.331264 * g + 0.5 * b + 0.5),
+                      static_cast<int>(128.0 + 0.5 * r - 0.418688 * g - 0.081312 * b + 0.5)};
+    }
+
+    const int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+    const std::size_t luma = static_cast<std::size_t>(width) * height;
+    const std::size_t chroma = static_cast<std::size_t>(chromaWidth) * chromaHeight;
+    const char marker[] = "FRAME\n";
+
+    out.resize(sizeof(marker) - 1 + luma + 2 * chroma);
+    std::memcpy(out.data(), marker, sizeof(marker) - 1);
+    std::uint8_t *y = out.data() + sizeof(marker) - 1, *cb = y + luma, *cr = cb + chroma;
+
+    for (std::size_t i = 0; i < luma; ++i)
+        y[i] = static_cast<std::uint8_t>(yuv[cells[i]][0]);
+
+    for (int cy = 0; cy < chromaHeight; ++cy)
+        for (int cx = 0; cx < chromaWidth; ++cx) {
+            int sumB = 0, sumR = 0, count = 0;
+
+            for (int row = 2 * cy; row < std::min(2 * cy + 2, height); ++row)
+                for (int column = 2 * cx; column < std::min(2 * cx + 2, width); ++column) {
+                    const auto &color = yuv[cells[static_cast<std::size_t>(row) * width + column]];
+                    sumB += color[1];
+                    sumR += color[2];
+                    count++;
+                }
+
+            cb[static_cast<std::size_t>(cy) * chromaWidth + cx] = static_cast<std::uint8_t>((sumB + count / 2) / count);
+            cr[static_cast<std::size_t>(cy) * chromaWidth + cx] = static_cast<std::uint8_t>((sumR + count / 2) / count);
+        }
+}
+
+// Captures generations of a run while it is being simulated. The thread that steps only copies the cells of a due
+// generation into a free frame buffer of one of the encoder threads, which convert it through the palette, encode
+// and write it. All buffers are allocated up front and handed back and forth through lock-free queues, one pair per
+// encoder, so capturing allocates nothing per frame and never makes a step wait.
+struct FrameCapture {
+    ~FrameCapture() {
+        stop();
+    }
+
+    bool start(const CaptureSettings &captureSettings, const ForestGrid &grid) {
+        stop();
+
+        settings = captureSettings;
+        settings.interval = std::max(settings.interval, 1);
+        settings.workers = std::clamp(settings.workers, 1, MAX_CAPTURE_WORKERS);
+        width = grid.width;
+        height = grid.height;
+        interval = settings.interval;
+        nextGeneration = 0;
+        sequence = 0;
+        cursor = 0;
+        captured = dropped = bytes = written = 0;
+        inFlight = 0;
+        failed = stopping = false;
+
+        if (settings.format == CAPTURE_Y4M) {
+            video = std::fopen(settings.path.c_str(), "wb");
+
+            if (video == nullptr)
+                return false;
+
+            std::fprintf(video, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height,
+                         std::max(settings.framesPerSecond, 1));
+        }
+
+        for (int w = 0; w < settings.workers; ++w) {
+            auto &worker = *workers.emplace_back(std::make_unique<Worker>());
+
+            for (int i = 0; i < CAPTURE_BUFFERS; ++i) {
+                worker.frames[i].cells.resize(grid.size());
+                worker.freeFrames.push(i);
+            }
+
+            worker.thread = std::thread(&FrameCapture::encode, this, std::ref(worker));
+        }
+
+        return true;
+    }
+
+    // Called from the thread that steps the grid, after every step. Copies the generation if it is due, false if it
+    // was not due or had to be dropped.
+    bool capture(const ForestGrid &grid, std::uint64_t generation) {
+        if (workers.empty() || grid.width != width || grid.height != height)
+            return false;
+
+        // A generation before the last one captured, after a reset or a seek back in a replay, starts over.
+        if (generation + interval < nextGeneration)
+            nextGeneration = generation;
+
+        if (generation < nextGeneration)
+            return false;
+
+        // The first encoder with a free buffer, going round from the one after the last frame's.
+        const int count = static_cast<int>(workers.size());
+        int index = -1, w = cursor;
+
+        for (int tried = 0; tried < count && index < 0; ++tried)
+            if (!workers[w = (cursor + tried) % count]->freeFrames.pop(index))
+                index = -1;
+
+        if (index < 0) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+
+            if (settings.policy == CAPTURE_THROTTLE)
+                interval = std::min(2 * interval, MAX_CAPTURE_INTERVAL);
+
+            nextGeneration = generation + interval;
+            return false;
+        }
+
+        // Every encoder idle again, the interval goes back towards the one asked for.
+        if (settings.policy == CAPTURE_THROTTLE && interval > settings.interval &&
+            inFlight.load(std::memory_order_acquire) == 0)
+            interval = std::max(interval / 2, settings.interval);
+
+        TraceScope trace("capture");
+        auto &frame = workers[w]->frames[index];
+        frame.generation = generation;
+        frame.sequence = sequence++;
+        std::memcpy(frame.cells.data(), grid.cells, grid.size());
+
+        inFlight.fetch_add(1, std::memory_order_relaxed);
+        workers[w]->pendingFrames.push(index);
+        cursor = (w + 1) % count;
+        nextGeneration = generation + interval;
+        return true;
+    }
+
+    // Encodes and writes every frame handed over so far. False if any write failed.
+    bool stop() {
+        if (workers.empty())
+            return true;
+
+        stopping = true;
+
+        for (auto &worker: workers)
+            worker->thread.join();
+
+        workers.clear();
+        bool succeeded = !failed;
+
+        if (video != nullptr)
+            succeeded &= std::fclose(video) == 0;
+
+        video = nullptr;
+        return succeeded;
+    }
+
+    [[nodiscard]] bool active() const {
+        return !workers.empty();
+    }
+
+    // Generations from one captured generation to the next, the one asked for unless throttled.
+    [[nodiscard]] int currentInterval() const {
+        return interval;
+    }
+
+public:
+    // Readable from any thread while capturing.
+    std::atomic<std::uint64_t> captured{0}, dropped{0}, bytes{0};
+    std::atomic<bool> failed{false};
+    int width{}, height{};
+
+private:
+    struct Frame {
+        std::uint64_t generation{}, sequence{};
+        std::vector<CellState> cells;
+    };
+
+    struct Worker {
+        std::array<Frame, CAPTURE_BUFFERS> frames;
+        SpscQueue<int, CAPTURE_BUFFERS> freeFrames, pendingFrames;
+        // Scratch of the encoders, which keeps its capacity from frame to frame.
+        std::vector<std::uint8_t> raw, encoded;
+        std::thread thread;
+    };
+
+    void encode(Worker &worker) {
+        tracing.nameThread("capture");
+
+        while (true) {
+            int index;
+
+            // Nothing is handed over after stopping is set, so one more look at the queue drains it.
+            if (!worker.pendingFrames.pop(index)) {
+                if (!stopping.load(std::memory_order_acquire)) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(200));
+                    continue;
+                }
+
+                if (!worker.pendingFrames.pop(index))
+                    break;
+            }
+
+            TraceScope trace("capture encode");
+            const auto &frame = worker.frames[index];
+
+            switch (settings.format) {
+                case CAPTURE_PPM:
+                    encodePpm(frame.cells.data(), width, height, settings.palette, worker.encoded);
+                    break;
+                case CAPTURE_PNG:
+                    encodePng(frame.cells.data(), width, height, settings.palette, worker.raw, worker.encoded);
+                    break;
+                case CAPTURE_Y4M:
+                    encodeY4mFrame(frame.cells.data(), width, height, settings.palette, worker.encoded);
+                    break;
+            }
+
+            write(frame.sequence, worker.encoded);
+            worker.freeFrames.push(index);
+            inFlight.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    // Images go to files of their own, named by their place in the sequence, so every tool that reads numbered
+    // images takes them. The frames of a video are appended in that order, each encoder waiting for its turn.
+    void write(std::uint64_t frameSequence, const std::vector<std::uint8_t> &data) {
+        bool ok;
+
+        if (settings.format == CAPTURE_Y4M) {
+            while (written.load(std::memory_order_acquire) != frameSequence)
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+
+            ok = std::fwrite(data.data(), 1, data.size(), video) == data.size();
+            written.store(frameSequence + 1, std::memory_order_release);
+        } else {
+            char name[600];
+            std::snprintf(name, sizeof(name), "%s_%06llu.%s", settings.path.c_str(),
+                          static_cast<unsigned long long>(frameSequence), CAPTURE_FORMAT_NAMES[settings.format]);
+            std::FILE *out = std::fopen(name, "wb");
+            ok = out != nullptr && std::fwrite(data.data(), 1, data.size(), out) == data.size();
+            ok = out != nullptr && std::fclose(out) == 0 && ok;
+        }
+
+        if (!ok)
+            failed = true;
+
+        captured.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(data.size(), std::memory_order_relaxed);
+    }
+
+    CaptureSettings settings;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::FILE *video{};
+    // Stepping thread only.
+    std::uint64_t nextGeneration{}, sequence{};
+    int interval{1}, cursor{};
+    // The next video frame to append, and the frames handed over that are not written yet.
+    std::atomic<std::uint64_t> written{0};
+    std::atomic<int> inFlight{0};
+    std::atomic<bool> stopping{false};
+};
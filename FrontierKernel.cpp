@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <omp.h>
+
+#include "ForestGrid.cpp"
+#include "Random.cpp"
+#include "SkipSampling.cpp"
+#include "Tracing.cpp"
+
+// Indices of all burning cells of the generation the next step starts from. Only valid while nobody but
+// stepFrontier touched the grid: an edit stamp or step number mismatch means it has to be rebuilt from a scan.
+struct FireFront {
+    [[nodiscard]] bool tracks(const ForestGrid &grid, std::uint64_t step) const {
+        return editStamp == grid.editStamp && nextStep == step;
+    }
+
+    void rebuild(const ForestGrid &grid) {
+        cells.clear();
+
+#pragma omp parallel default(none) shared(grid)
+        {
+            std::vector<std::uint32_t> found;
+
+#pragma omp for nowait
+            for (int y = 0; y < grid.height; ++y) {
+                const CellState *row = grid.row(y);
+
+                for (int x = 0; x < grid.width; ++x)
+                    if (row[x] == FIRE)
+                        found.push_back(static_cast<std::uint32_t>(grid.index(x, y)));
+            }
+
+#pragma omp critical
+            cells.insert(cells.end(), found.begin(), found.end());
+        }
+
+        editStamp = grid.editStamp;
+    }
+
+public:
+    std::vector<std::uint32_t> cells;
+    std::uint64_t editStamp{}, nextStep{};
+};
+
+// Sets a TREE neighbor on fire and reports whether this thread was the one that did it.
+static inline bool igniteTree(CellState &cell) {
+    CellState expected = TREE;
+    return std::atomic_ref<CellState>(cell).compare_exchange_strong(expected, FIRE, std::memory_order_relaxed);
+}
+
+// Sets the TREE neighbors of a burning cell on fire and appends the ones this thread ignited.
+template<BoundaryMode Boundary>
+static inline void igniteNeighbors(CellState *cells, int width, int height, std::uint32_t index, bool moore,
+                                   std::vector<std::uint32_t> &ignited) {
+    int x = static_cast<int>(index % width), y = static_cast<int>(index / width);
+
+    forEachNeighbor<Boundary>(width, height, x, y, moore, [&](std::size_t neighbor) {
+        if (igniteTree(cells[neighbor]))
+            ignited.push_back(static_cast<std::uint32_t>(neighbor));
+    });
+}
+
+// Same rule as the per-cell kernel, updated in place. Fire only spreads from the cells on the fire front, so that
+// part costs O(perimeter) instead of a neighbor check for every tree. Lightning and growth follow in a separate,
+// branch-light pass over the grid using the same per-cell draws as the other kernels, or, when skip-sampled, in
+// O(events) without touching the rest of the grid.
+void stepFrontier(ForestGrid &grid, const StepParams &params, std::uint64_t step, StepStats *stats = nullptr) {
+    thread_local FireFront threadFront;
+    FireFront &front = threadFront;
+
+    if (!front.tracks(grid, step))
+        front.rebuild(grid);
+
+    const int width = grid.width, height = grid.height;
+    const bool moore = params.logic == MOORE, periodic = params.boundary == PERIODIC_BOUNDARY;
+    const auto igniteThreshold = params.igniteThreshold(), growThreshold = params.growThreshold();
+    const auto burning = static_cast<std::int64_t>(front.cells.size());
+    CellState *cells = grid.cells;
+    std::vector<std::uint32_t> nextFront;
+    std::uint64_t struck = 0, grown = 0;
+
+#pragma omp parallel default(none) shared(grid, params, step, front, nextFront, cells, width, height, moore, periodic, igniteThreshold, growThreshold, burning) reduction(+ : struck, grown)
+    {
+        std::vector<std::uint32_t> ignited;
+
+        TraceScope work("front spread");
+
+        // The old front is still FIRE and newly ignited cells are no longer TREE, so neither gets ignited twice.
+#pragma omp for nowait
+        for (std::int64_t i = 0; i < burning; ++i) {
+            if (periodic)
+                igniteNeighbors<PERIODIC_BOUNDARY>(cells, width, height, front.cells[i], moore, ignited);
+            else
+                igniteNeighbors<FIXED_BOUNDARY>(cells, width, height, front.cells[i], moore, ignited);
+        }
+
+        work.end();
+
+#pragma omp barrier
+
+        // Lightning may only hit trees of the previous generation and growth only cells that were empty, so the
+        // old front must stay FIRE until this pass is done.
+        if (params.skipSampling) {
+            auto events = sampleEvents(grid, cells, cells, params, step, [&ignited](std::uint64_t index) {
+                ignited.push_back(static_cast<std::uint32_t>(index));
+            });
+            struck += events.struck;
+            grown += events.grown;
+        } else if (igniteThreshold || growThreshold) {
+#pragma omp for
+            for (int y = 0; y < height; ++y) {
+                CellDraws draws(params.seed, step);
+                CellState *row = grid.row(y);
+
+                for (int x = 0; x < width; ++x) {
+                    if (row[x] == TREE && igniteThreshold && draws(grid.index(x, y)) < igniteThreshold) {
+                        row[x] = FIRE;
+                        ignited.push_back(static_cast<std::uint32_t>(grid.index(x, y)));
+                        struck++;
+                    } else if (row[x] == EMPTY && growThreshold && draws(grid.index(x, y)) < growThreshold) {
+                        row[x] = TREE;
+                        grown++;
+                    }
+                }
+            }
+        }
+
+#pragma omp for
+        for (std::int64_t i = 0; i < burning; ++i)
+            cells[front.cells[i]] = EMPTY;
+
+#pragma omp critical
+        nextFront.insert(nextFront.end(), ignited.begin(), ignited.end());
+    }
+
+    front.cells.swap(nextFront);
+    front.nextStep = step + 1;
+
+    if (stats)
+        *stats = {0, front.cells.size(), struck, grown};
+}
@@ -4,9 +4,8 @@
 
 void createWindow() {
     auto windowFlags = (SDL_WindowFlags) (SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
-    window = SDL_CreateWindow("ForestFire", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-                              currentWidth * currentSize,
-                              currentHeight * currentSize, windowFlags);
+    window = SDL_CreateWindow("ForestFire", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, WINDOW_WIDTH,
+                              WINDOW_HEIGHT, windowFlags);
     renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_PRESENTVSYNC | SDL_RENDERER_ACCELERATED);
 }
 
@@ -16,6 +15,45 @@ void mainMenu() {
             if (ImGui::MenuItem("Reset"))
                 initForest();
 
+            ImGui::Separator();
+            ImGui::InputText("##recording", recordingFile, sizeof(recordingFile));
+
+            if (ImGui::MenuItem("Record run", nullptr, recording, !replaying))
+                toggleRecording();
+
+            if (ImGui::MenuItem("Open replay", nullptr, false, !recording))
+                openReplay();
+
+            if (ImGui::MenuItem("Close replay", nullptr, false, replaying))
+                simulation.send({CLOSE_REPLAY});
+
+            ImGui::Separator();
+            ImGui::InputText("##capture", captureFile, sizeof(captureFile));
+
+            if (ImGui::BeginMenu("Capture settings", !capturing)) {
+                for (int format = CAPTURE_PPM; format <= CAPTURE_Y4M; ++format)
+                    if (ImGui::MenuItem(CAPTURE_FORMAT_NAMES[format], nullptr, captureFormat == format))
+                        captureFormat = static_cast<CaptureFormat>(format);
+
+                ImGui::Separator();
+
+                if (ImGui::InputInt("Every", &captureInterval))
+                    captureInterval = std::clamp(captureInterval, 1, MAX_CAPTURE_INTERVAL);
+
+                // Frames the encoders cannot keep up with are dropped either way, the simulation never waits.
+                bool throttle = capturePolicy == CAPTURE_THROTTLE;
+
+                if (ImGui::MenuItem("Capture less often when behind", nullptr, &throttle))
+                    capturePolicy = throttle ? CAPTURE_THROTTLE : CAPTURE_DROP;
+
+                ImGui::EndMenu();
+            }
+
+            if (ImGui::MenuItem("Capture frames", nullptr, capturing))
+                toggleCapture();
+
+            ImGui::Separator();
+
             if (ImGui::MenuItem("Exit", "Cmd+Q"))
                 running = false;
 
@@ -24,35 +62,57 @@ void mainMenu() {
         if (ImGui::BeginMenu("View")) {
             ImGui::MenuItem("Settings", nullptr, &settingsWindow);
             ImGui::MenuItem("Measurements", nullptr, &measurementWindow);
+            ImGui::MenuItem("Statistics", nullptr, &statisticsWindow);
             ImGui::MenuItem("Colors", nullptr, &colorWindow);
+            ImGui::MenuItem("Frame phases", nullptr, &traceWindow);
             ImGui::EndMenu();
         }
 
+        if (recording)
+            ImGui::TextColored(ImVec4(0.9f, 0.1f, 0.1f, 1.0f), "REC %llu generations, %llu dropped",
+                               static_cast<unsigned long long>(simulation.recordedSteps()),
+                               static_cast<unsigned long long>(simulation.droppedSteps()));
+
+        if (capturing)
+            ImGui::TextColored(ImVec4(0.9f, 0.5f, 0.1f, 1.0f), "CAP %llu frames, %llu dropped",
+                               static_cast<unsigned long long>(simulation.capturedFrames()),
+                               static_cast<unsigned long long>(simulation.droppedFrames()));
+
         ImGui::EndMainMenuBar();
     }
 }
 
-void initSettings(int &lastHeight, int &lastWidth, int &lastSize) {
+void initSettings(int &lastHeight, int &lastWidth) {
     if (settingsWindow) {
         ImGui::SetNextWindowSize(ImVec2(0.0f, 0.0f));
 
         ImGui::Begin("Settings", &settingsWindow);
 
-        ImGui::SliderInt("Height", &currentHeight, 100, 1024);
-        ImGui::SliderInt("Width", &currentWidth, 100, 1024);
-        ImGui::SliderInt("Zoom", &currentSize, 1, 5);
+        ImGui::SliderInt("Height", &currentHeight, MIN_GRID_SIDE, MAX_GRID_SIDE, "%d", ImGuiSliderFlags_Logarithmic);
+        ImGui::SliderInt("Width", &currentWidth, MIN_GRID_SIDE, MAX_GRID_SIDE, "%d", ImGuiSliderFlags_Logarithmic);
+
+        if (ImGui::Button("Fit to window"))
+            fitViewport = true;
+
+        ImGui::SameLine();
+        ImGui::TextDisabled("%.3g pixels per cell, scroll to zoom, right drag to pan", viewport.zoom);
 
         ImGui::SliderFloat("Spontaneous fire", &fire, 0.0f, 0.005f, "%.4f");
         ImGui::SliderFloat("Tree growth", &growth, 0.0f, 0.3f, "%.3f");
 
+        if (ImGui::InputScalar("Seed", ImGuiDataType_U64, &simulationSeed, nullptr, nullptr, nullptr,
+                               ImGuiInputTextFlags_EnterReturnsTrue))
+            initForest();
+
         const char *items[] = {"Von Neumann", "Moore"};
         static const char *currentItem = items[0];
 
-        if (lastHeight != currentHeight || lastWidth != currentWidth || lastSize != currentSize) {
-            SDL_SetWindowSize(window, currentWidth * currentSize, currentHeight * currentSize);
+        // Every new size reallocates the grid, so a size is only sent once the slider is let go.
+        if ((lastHeight != currentHeight || lastWidth != currentWidth) && !ImGui::IsAnyItemActive() &&
+            simulation.send({RESIZE_FOREST, {}, currentWidth, currentHeight})) {
             lastHeight = currentHeight;
             lastWidth = currentWidth;
-            lastSize = currentSize;
+            fitViewport = true;
         }
 
         if (ImGui::BeginCombo("Neighborhood logic", currentItem)) {
@@ -72,6 +132,46 @@ void initSettings(int &lastHeight, int &lastWidth, int &lastSize) {
             ImGui::EndCombo();
         }
 
+        const char *kernels[] = {"Per-cell", "Bitplane", "Fire front", "Tiled", "Temporal blocking"};
+
+        if (ImGui::BeginCombo("Step kernel", kernels[currentKernel])) {
+            for (int i = 0; i < IM_ARRAYSIZE(kernels); ++i) {
+                bool isSelected = (currentKernel == i);
+                if (ImGui::Selectable(kernels[i], isSelected))
+                    currentKernel = static_cast<StepKernel>(i);
+                if (isSelected)
+                    ImGui::SetItemDefaultFocus();
+            }
+
+            ImGui::EndCombo();
+        }
+
+        if (currentKernel == TEMPORAL_KERNEL)
+            ImGui::SliderInt("Generations per pass", &blockDepth, 1, MAX_BLOCK_DEPTH);
+
+        const char *boundaries[] = {"Fixed", "Periodic (torus)"};
+
+        if (ImGui::BeginCombo("Boundary", boundaries[currentBoundary])) {
+            for (int i = 0; i < IM_ARRAYSIZE(boundaries); ++i) {
+                bool isSelected = (currentBoundary == i);
+                if (ImGui::Selectable(boundaries[i], isSelected))
+                    currentBoundary = static_cast<BoundaryMode>(i);
+                if (isSelected)
+                    ImGui::SetItemDefaultFocus();
+            }
+
+            ImGui::EndCombo();
+        }
+
+        ImGui::Checkbox(" Skip-sample lightning and growth", &skipSampling);
+        ImGui::Checkbox(" Instant burn (a step runs to the next strike)", &instantBurn);
+
+        if (ImGui::InputInt("Cluster sizes every", &clusterInterval, 10, 100))
+            clusterInterval = std::max(clusterInterval, 0);
+
+        ImGui::SameLine();
+        ImGui::TextDisabled("steps");
+
         ImGui::Separator();
 
         if (limitAnimation && !stepwiseAnimation) {
@@ -98,4 +198,119 @@ void initSettings(int &lastHeight, int &lastWidth, int &lastSize) {
 
         ImGui::End();
     }
-}
\ No newline at end of file
+}
+
+// Shown while a recorded run is replayed. Playing goes at the pace of the simulation, one record per step, so the
+// speed control and step-by-step mode work on replays as well.
+void replayControls(std::uint64_t shownGeneration) {
+    if (!replaying)
+        return;
+
+    ImGui::SetNextWindowSize(ImVec2(0.0f, 0.0f));
+    ImGui::Begin("Replay");
+
+    auto generation = std::clamp(shownGeneration, replayFirst, replayLast);
+
+    // Generations that were not recorded show the last one recorded before them.
+    if (ImGui::SliderScalar("Generation", ImGuiDataType_U64, &generation, &replayFirst, &replayLast)) {
+        SimulationCommand command{SEEK_REPLAY};
+        command.generation = generation;
+        simulation.send(command);
+    }
+
+    if (ImGui::Button("First")) {
+        SimulationCommand command{SEEK_REPLAY};
+        command.generation = replayFirst;
+        simulation.send(command);
+    }
+
+    ImGui::SameLine();
+
+    if (ImGui::Button("Previous"))
+        simulation.send({STEP_REPLAY, {}, -1});
+
+    ImGui::SameLine();
+
+    if (ImGui::Button("Next"))
+        simulation.send({STEP_REPLAY, {}, 1});
+
+    ImGui::SameLine();
+
+    if (ImGui::Button("Last")) {
+        SimulationCommand command{SEEK_REPLAY};
+        command.generation = replayLast;
+        simulation.send(command);
+    }
+
+    ImGui::SameLine();
+
+    if (ImGui::Button("Continue simulating"))
+        simulation.send({CLOSE_REPLAY});
+
+    ImGui::End();
+}
+
+// Where the frame and the steps spend their time, per phase over the collected spans. Phases that every OpenMP thread
+// records show how unevenly the work of a step is split.
+void framePhases() {
+    if (!traceWindow)
+        return;
+
+    ImGui::SetNextWindowSize(ImVec2(520.0f, 0.0f));
+    ImGui::Begin("Frame phases", &traceWindow);
+
+    bool enabled = tracing.enabled.load(std::memory_order_relaxed);
+
+    if (ImGui::Checkbox(" Record phases", &enabled))
+        tracing.enabled.store(enabled, std::memory_order_relaxed);
+
+    ImGui::SameLine();
+
+    if (ImGui::Button("Clear"))
+        traceLog.clear();
+
+    ImGui::SameLine();
+
+    if (ImGui::Button("Export trace")) {
+        if (traceLog.write(TRACE_FILE))
+            measurements.AddLog("[%s] Wrote %zu spans to %s, open it in chrome://tracing or Perfetto\n", "info",
+                                traceLog.spans.size(), TRACE_FILE);
+        else
+            measurements.AddLog("[%s] Could not write %s!\n", "error", TRACE_FILE);
+    }
+
+    ImGui::TextDisabled("%zu spans, %llu dropped", traceLog.spans.size(),
+                        static_cast<unsigned long long>(tracing.dropped.load(std::memory_order_relaxed)));
+
+    if (ImGui::BeginTable("phases", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+        ImGui::TableSetupColumn("Phase");
+        ImGui::TableSetupColumn("Spans");
+        ImGui::TableSetupColumn("p50 ms");
+        ImGui::TableSetupColumn("p99 ms");
+        ImGui::TableSetupColumn("Threads");
+        ImGui::TableSetupColumn("Busiest / mean");
+        ImGui::TableHeadersRow();
+
+        for (const auto &phase: traceLog.cachedSummaries()) {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(phase.name.c_str());
+            ImGui::TableNextColumn();
+            ImGui::Text("%zu", phase.count);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", phase.p50);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", phase.p99);
+            ImGui::TableNextColumn();
+            ImGui::Text("%d", phase.threads);
+            ImGui::TableNextColumn();
+
+            if (phase.threads > 1)
+                ImGui::Text("%.2f", phase.imbalance);
+        }
+
+        ImGui::EndTable();
+    }
+
+    ImGui::End();
+}
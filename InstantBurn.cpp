@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <omp.h>
+
+#include "ForestGrid.cpp"
+#include "FrontierKernel.cpp"
+#include "SkipSampling.cpp"
+
+// Fronts smaller than this are burned on the calling thread, a parallel level costs more than it saves for them.
+const std::size_t PARALLEL_BURN_FRONT = 1024;
+
+// What an instant-burn step needs from the one before it: the cells its strike burned, which burn out now, and the
+// cell after that strike in the current generation, where the wait for the next strike starts. Only valid while
+// nobody but stepInstantBurn touched the grid, it is rebuilt from a scan otherwise and the wait then starts at the
+// beginning of a generation.
+struct BurnState {
+    [[nodiscard]] bool tracks(const ForestGrid &grid, std::uint64_t step) const {
+        return editStamp == grid.editStamp && nextStep == step;
+    }
+
+    void rebuild(const ForestGrid &grid) {
+        burning.clear();
+
+        for (std::size_t i = 0; i < grid.size(); ++i)
+            if (grid.cells[i] == FIRE)
+                burning.push_back(static_cast<std::uint32_t>(i));
+
+        position = 0;
+        editStamp = grid.editStamp;
+    }
+
+public:
+    std::vector<std::uint32_t> burning;
+    std::vector<std::vector<std::uint32_t>> queues;
+    std::uint64_t position{}, editStamp{}, nextStep{};
+};
+
+// Sets the whole tree cluster of cell on fire, breadth first, and appends its cells to burned. Levels with a large
+// front are expanded by all threads, each into its own queue, and a cell is claimed by whichever thread ignites it
+// first, so every tree is burned exactly once.
+static void burnCluster(ForestGrid &grid, std::uint32_t cell, bool moore, bool periodic, BurnState &state,
+                        std::vector<std::uint32_t> &burned) {
+    const int width = grid.width, height = grid.height;
+    CellState *cells = grid.cells;
+
+    auto spread = [&](std::uint32_t index, std::vector<std::uint32_t> &ignited) {
+        if (periodic)
+            igniteNeighbors<PERIODIC_BOUNDARY>(cells, width, height, index, moore, ignited);
+        else
+            igniteNeighbors<FIXED_BOUNDARY>(cells, width, height, index, moore, ignited);
+    };
+
+    state.queues.resize(omp_get_max_threads());
+    std::size_t begin = burned.size();
+
+    cells[cell] = FIRE;
+    burned.push_back(cell);
+
+    // The current level is burned[begin, end), the next one is appended behind it.
+    while (begin < burned.size()) {
+        std::size_t end = burned.size();
+
+        if (end - begin < PARALLEL_BURN_FRONT) {
+            for (auto i = begin; i < end; ++i)
+                spread(burned[i], burned);
+        } else {
+            const auto front = static_cast<std::int64_t>(end - begin);
+
+#pragma omp parallel default(none) shared(burned, state, spread, begin, front)
+            {
+                auto &ignited = state.queues[omp_get_thread_num()];
+                ignited.clear();
+
+#pragma omp for
+                for (std::int64_t i = 0; i < front; ++i)
+                    spread(burned[begin + i], ignited);
+            }
+
+            for (auto &ignited: state.queues)
+                burned.insert(burned.end(), ignited.begin(), ignited.end());
+        }
+
+        begin = end;
+    }
+}
+
+// The Drossel-Schwabl limit of the model: a struck tree burns its whole cluster within the same step. One step runs
+// from one lightning strike to the next. Strikes hit every cell of every generation with probability p, so the wait
+// for the next one, counted in cells of successive generations, is geometric and drawn directly. All growth of the
+// generations in between is batched into one skip-sampled pass, a cell that stayed empty for k generations growing
+// a tree with probability 1 - (1 - g)^k. For p * cells << 1 a step covers many generations at the cost of one.
+//
+// The cells burned by a strike are FIRE until the next step, stats->generations holds the generations it covered.
+void stepInstantBurn(ForestGrid &grid, const StepParams &params, std::uint64_t step, StepStats *stats = nullptr) {
+    thread_local BurnState threadState;
+    BurnState &state = threadState;
+
+    if (!state.tracks(grid, step))
+        state.rebuild(grid);
+
+    const auto cells = static_cast<std::uint64_t>(grid.size());
+    const auto chunks = static_cast<std::int64_t>((cells + SKIP_CHUNK - 1) / SKIP_CHUNK);
+
+    for (auto index: state.burning)
+        grid.cells[index] = EMPTY;
+
+    state.burning.clear();
+
+    // Without lightning a step is a single generation of growth.
+    std::uint64_t generations = 1, strike = cells;
+
+    if (params.p > 0.0 && cells > 0) {
+        ChunkStream stream(params.seed ^ IGNITION_STREAM, step, 0);
+        double wait = std::floor(std::log(stream.next()) / std::log1p(-params.p));
+        double at = std::min(static_cast<double>(state.position) + wait, 0x1.0p62);
+        auto target = static_cast<std::uint64_t>(at);
+
+        generations = target / cells;
+        strike = target % cells;
+        state.position = strike + 1;
+    }
+
+    double growth = -std::expm1(static_cast<double>(generations) * std::log1p(-params.g));
+    std::uint64_t grown = 0;
+
+#pragma omp parallel for schedule(dynamic) default(none) shared(grid, params, step, cells, chunks, growth) reduction(+ : grown)
+    for (std::int64_t chunk = 0; chunk < chunks; ++chunk) {
+        auto begin = static_cast<std::uint64_t>(chunk) * SKIP_CHUNK, end = std::min(begin + SKIP_CHUNK, cells);
+
+        forEachHit(growth, params.seed ^ GROWTH_STREAM, step, chunk, begin, end, [&](std::uint64_t index) {
+            if (grid.cells[index] == EMPTY) {
+                grid.cells[index] = TREE;
+                grown++;
+            }
+        });
+    }
+
+    bool struck = strike < cells && grid.cells[strike] == TREE;
+
+    if (struck)
+        burnCluster(grid, static_cast<std::uint32_t>(strike), params.logic == MOORE,
+                    params.boundary == PERIODIC_BOUNDARY, state, state.burning);
+
+    state.nextStep = step + 1;
+
+    if (stats)
+        *stats = {0, state.burning.size(), struck, grown, generations};
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "ForestGrid.cpp"
+#include "Random.cpp"
+#include "Simulation.cpp"
+
+// Runs every other kernel, and the bitplane kernel on every available instruction set, against the per-cell kernel
+// from the same start grid and with the same random draws, for both neighborhoods and boundaries and with lightning
+// and growth drawn per cell as well as skip-sampled. The temporal kernel is compared after every block of generations,
+// up to blocks as deep as its halo when there are enough steps. Returns false on the first step that differs, in its
+// cells or in its statistics.
+bool verifyKernels(int width, int height, int steps, double p, double g, std::uint64_t seed,
+                   double startFire = 0.01, double startTrees = START_GROWTH) {
+    struct Candidate {
+        StepKernel kernel;
+        BitplaneIsa isa;
+        int depth;
+    };
+
+    ForestGrid reference(width, height), candidate(width, height);
+    std::vector<Candidate> candidates{{FRONTIER_KERNEL, ISA_SCALAR, 1}, {TILED_KERNEL, ISA_SCALAR, 1}};
+
+    for (int isa = ISA_SCALAR; isa <= detectBitplaneIsa(); ++isa)
+        candidates.push_back({BITPLANE_KERNEL, static_cast<BitplaneIsa>(isa), 1});
+
+    for (int depth: {3, MAX_BLOCK_DEPTH})
+        candidates.push_back({TEMPORAL_KERNEL, detectBitplaneIsa(), std::min(depth, steps)});
+
+    for (auto boundary: {FIXED_BOUNDARY, PERIODIC_BOUNDARY}) {
+        for (auto logic: {VON_NEUMANN, MOORE}) {
+            for (auto [kernel, isa, depth]: candidates) {
+                // The boundary is handled apart from the pack and unpack routines, one instruction set covers it.
+                if (boundary == PERIODIC_BOUNDARY && kernel == BITPLANE_KERNEL && isa != detectBitplaneIsa())
+                    continue;
+
+                for (bool skipSampling: {false, true}) {
+                    StepParams params{p, g, logic, kernel, seed, skipSampling, false, depth, boundary};
+
+                    for (int y = 0; y < height; ++y)
+                        for (int x = 0; x < width; ++x) {
+                            auto draw = cellRandom(seed, INIT_STREAM, reference.index(x, y)) / 4294967296.0;
+                            reference.at(x, y) = (draw < startFire) ? FIRE : (draw < startTrees) ? TREE : EMPTY;
+                        }
+
+                    std::memcpy(candidate.cells, reference.cells, reference.size());
+                    candidate.markEdited();
+
+                    for (std::uint64_t step = 0; step < static_cast<std::uint64_t>(steps); step += depth) {
+                        StepStats expected, actual;
+
+                        for (int generation = 0; generation < depth; ++generation) {
+                            StepStats single;
+                            stepCells(reference, params, step + generation, &single);
+
+                            expected.fires = single.fires;
+                            expected.struck += single.struck;
+                            expected.grown += single.grown;
+                        }
+
+                        if (kernel == BITPLANE_KERNEL)
+                            stepBitplane(candidate, params, step, isa, &actual);
+                        else if (kernel == TEMPORAL_KERNEL)
+                            stepTemporal(candidate, params, step, isa, &actual);
+                        else
+                            stepGrid(candidate, params, step, &actual);
+
+                        if (std::memcmp(reference.cells, candidate.cells, reference.size()) != 0)
+                            return false;
+
+                        // The statistics have to be those of the grid, and the same for every kernel. The temporal
+                        // kernel counts the trees itself, the others get them from stepGrid.
+                        auto counts = countCells(reference);
+
+                        if (expected.fires != counts[FIRE] || actual.fires != expected.fires ||
+                            actual.struck != expected.struck || actual.grown != expected.grown ||
+                            (kernel != BITPLANE_KERNEL && actual.trees != counts[TREE]))
+                            return false;
+                    }
+                }
+            }
+        }
+    }
+
+    return true;
+}
@@ -42,7 +42,9 @@ struct MeasurementsLog {
         ImGui::SameLine();
         ImGui::TextDisabled("Average FPS: %.2f  | ", avg);
         ImGui::SameLine();
-        ImGui::TextDisabled("Perf: %lld", framePerf);
+        ImGui::TextDisabled("Frame: %.2f ms  | ", frameMs);
+        ImGui::SameLine();
+        ImGui::TextDisabled("Generation: %llu", generation);
 
         ImGui::Separator();
 
@@ -79,8 +81,8 @@ struct MeasurementsLog {
     }
 
 public:
-    float fps{}, avg{};
-    unsigned long long framePerf{};
+    float fps{}, avg{}, frameMs{};
+    unsigned long long generation{};
 };
 
 static MeasurementsLog measurements;
\ No newline at end of file
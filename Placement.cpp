@@ -0,0 +1,290 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+// Alignment of allocations backed by huge pages, the size of a transparent huge page with 4 KiB base pages.
+const std::size_t HUGE_PAGE_SIZE = std::size_t{2} << 20;
+
+// How the OpenMP threads are placed on the CPUs: left to the scheduler, packed onto the first NUMA node before the
+// next one is used, dealt out round robin over the nodes, or onto a given list of CPUs, thread i onto item i.
+enum PinMode {
+    PIN_NONE,
+    PIN_COMPACT,
+    PIN_SPREAD,
+    PIN_LIST
+};
+
+const char *PIN_NAMES[] = {"none", "compact", "spread", "list"};
+
+// Where grid memory lives and where the threads that step it run. Set from the command line before the first grid
+// is allocated. Memory is never bound to a node explicitly: every page lands on the node of the thread that touches
+// it first, so grids are first touched by the threads that step them, in the partition of their steps.
+struct Placement {
+    PinMode pin{PIN_NONE};
+    std::vector<int> cpus;
+    bool hugePages{false};
+};
+
+static Placement placement;
+
+struct NumaNode {
+    int node{};
+    std::vector<int> cpus;
+};
+
+// CPUs of a list in the kernel's format, like "0-3,8,10-11".
+std::vector<int> parseCpuList(const char *text) {
+    std::vector<int> cpus;
+
+    while (*text != '\0') {
+        char *end;
+        int first = static_cast<int>(std::strtol(text, &end, 10)), last = first;
+
+        if (end == text)
+            break;
+
+        if (*end == '-')
+            last = static_cast<int>(std::strtol(end + 1, &end, 10));
+
+        for (int cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+
+        text = *end == ',' ? end + 1 : end;
+    }
+
+    return cpus;
+}
+
+// A pin mode by name, or a list of CPUs. False for anything else.
+bool parsePinning(const char *text, Placement &settings) {
+    for (int mode = PIN_NONE; mode < PIN_LIST; ++mode)
+        if (std::strcmp(text, PIN_NAMES[mode]) == 0) {
+            settings.pin = static_cast<PinMode>(mode);
+            return true;
+        }
+
+    auto cpus = parseCpuList(text);
+
+    if (cpus.empty())
+        return false;
+
+    settings.pin = PIN_LIST;
+    settings.cpus = cpus;
+    return true;
+}
+
+// The CPUs the process may run on, as it started. Threads that are not pinned get all of them back.
+const std::vector<int> &allowedCpus() {
+    static const std::vector<int> cpus = [] {
+        std::vector<int> allowed;
+#ifdef __linux__
+        cpu_set_t set;
+
+        if (sched_getaffinity(0, sizeof(set), &set) == 0)
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+                if (CPU_ISSET(cpu, &set))
+                    allowed.push_back(cpu);
+#endif
+        if (allowed.empty())
+            for (int cpu = 0; cpu < omp_get_num_procs(); ++cpu)
+                allowed.push_back(cpu);
+
+        return allowed;
+    }();
+
+    return cpus;
+}
+
+// The NUMA nodes with CPUs the process may run on. Without a NUMA topology to read, all of them form node 0.
+const std::vector<NumaNode> &numaNodes() {
+    static const std::vector<NumaNode> nodes = [] {
+        std::vector<NumaNode> found;
+        const auto &allowed = allowedCpus();
+
+        for (int node = 0; node < 1024; ++node) {
+            char path[64], list[4096];
+            std::snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+            std::FILE *in = std::fopen(path, "r");
+
+            // Node numbers may have gaps, but not many.
+            if (in == nullptr) {
+                if (node > 64 && found.empty())
+                    break;
+
+                continue;
+            }
+
+            NumaNode numa{node, {}};
+
+            if (std::fgets(list, sizeof(list), in))
+                for (int cpu: parseCpuList(list))
+                    if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end())
+                        numa.cpus.push_back(cpu);
+
+            std::fclose(in);
+
+            if (!numa.cpus.empty())
+                found.push_back(numa);
+        }
+
+        if (found.empty())
+            found.push_back({0, allowed});
+
+        return found;
+    }();
+
+    return nodes;
+}
+
+// The CPU of every thread in the order of their numbers, empty when they are not pinned. A team with more threads
+// than CPUs in the order starts over at its beginning.
+std::vector<int> pinOrder(const Placement &settings) {
+    std::vector<int> order;
+    const auto &nodes = numaNodes();
+
+    if (settings.pin == PIN_COMPACT)
+        for (const auto &node: nodes)
+            order.insert(order.end(), node.cpus.begin(), node.cpus.end());
+
+    if (settings.pin == PIN_SPREAD) {
+        std::size_t largest = 0;
+
+        for (const auto &node: nodes)
+            largest = std::max(largest, node.cpus.size());
+
+        for (std::size_t i = 0; i < largest; ++i)
+            for (const auto &node: nodes)
+                if (i < node.cpus.size())
+                    order.push_back(node.cpus[i]);
+    }
+
+    if (settings.pin == PIN_LIST)
+        order = settings.cpus;
+
+    return order;
+}
+
+// Restricts the calling thread to cpus. Does nothing where threads cannot be pinned.
+inline bool pinThread(const std::vector<int> &cpus) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    for (int cpu: cpus)
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void) cpus;
+    return false;
+#endif
+}
+
+// Pins every thread of the OpenMP team the calling thread starts, itself as thread 0 included. Every thread that
+// starts parallel regions has a team of its own, and it keeps its threads from one region to the next as long as
+// their number does not change, so this is called on the thread that steps, after every change of the thread count.
+void applyPlacement(const Placement &settings = placement) {
+    const auto order = pinOrder(settings);
+    const auto &all = allowedCpus();
+
+#pragma omp parallel default(none) shared(order, all)
+    {
+        if (order.empty())
+            pinThread(all);
+        else
+            pinThread({order[omp_get_thread_num() % order.size()]});
+    }
+}
+
+// Alignment an allocation of bytes gets: a huge page, if they are enabled and it spans at least one, alignment
+// otherwise.
+inline std::size_t placedAlignment(std::size_t bytes, std::size_t alignment) {
+    return placement.hugePages && bytes >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : alignment;
+}
+
+// Memory that is not touched yet, rounded up to whole units of alignment, which must come from placedAlignment and
+// be passed again to releasePlaced. Memory aligned to huge pages is advised to be backed by them.
+inline void *allocatePlaced(std::size_t bytes, std::size_t alignment) {
+    bytes = (bytes + alignment - 1) / alignment * alignment;
+    void *memory = ::operator new[](bytes, std::align_val_t{alignment});
+
+#ifdef MADV_HUGEPAGE
+    if (alignment == HUGE_PAGE_SIZE)
+        madvise(memory, bytes, MADV_HUGEPAGE);
+#endif
+
+    return memory;
+}
+
+inline void releasePlaced(void *memory, std::size_t alignment) {
+    ::operator delete[](memory, std::align_val_t{alignment});
+}
+
+// Copy bandwidth of the memory of one NUMA node, read and written by threads pinned to its CPUs.
+struct NodeBandwidth {
+    int node{}, threads{};
+    double gigabytesPerSecond{};
+};
+
+// Every node copies a buffer of bytes that its own threads first touched, the best of repeats copies counts, as
+// bytes read plus bytes written. Leaves the team of the calling thread pinned as placement says.
+std::vector<NodeBandwidth> measureNodeBandwidth(std::size_t bytes = std::size_t{256} << 20, int repeats = 5) {
+    std::vector<NodeBandwidth> bandwidths;
+    const int threads = omp_get_max_threads();
+
+    for (const auto &node: numaNodes()) {
+        Placement onNode{PIN_LIST, node.cpus};
+        const int team = std::min<int>(threads, static_cast<int>(node.cpus.size()));
+        const std::size_t alignment = placedAlignment(bytes, 64);
+        auto *source = static_cast<char *>(allocatePlaced(bytes, alignment));
+        auto *target = static_cast<char *>(allocatePlaced(bytes, alignment));
+        double best = 0.0;
+
+        omp_set_num_threads(team);
+        applyPlacement(onNode);
+
+#pragma omp parallel default(none) shared(source, target, bytes, repeats, best)
+        {
+            const int thread = omp_get_thread_num(), count = omp_get_num_threads();
+            const std::size_t begin = bytes * thread / count, end = bytes * (thread + 1) / count;
+
+            std::memset(source + begin, thread + 1, end - begin);
+            std::memset(target + begin, 0, end - begin);
+
+            for (int repeat = 0; repeat < repeats; ++repeat) {
+#pragma omp barrier
+                auto start = std::chrono::steady_clock::now();
+                std::memcpy(target + begin, source + begin, end - begin);
+#pragma omp barrier
+#pragma omp single
+                {
+                    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+                    best = std::max(best, 2.0 * static_cast<double>(bytes) / seconds.count() / 1e9);
+                }
+            }
+        }
+
+        releasePlaced(source, alignment);
+        releasePlaced(target, alignment);
+        bandwidths.push_back({node.node, team, best});
+    }
+
+    omp_set_num_threads(threads);
+    applyPlacement();
+    return bandwidths;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// Counter value used for the draws of initForest, the simulation itself counts generations up from 0.
+const std::uint64_t INIT_STREAM = ~0ull;
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3"). A pure function of a 128-bit
+// counter and a 64-bit key, so any cell of any generation can be drawn independently of all others.
+inline std::array<std::uint32_t, 4> philox4x32(std::array<std::uint32_t, 4> counter, std::uint64_t key) {
+    auto k0 = static_cast<std::uint32_t>(key), k1 = static_cast<std::uint32_t>(key >> 32);
+
+    for (int round = 0; round < 10; ++round) {
+        std::uint64_t product0 = static_cast<std::uint64_t>(0xD2511F53u) * counter[0];
+        std::uint64_t product1 = static_cast<std::uint64_t>(0xCD9E8D57u) * counter[2];
+
+        counter = {static_cast<std::uint32_t>(product1 >> 32) ^ counter[1] ^ k0, static_cast<std::uint32_t>(product1),
+                   static_cast<std::uint32_t>(product0 >> 32) ^ counter[3] ^ k1, static_cast<std::uint32_t>(product0)};
+
+        k0 += 0x9E3779B9u;
+        k1 += 0xBB67AE85u;
+    }
+
+    return counter;
+}
+
+// Draws for the four consecutive cells starting at 4 * block in the given generation.
+inline std::array<std::uint32_t, 4> cellRandomBlock(std::uint64_t seed, std::uint64_t step, std::uint64_t block) {
+    return philox4x32({static_cast<std::uint32_t>(block), static_cast<std::uint32_t>(block >> 32),
+                       static_cast<std::uint32_t>(step), static_cast<std::uint32_t>(step >> 32)}, seed);
+}
+
+// Stateless per-cell random draw keyed by (seed, step, cell index). Every kernel asks for the draw of the cell it
+// is updating, so the result does not depend on iteration order, thread count or which kernel is running.
+inline std::uint32_t cellRandom(std::uint64_t seed, std::uint64_t step, std::uint64_t index) {
+    return cellRandomBlock(seed, step, index / 4)[index % 4];
+}
+
+const int RANDOM_BATCH = 64;
+
+// Fills out[0, count) with the draws of cells first .. first + count - 1, for count up to RANDOM_BATCH. Same values
+// as cellRandom(), but the Philox rounds run over all blocks side by side so the compiler can vectorize them.
+inline void cellRandomRange(std::uint64_t seed, std::uint64_t step, std::uint64_t first, int count,
+                            std::uint32_t *out) {
+    const int maxBlocks = RANDOM_BATCH / 4 + 1;
+    std::uint32_t c0[maxBlocks], c1[maxBlocks], c2[maxBlocks], c3[maxBlocks];
+    auto firstBlock = first / 4;
+    int blocks = static_cast<int>((first + count + 3) / 4 - firstBlock);
+
+    for (int b = 0; b < blocks; ++b) {
+        c0[b] = static_cast<std::uint32_t>(firstBlock + b);
+        c1[b] = static_cast<std::uint32_t>((firstBlock + b) >> 32);
+        c2[b] = static_cast<std::uint32_t>(step);
+        c3[b] = static_cast<std::uint32_t>(step >> 32);
+    }
+
+    auto k0 = static_cast<std::uint32_t>(seed), k1 = static_cast<std::uint32_t>(seed >> 32);
+
+    for (int round = 0; round < 10; ++round) {
+        for (int b = 0; b < blocks; ++b) {
+            std::uint64_t product0 = static_cast<std::uint64_t>(0xD2511F53u) * c0[b];
+            std::uint64_t product1 = static_cast<std::uint64_t>(0xCD9E8D57u) * c2[b];
+
+            c0[b] = static_cast<std::uint32_t>(product1 >> 32) ^ c1[b] ^ k0;
+            c1[b] = static_cast<std::uint32_t>(product1);
+            c2[b] = static_cast<std::uint32_t>(product0 >> 32) ^ c3[b] ^ k1;
+            c3[b] = static_cast<std::uint32_t>(product0);
+        }
+
+        k0 += 0x9E3779B9u;
+        k1 += 0xBB67AE85u;
+    }
+
+    const std::uint32_t *lanes[] = {c0, c1, c2, c3};
+    auto offset = static_cast<int>(first % 4);
+
+    for (int i = 0; i < count; ++i)
+        out[i] = lanes[(offset + i) % 4][(offset + i) / 4];
+}
+
+// Walks cells in increasing index order and draws them RANDOM_BATCH at a time.
+struct CellDraws {
+    CellDraws(std::uint64_t seed, std::uint64_t step) : seed(seed), step(step) {}
+
+    std::uint32_t operator()(std::uint64_t index) {
+        if (index < first || index >= first + RANDOM_BATCH) {
+            first = index;
+            cellRandomRange(seed, step, first, RANDOM_BATCH, draws);
+        }
+
+        return draws[index - first];
+    }
+
+private:
+    std::uint64_t seed, step;
+    std::uint64_t first{~0ull};
+    std::uint32_t draws[RANDOM_BATCH]{};
+};
+
+// A draw hits probability p when it is below the returned threshold.
+inline std::uint64_t probabilityThreshold(double p) {
+    if (p <= 0.0)
+        return 0;
+    if (p >= 1.0)
+        return 1ull << 32;
+    return static_cast<std::uint64_t>(p * 4294967296.0);
+}
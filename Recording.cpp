@@ -0,0 +1,542 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <omp.h>
+
+#include "ForestGrid.cpp"
+#include "SpscQueue.cpp"
+#include "Tracing.cpp"
+
+// A recorded run on disk, in the byte order of the machine that wrote it: a RecordingHeader, then one record per
+// recorded generation, a RecordHeader followed by its payload. The payload of a keyframe is the whole generation,
+// four cells per byte, cell i in bits 2 (i % 4) of byte i / 4. The payload of a delta lists the cells that changed
+// since the record before it in runs: the unchanged cells skipped and the length of the run as LEB128 varints, then
+// the new states of the run, packed like a keyframe. There is no index, a replay builds it from the record headers,
+// so a recording that was cut off can be replayed up to its last complete record.
+const char RECORDING_MAGIC[8] = {'F', 'O', 'R', 'E', 'S', 'T', 'R', 'C'};
+const std::uint32_t RECORDING_VERSION = 1;
+
+// Records from one keyframe to the next, so a seek decodes at most one keyframe and this many deltas.
+const int KEYFRAME_INTERVAL = 64;
+
+// Packed generations the writer thread may be behind by. A generation that finds all of them in use is dropped.
+const int RECORDER_BUFFERS = 4;
+
+struct RecordingHeader {
+    char magic[8];
+    std::uint32_t version, width, height, keyframeInterval;
+    // What the run was started with, for reference. A replay does not need them.
+    std::uint32_t logic, kernel, boundary, blockDepth;
+    std::uint8_t skipSampling, instantBurn, reserved[6];
+    double p, g;
+    std::uint64_t seed;
+};
+
+enum RecordType : std::uint32_t {
+    KEYFRAME_RECORD,
+    DELTA_RECORD
+};
+
+struct RecordHeader {
+    std::uint64_t generation;
+    RecordType type;
+    std::uint32_t bytes;
+};
+
+static_assert(sizeof(RecordingHeader) == 72 && sizeof(RecordHeader) == 16);
+// The encoder reads packed cells as words, cell i % 32 of a word has to be in its bits 2 (i % 32).
+static_assert(std::endian::native == std::endian::little);
+
+inline std::size_t packedBytes(std::size_t cells) {
+    return (cells + 3) / 4;
+}
+
+// Four cells per byte, as in a keyframe. The last byte is padded with TREE, which is zero.
+void packCells(const CellState *cells, std::size_t count, std::uint8_t *packed) {
+    const auto whole = static_cast<std::int64_t>(count / 4);
+
+#pragma omp parallel for default(none) shared(cells, packed, whole)
+    for (std::int64_t i = 0; i < whole; ++i)
+        packed[i] = static_cast<std::uint8_t>(cells[4 * i] | cells[4 * i + 1] << 2 | cells[4 * i + 2] << 4 |
+                                              cells[4 * i + 3] << 6);
+
+    if (count % 4 != 0) {
+        std::uint8_t last = 0;
+
+        for (std::size_t i = count / 4 * 4; i < count; ++i)
+            last |= static_cast<std::uint8_t>(cells[i] << 2 * (i % 4));
+
+        packed[count / 4] = last;
+    }
+}
+
+void unpackCells(const std::uint8_t *packed, std::size_t count, CellState *cells) {
+    const auto total = static_cast<std::int64_t>(count);
+
+#pragma omp parallel for default(none) shared(packed, cells, total)
+    for (std::int64_t i = 0; i < total; ++i)
+        cells[i] = static_cast<CellState>(packed[i / 4] >> 2 * (i % 4) & 3);
+}
+
+static void appendVarint(std::vector<std::uint8_t> &out, std::uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<std::uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+
+    out.push_back(static_cast<std::uint8_t>(value));
+}
+
+static bool readVarint(const std::uint8_t *&data, const std::uint8_t *end, std::uint64_t &value) {
+    value = 0;
+
+    for (int shift = 0; shift < 64 && data < end; shift += 7) {
+        std::uint8_t byte = *data++;
+        value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+// Runs of the cells whose states differ between two packed generations, compared 32 cells at a time, so the
+// unchanged parts of the grid cost a word compare each. Both have to be padded with zeros to whole words.
+static void encodeDelta(const std::uint64_t *previous, const std::uint64_t *current, std::size_t cells,
+                        std::vector<std::uint8_t> &out) {
+    const std::uint64_t LANES = 0x5555555555555555ull;
+    const std::size_t words = (cells + 31) / 32;
+    std::size_t written = 0, start = 0;
+    bool inRun = false;
+
+    // The states of the four cells from cell i on, which may straddle two words.
+    auto fourCells = [current, words](std::size_t i) {
+        std::size_t word = i / 32;
+        unsigned shift = 2 * (i % 32);
+        std::uint64_t bits = current[word] >> shift;
+
+        if (shift > 56 && word + 1 < words)
+            bits |= current[word + 1] << (64 - shift);
+
+        return static_cast<std::uint8_t>(bits);
+    };
+
+    auto closeRun = [&](std::size_t end) {
+        appendVarint(out, start - written);
+        appendVarint(out, end - start);
+
+        for (std::size_t i = start; i < end; i += 4)
+            out.push_back(end - i >= 4 ? fourCells(i) : fourCells(i) & ((1u << 2 * (end - i)) - 1));
+
+        written = end;
+        inRun = false;
+    };
+
+    for (std::size_t w = 0; w < words; ++w) {
+        std::uint64_t diff = previous[w] ^ current[w];
+
+        if (diff == 0) {
+            if (inRun)
+                closeRun(32 * w);
+            continue;
+        }
+
+        // One bit per cell, the low bit of its two, set where the cell changed. Every run that starts or ends in
+        // the word is found with one bit scan.
+        const std::uint64_t changed = (diff | diff >> 1) & LANES;
+
+        for (int lane = 0;;) {
+            std::uint64_t next = (inRun ? ~changed & LANES : changed) & ~0ull << 2 * lane;
+
+            if (next == 0)
+                break;
+
+            lane = std::countr_zero(next) / 2;
+
+            if (inRun) {
+                closeRun(32 * w + lane);
+            } else {
+                start = 32 * w + lane;
+                inRun = true;
+            }
+        }
+    }
+
+    if (inRun)
+        closeRun(cells);
+}
+
+// Applies a delta to the cells of the generation before it. False if it does not fit the grid.
+static bool applyDelta(const std::uint8_t *data, std::size_t bytes, CellState *cells, std::size_t count) {
+    const std::uint8_t *end = data + bytes;
+    std::size_t position = 0;
+
+    while (data < end) {
+        std::uint64_t skip, length;
+
+        if (!readVarint(data, end, skip) || !readVarint(data, end, length) || skip > count - position ||
+            length > count - position - skip || packedBytes(length) > static_cast<std::size_t>(end - data))
+            return false;
+
+        position += skip;
+
+        for (std::size_t i = 0; i < length; ++i)
+            cells[position + i] = static_cast<CellState>(data[i / 4] >> 2 * (i % 4) & 3);
+
+        data += packedBytes(length);
+        position += length;
+    }
+
+    return true;
+}
+
+// Records a run to disk while it is being simulated. The thread that steps the grid only packs every generation into
+// a free buffer and hands it over; diffing it against the generation before and writing it happens on the recorder's
+// own thread, so recording never makes a step wait for the disk.
+struct RunRecorder {
+    ~RunRecorder() {
+        stop();
+    }
+
+    bool start(const char *path, const ForestGrid &grid, const StepParams &params) {
+        stop();
+
+        file = std::fopen(path, "wb");
+
+        if (file == nullptr)
+            return false;
+
+        width = grid.width;
+        height = grid.height;
+        recorded = dropped = bytes = 0;
+        failed = stopping = false;
+
+        RecordingHeader header{};
+        std::memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+        header.version = RECORDING_VERSION;
+        header.width = width;
+        header.height = height;
+        header.keyframeInterval = KEYFRAME_INTERVAL;
+        header.logic = params.logic;
+        header.kernel = params.kernel;
+        header.boundary = params.boundary;
+        header.blockDepth = params.blockDepth;
+        header.skipSampling = params.skipSampling;
+        header.instantBurn = params.instantBurn;
+        header.p = params.p;
+        header.g = params.g;
+        header.seed = params.seed;
+
+        if (std::fwrite(&header, sizeof(header), 1, file) != 1) {
+            std::fclose(file);
+            file = nullptr;
+            return false;
+        }
+
+        bytes = sizeof(header);
+
+        // Padded to whole words, the encoder compares 32 cells at a time.
+        for (auto &frame: frames)
+            frame.packed.assign((grid.size() + 31) / 32, 0);
+
+        for (int i = 0; i < RECORDER_BUFFERS; ++i)
+            freeFrames.push(i);
+
+        thread = std::thread(&RunRecorder::write, this);
+        return true;
+    }
+
+    // Called from the thread that steps the grid, after every step. With all buffers waiting for the writer, the
+    // generation is dropped, unless wait is set, and the next delta then spans the generations in between.
+    bool record(const ForestGrid &grid, std::uint64_t generation, bool wait = false) {
+        if (file == nullptr || grid.width != width || grid.height != height)
+            return false;
+
+        int index;
+
+        while (!freeFrames.pop(index)) {
+            if (!wait) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+
+            std::this_thread::yield();
+        }
+
+        TraceScope trace("record");
+        auto &frame = frames[index];
+        frame.generation = generation;
+        packCells(grid.cells, grid.size(), reinterpret_cast<std::uint8_t *>(frame.packed.data()));
+
+        pendingFrames.push(index);
+        return true;
+    }
+
+    // Writes every generation handed over so far and closes the file. False if any write failed.
+    bool stop() {
+        if (file == nullptr)
+            return true;
+
+        stopping = true;
+        thread.join();
+
+        bool written = !failed && std::fclose(file) == 0;
+        file = nullptr;
+
+        int index;
+        while (freeFrames.pop(index) || pendingFrames.pop(index)) {}
+
+        return written;
+    }
+
+    [[nodiscard]] bool active() const {
+        return file != nullptr;
+    }
+
+public:
+    // Readable from any thread while recording.
+    std::atomic<std::uint64_t> recorded{0}, dropped{0}, bytes{0};
+    std::atomic<bool> failed{false};
+
+private:
+    struct Frame {
+        std::uint64_t generation{};
+        std::vector<std::uint64_t> packed;
+    };
+
+    void write() {
+        std::vector<std::uint8_t> delta;
+        int previous = -1, sinceKeyframe = 0;
+        const std::size_t cells = static_cast<std::size_t>(width) * height;
+
+        tracing.nameThread("recorder");
+
+        while (true) {
+            int index;
+
+            // Nothing is handed over after stopping is set, so one more look at the queue drains it.
+            if (!pendingFrames.pop(index)) {
+                if (!stopping.load(std::memory_order_acquire)) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(200));
+                    continue;
+                }
+
+                if (!pendingFrames.pop(index))
+                    break;
+            }
+
+            TraceScope trace("record write");
+            const auto &frame = frames[index];
+            RecordHeader header{frame.generation, KEYFRAME_RECORD, 0};
+            const void *payload = frame.packed.data();
+
+            if (previous < 0 || sinceKeyframe == KEYFRAME_INTERVAL) {
+                header.bytes = static_cast<std::uint32_t>(packedBytes(cells));
+                sinceKeyframe = 0;
+            } else {
+                delta.clear();
+                encodeDelta(frames[previous].packed.data(), frame.packed.data(), cells, delta);
+                header.type = DELTA_RECORD;
+                header.bytes = static_cast<std::uint32_t>(delta.size());
+                payload = delta.data();
+            }
+
+            if (std::fwrite(&header, sizeof(header), 1, file) != 1 ||
+                std::fwrite(payload, 1, header.bytes, file) != header.bytes)
+                failed = true;
+
+            sinceKeyframe++;
+            recorded.fetch_add(1, std::memory_order_relaxed);
+            bytes.fetch_add(sizeof(header) + header.bytes, std::memory_order_relaxed);
+
+            if (previous >= 0)
+                freeFrames.push(previous);
+
+            previous = index;
+        }
+
+        if (previous >= 0)
+            freeFrames.push(previous);
+    }
+
+    std::array<Frame, RECORDER_BUFFERS> frames;
+    SpscQueue<int, RECORDER_BUFFERS> freeFrames, pendingFrames;
+    std::FILE *file{};
+    int width{}, height{};
+    std::atomic<bool> stopping{false};
+    std::thread thread;
+};
+
+// Plays a recorded run back from a memory-mapped file. Any recorded generation can be shown in any order: seeking
+// decodes the keyframe before it and the deltas up to it, or only the deltas when it continues from the generation
+// shown last, so playing forward costs one delta per record.
+struct RunReplay {
+    ~RunReplay() {
+        close();
+    }
+
+    bool open(const char *path) {
+        close();
+
+        int descriptor = ::open(path, O_RDONLY);
+        struct stat info{};
+
+        if (descriptor < 0)
+            return false;
+
+        if (fstat(descriptor, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(RecordingHeader)) {
+            ::close(descriptor);
+            return false;
+        }
+
+        size = static_cast<std::size_t>(info.st_size);
+        void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        ::close(descriptor);
+
+        if (mapped == MAP_FAILED)
+            return false;
+
+        data = static_cast<const std::uint8_t *>(mapped);
+        std::memcpy(&header, data, sizeof(header));
+
+        if (std::memcmp(header.magic, RECORDING_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != RECORDING_VERSION || header.width == 0 || header.height == 0) {
+            close();
+            return false;
+        }
+
+        // Only complete records whose generations go forward count, a recording that was cut off ends before.
+        for (std::size_t offset = sizeof(header); offset + sizeof(RecordHeader) <= size;) {
+            RecordHeader record;
+            std::memcpy(&record, data + offset, sizeof(record));
+
+            if (record.bytes > size - offset - sizeof(record) || record.type > DELTA_RECORD ||
+                (index.empty() ? record.type != KEYFRAME_RECORD : record.generation <= index.back().generation))
+                break;
+
+            index.push_back({record.generation, offset + sizeof(record), record.bytes, record.type == KEYFRAME_RECORD});
+            offset += sizeof(record) + record.bytes;
+        }
+
+        if (index.empty()) {
+            close();
+            return false;
+        }
+
+        return true;
+    }
+
+    void close() {
+        if (data != nullptr)
+            munmap(const_cast<std::uint8_t *>(data), size);
+
+        data = nullptr;
+        size = 0;
+        index.clear();
+        shown = -1;
+    }
+
+    // Shows the last recorded generation at or before generation in grid, resized to the recording. False if the
+    // file is damaged there.
+    bool seek(ForestGrid &grid, std::uint64_t generation) {
+        auto after = std::upper_bound(index.begin(), index.end(), generation, [](std::uint64_t g, const Entry &e) {
+            return g < e.generation;
+        });
+
+        return show(grid, std::max<std::ptrdiff_t>(after - index.begin() - 1, 0));
+    }
+
+    // Shows the generation of a record, counted from the first one.
+    bool show(ForestGrid &grid, std::ptrdiff_t target) {
+        target = std::clamp<std::ptrdiff_t>(target, 0, static_cast<std::ptrdiff_t>(index.size()) - 1);
+
+        auto keyframe = target;
+        while (!index[keyframe].keyframe)
+            keyframe--;
+
+        grid.resize(static_cast<int>(header.width), static_cast<int>(header.height));
+
+        // The deltas since the shown generation are enough if nobody else touched the grid in between.
+        bool continues = shown >= keyframe && shown <= target && grid.editStamp == shownStamp;
+        auto from = shown + 1;
+
+        if (!continues) {
+            const auto &entry = index[keyframe];
+
+            if (entry.bytes != packedBytes(grid.size()))
+                return false;
+
+            unpackCells(data + entry.offset, grid.size(), grid.cells);
+            from = keyframe + 1;
+        }
+
+        for (auto i = from; i <= target; ++i)
+            if (!applyDelta(data + index[i].offset, index[i].bytes, grid.cells, grid.size())) {
+                shown = -1;
+                grid.markEdited();
+                return false;
+            }
+
+        shown = target;
+        grid.markEdited();
+        shownStamp = grid.editStamp;
+        return true;
+    }
+
+    [[nodiscard]] bool opened() const {
+        return data != nullptr;
+    }
+
+    [[nodiscard]] std::uint64_t firstGeneration() const {
+        return index.front().generation;
+    }
+
+    [[nodiscard]] std::uint64_t lastGeneration() const {
+        return index.back().generation;
+    }
+
+    [[nodiscard]] std::uint64_t shownGeneration() const {
+        return shown >= 0 ? index[shown].generation : 0;
+    }
+
+    [[nodiscard]] std::ptrdiff_t shownRecord() const {
+        return shown;
+    }
+
+    [[nodiscard]] std::size_t records() const {
+        return index.size();
+    }
+
+public:
+    RecordingHeader header{};
+
+private:
+    struct Entry {
+        std::uint64_t generation;
+        std::size_t offset;
+        std::uint32_t bytes;
+        bool keyframe;
+    };
+
+    const std::uint8_t *data{};
+    std::size_t size{};
+    std::vector<Entry> index;
+    std::ptrdiff_t shown{-1};
+    std::uint64_t shownStamp{};
+};
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <omp.h>
+
+#include "ForestGrid.cpp"
+#include "Random.cpp"
+#include "SkipSampling.cpp"
+
+const int REPLICAS = 64;
+
+// REPLICAS independent forests of the same size, bit-sliced: bit r of a cell's words holds that cell in replica r,
+// which is TREE if its bit in trees is set, FIRE if its bit in fires is set and EMPTY if neither is.
+struct ReplicaGrid {
+    ReplicaGrid(int width, int height)
+            : width(width), height(height), trees(size()), fires(size()), nextTrees(size()), nextFires(size()) {}
+
+    // Replaces replica r with a grid of the same size.
+    void load(int replica, const ForestGrid &grid) {
+        const auto bit = std::uint64_t{1} << replica;
+
+#pragma omp parallel for default(none) shared(grid, bit)
+        for (int y = 0; y < height; ++y)
+            for (int x = 0; x < width; ++x) {
+                auto i = index(x, y);
+                trees[i] = grid.at(x, y) == TREE ? trees[i] | bit : trees[i] & ~bit;
+                fires[i] = grid.at(x, y) == FIRE ? fires[i] | bit : fires[i] & ~bit;
+            }
+    }
+
+    // Copies replica r into a grid of the same size.
+    void extract(int replica, ForestGrid &grid) const {
+#pragma omp parallel for default(none) shared(grid, replica)
+        for (int y = 0; y < height; ++y)
+            for (int x = 0; x < width; ++x) {
+                auto i = index(x, y);
+                grid.at(x, y) = (trees[i] >> replica & 1) ? TREE : (fires[i] >> replica & 1) ? FIRE : EMPTY;
+            }
+
+        grid.markEdited();
+    }
+
+    void swap() {
+        trees.swap(nextTrees);
+        fires.swap(nextFires);
+    }
+
+    [[nodiscard]] std::size_t size() const {
+        return static_cast<std::size_t>(width) * height;
+    }
+
+    [[nodiscard]] std::size_t index(int x, int y) const {
+        return static_cast<std::size_t>(y) * width + x;
+    }
+
+public:
+    int width, height;
+    std::vector<std::uint64_t> trees, fires, nextTrees, nextFires;
+};
+
+// Trees and burning cells of every replica, indexed by replica.
+struct ReplicaCounts {
+    std::array<std::uint64_t, REPLICAS> trees{}, fires{};
+};
+
+// Adds bit r of every word to counts[r]. Bits are summed in eight byte-wide counters per word, so every word costs
+// eight shifts and adds instead of 64 bit tests; the counters are flushed before they can overflow.
+static void countLanes(const std::uint64_t *words, std::size_t n, std::array<std::uint64_t, REPLICAS> &counts) {
+    const std::uint64_t lowBits = 0x0101010101010101ull;
+
+    for (std::size_t begin = 0; begin < n; begin += 255) {
+        std::uint64_t bytes[8] = {};
+
+        for (std::size_t i = begin; i < std::min(begin + 255, n); ++i)
+            for (int j = 0; j < 8; ++j)
+                bytes[j] += (words[i] >> j) & lowBits;
+
+        for (int j = 0; j < 8; ++j)
+            for (int b = 0; b < 8; ++b)
+                counts[8 * b + j] += (bytes[j] >> (8 * b)) & 0xFF;
+    }
+}
+
+ReplicaCounts countReplicaCells(const ReplicaGrid &grid) {
+    ReplicaCounts total;
+
+#pragma omp parallel default(none) shared(grid, total)
+    {
+        ReplicaCounts counts;
+
+#pragma omp for nowait
+        for (int y = 0; y < grid.height; ++y) {
+            countLanes(grid.trees.data() + grid.index(0, y), grid.width, counts.trees);
+            countLanes(grid.fires.data() + grid.index(0, y), grid.width, counts.fires);
+        }
+
+#pragma omp critical
+        for (int r = 0; r < REPLICAS; ++r) {
+            total.trees[r] += counts.trees[r];
+            total.fires[r] += counts.fires[r];
+        }
+    }
+
+    return total;
+}
+
+// Spreading of fire for the cells [begin, end) of row y, all replicas at once: a tree catches fire if any neighbor
+// burns, burning cells burn out and empty cells stay empty until growth.
+static void spreadReplicaRow(ReplicaGrid &grid, int y, int begin, int end, bool moore) {
+    const int width = grid.width, height = grid.height;
+    const std::uint64_t *fires = grid.fires.data() + grid.index(0, y);
+    const std::uint64_t *up = y > 0 ? fires - width : nullptr;
+    const std::uint64_t *down = y < height - 1 ? fires + width : nullptr;
+    const std::uint64_t *trees = grid.trees.data() + grid.index(0, y);
+    std::uint64_t *nextTrees = grid.nextTrees.data() + grid.index(0, y);
+    std::uint64_t *nextFires = grid.nextFires.data() + grid.index(0, y);
+
+    auto nearby = [&](int x) {
+        bool left = x > 0, right = x < width - 1;
+        std::uint64_t fire = (left ? fires[x - 1] : 0) | (right ? fires[x + 1] : 0);
+
+        if (up)
+            fire |= up[x] | (moore ? (left ? up[x - 1] : 0) | (right ? up[x + 1] : 0) : 0);
+        if (down)
+            fire |= down[x] | (moore ? (left ? down[x - 1] : 0) | (right ? down[x + 1] : 0) : 0);
+
+        return fire;
+    };
+
+    auto update = [&](int x, std::uint64_t fire) {
+        nextFires[x] = trees[x] & fire;
+        nextTrees[x] = trees[x] & ~fire;
+    };
+
+    // Branch-free interior, so the compiler can vectorize over cells, the bounds checks only at the row ends.
+    int inner = std::max(begin, 1), innerEnd = std::min(end, width - 1);
+
+    for (int x = begin; x < std::min(inner, end); ++x)
+        update(x, nearby(x));
+
+    if (up && down) {
+        for (int x = inner; x < innerEnd; ++x) {
+            auto fire = fires[x - 1] | fires[x + 1] | up[x] | down[x];
+
+            if (moore)
+                fire |= up[x - 1] | up[x + 1] | down[x - 1] | down[x + 1];
+
+            update(x, fire);
+        }
+    } else {
+        for (int x = inner; x < innerEnd; ++x)
+            update(x, nearby(x));
+    }
+
+    for (int x = std::max(innerEnd, inner); x < end; ++x)
+        update(x, nearby(x));
+}
+
+// Advances all replicas by one generation in one pass over the grid. Lightning and growth are always skip-sampled,
+// replica r drawing from the same streams as a single forest seeded with params.seed + r, so every replica is
+// exactly the forest the other kernels compute for that seed in skip sampling mode. The boundary is always fixed.
+void stepReplicas(ReplicaGrid &grid, const StepParams &params, std::uint64_t step) {
+    const bool moore = params.logic == MOORE;
+    const auto cells = static_cast<std::uint64_t>(grid.size());
+    const auto chunks = static_cast<std::int64_t>((cells + SKIP_CHUNK - 1) / SKIP_CHUNK);
+
+    // The skip sampling chunks are the unit of work, so the events of a chunk can be applied right after its cells
+    // were computed, while they are still in cache.
+#pragma omp parallel for schedule(dynamic) default(none) shared(grid, params, step, moore, cells, chunks)
+    for (std::int64_t chunk = 0; chunk < chunks; ++chunk) {
+        auto begin = static_cast<std::uint64_t>(chunk) * SKIP_CHUNK, end = std::min(begin + SKIP_CHUNK, cells);
+
+        for (auto i = begin; i < end;) {
+            int y = static_cast<int>(i / grid.width), x = static_cast<int>(i % grid.width);
+            int rowEnd = static_cast<int>(std::min<std::uint64_t>(end - i + x, grid.width));
+
+            spreadReplicaRow(grid, y, x, rowEnd, moore);
+            i += rowEnd - x;
+        }
+
+        // One pass per replica, as every replica draws the hits of its own seed. A single pass over all lanes would
+        // take as many draws, one per hit, so it would not be faster. The updates are branch-free, since whether a
+        // hit lands on a tree or an empty cell of that replica is a coin flip.
+        for (int r = 0; r < REPLICAS; ++r) {
+            const auto bit = std::uint64_t{1} << r;
+            const auto seed = params.seed + r;
+
+            forEachHit(params.p, seed ^ IGNITION_STREAM, step, chunk, begin, end, [&](std::uint64_t index) {
+                auto struck = grid.nextTrees[index] & bit;
+                grid.nextTrees[index] ^= struck;
+                grid.nextFires[index] |= struck;
+            });
+
+            forEachHit(params.g, seed ^ GROWTH_STREAM, step, chunk, begin, end, [&](std::uint64_t index) {
+                grid.nextTrees[index] |= bit & ~(grid.trees[index] | grid.fires[index]);
+            });
+        }
+    }
+
+    grid.swap();
+}
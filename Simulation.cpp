@@ -0,0 +1,131 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include <omp.h>
+
+#include "CellKernel.cpp"
+#include "ClusterSizes.cpp"
+#include "ForestGrid.cpp"
+#include "Random.cpp"
+#include "Tracing.cpp"
+#include "BitplaneKernel.cpp"
+#include "FrontierKernel.cpp"
+#include "InstantBurn.cpp"
+#include "TemporalKernel.cpp"
+#include "TiledKernel.cpp"
+#include "ReplicaKernel.cpp"
+#include "SkipSampling.cpp"
+
+const double START_GROWTH = 0.5;
+
+const char *STEP_KERNEL_NAMES[] = {"cell", "bitplane", "frontier", "tiled", "temporal"};
+const char *NEIGHBORHOOD_NAMES[] = {"moore", "von-neumann"};
+const char *SAMPLING_NAMES[] = {"cell", "skip"};
+const char *BURN_NAMES[] = {"spread", "instant"};
+const char *BOUNDARY_NAMES[] = {"fixed", "periodic"};
+
+void initGrid(ForestGrid &grid, std::uint64_t seed) {
+    const auto treeThreshold = probabilityThreshold(START_GROWTH);
+
+#pragma omp parallel for default(none) shared(grid, seed, treeThreshold)
+    for (int y = 0; y < grid.height; ++y) {
+        CellDraws draws(seed, INIT_STREAM);
+        CellState *row = grid.row(y);
+
+        for (int x = 0; x < grid.width; ++x)
+            row[x] = (draws(grid.index(x, y)) < treeThreshold) ? TREE : EMPTY;
+    }
+
+    grid.markEdited();
+}
+
+// Number of cells in each state of the current generation, indexed by CellState.
+std::array<std::size_t, 3> countCells(const ForestGrid &grid) {
+    std::size_t trees = 0, fires = 0;
+
+    for (std::size_t i = 0; i < grid.size(); ++i) {
+        trees += grid.cells[i] == TREE;
+        fires += grid.cells[i] == FIRE;
+    }
+
+    return {trees, fires, grid.size() - trees - fires};
+}
+
+// Trees of the generation the next step starts from. Every cell burning after a step was a tree before it and every
+// grown tree was empty, so the count follows from the step statistics and only needs a scan after the grid was
+// edited or stepped without statistics.
+struct TreeCount {
+    [[nodiscard]] bool tracks(const ForestGrid &grid, std::uint64_t step) const {
+        return editStamp == grid.editStamp && nextStep == step;
+    }
+
+    void rebuild(const ForestGrid &grid) {
+        std::uint64_t count = 0;
+
+#pragma omp parallel for default(none) shared(grid) reduction(+ : count)
+        for (int y = 0; y < grid.height; ++y) {
+            const CellState *row = grid.row(y);
+
+            for (int x = 0; x < grid.width; ++x)
+                count += row[x] == TREE;
+        }
+
+        trees = count;
+        editStamp = grid.editStamp;
+    }
+
+public:
+    std::uint64_t trees{}, editStamp{}, nextStep{};
+};
+
+// Advances the grid by params.stepLength() generations with the kernel selected in params, or up to the next
+// lightning strike with instant burning. With stats, the observables of the step are counted by the kernel on the way.
+void stepGrid(ForestGrid &grid, const StepParams &params, std::uint64_t step, StepStats *stats = nullptr) {
+    TraceScope trace("step");
+    thread_local TreeCount threadTrees;
+    TreeCount &trees = threadTrees;
+
+    if (stats && !trees.tracks(grid, step))
+        trees.rebuild(grid);
+
+    if (params.instantBurn) {
+        stepInstantBurn(grid, params, step, stats);
+    } else {
+        switch (params.kernel) {
+            case BITPLANE_KERNEL:
+                stepBitplane(grid, params, step, detectBitplaneIsa(), stats);
+                break;
+            case FRONTIER_KERNEL:
+                stepFrontier(grid, params, step, stats);
+                break;
+            case TILED_KERNEL:
+                stepTiled(grid, params, step, stats);
+                break;
+            case TEMPORAL_KERNEL:
+                stepTemporal(grid, params, step, detectBitplaneIsa(), stats);
+                break;
+            default:
+                stepCells(grid, params, step, stats);
+        }
+    }
+
+    // Over several generations, the fires of the last one no longer give the trees, so the temporal kernel counts
+    // them itself.
+    if (stats) {
+        trees.trees = params.stepLength() > 1 ? stats->trees : trees.trees - stats->fires + stats->grown;
+        trees.nextStep = step + params.stepLength();
+        stats->trees = trees.trees;
+    }
+}
+
+// Replica r starts from the same forest as initGrid with seed + r.
+void initReplicas(ReplicaGrid &grid, std::uint64_t seed) {
+    ForestGrid replica(grid.width, grid.height);
+
+    for (int r = 0; r < REPLICAS; ++r) {
+        initGrid(replica, seed + r);
+        grid.load(r, replica);
+    }
+}
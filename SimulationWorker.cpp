@@ -0,0 +1,666 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Benchmark.cpp"
+#include "ForestPyramid.cpp"
+#include "FrameCapture.cpp"
+#include "KernelVerification.cpp"
+#include "Placement.cpp"
+#include "Recording.cpp"
+#include "Simulation.cpp"
+#include "SpscQueue.cpp"
+#include "Tracing.cpp"
+
+// The part of one completed generation the window shows, at the level of the pyramid it is drawn from, which is all
+// the renderer needs. Copying it costs as much as the window has pixels, whatever the size of the grid.
+struct ForestSnapshot {
+    // view has to lie within its level. Level 0 is copied from the grid, every other level from the pyramid.
+    void copy(const ForestGrid &grid, const ForestPyramid &pyramid, const ViewRegion &view, std::uint64_t step) {
+        region = view;
+        gridWidth = grid.width;
+        gridHeight = grid.height;
+        generation = step;
+        cells.resize(static_cast<std::size_t>(view.width) * view.height);
+
+        for (int y = 0; y < view.height; ++y) {
+            const CellState *source = view.level == 0 ? grid.row(view.y + y) : pyramid.row(view.level, view.y + y);
+            std::copy_n(source + view.x, view.width, cells.data() + static_cast<std::size_t>(y) * view.width);
+        }
+    }
+
+    [[nodiscard]] const CellState *row(int y) const {
+        return cells.data() + static_cast<std::size_t>(y) * region.width;
+    }
+
+public:
+    ViewRegion region;
+    int gridWidth{}, gridHeight{};
+    std::uint64_t generation{};
+    std::vector<CellState> cells;
+};
+
+// Triple buffer between the simulation worker and the renderer. The worker fills the back snapshot and swaps it
+// with the handed-over one, the renderer swaps the handed-over one with the one it draws whenever it is newer.
+// Neither side ever waits for the other, and the renderer always gets the latest published generation.
+struct SnapshotBuffer {
+    ForestSnapshot &back() {
+        return snapshots[backIndex];
+    }
+
+    void publish() {
+        backIndex = handover.exchange(backIndex | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // True while the renderer has not picked up the last published snapshot yet.
+    [[nodiscard]] bool pending() const {
+        return handover.load(std::memory_order_acquire) & FRESH;
+    }
+
+    const ForestSnapshot &latest() {
+        if (handover.load(std::memory_order_relaxed) & FRESH)
+            frontIndex = handover.exchange(frontIndex, std::memory_order_acq_rel) & INDEX;
+
+        return snapshots[frontIndex];
+    }
+
+private:
+    static constexpr std::uint8_t INDEX = 0x3, FRESH = 0x4;
+
+    std::array<ForestSnapshot, 3> snapshots;
+    std::uint8_t backIndex{0}, frontIndex{1};
+    std::atomic<std::uint8_t> handover{2};
+};
+
+enum SimulationPace {
+    FREE_RUNNING,
+    LIMITED_RATE,
+    STEPWISE
+};
+
+enum SimulationCommandType {
+    RESET_FOREST,
+    RESIZE_FOREST,
+    SET_PARAMS,
+    SET_PACE,
+    MAKE_STEP,
+    IGNITE_CELL,
+    MEASURE_STEPS,
+    STOP_MEASURE,
+    MEASURE_CLUSTERS,
+    VERIFY_KERNELS,
+    SET_CLUSTER_INTERVAL,
+    SET_VIEW,
+    START_RECORDING,
+    STOP_RECORDING,
+    OPEN_REPLAY,
+    SEEK_REPLAY,
+    STEP_REPLAY,
+    CLOSE_REPLAY,
+    START_CAPTURE,
+    STOP_CAPTURE,
+    QUIT_WORKER
+};
+
+struct SimulationCommand {
+    SimulationCommandType type;
+    // SET_PARAMS and RESET_FOREST, which only uses the seed.
+    StepParams params{};
+    // IGNITE_CELL, RESIZE_FOREST as width and height, SET_CLUSTER_INTERVAL as the steps between two cluster
+    // measurements and STEP_REPLAY as the records to go forward or back in x.
+    int x{}, y{};
+    SimulationPace pace{FREE_RUNNING};
+    double stepsPerSecond{};
+    // SET_VIEW, clamped to the grid by the worker.
+    ViewRegion view{};
+    // START_RECORDING and OPEN_REPLAY.
+    std::string path{};
+    // SEEK_REPLAY, which shows the last recorded generation at or before it.
+    std::uint64_t generation{};
+    // MEASURE_STEPS, run with the parameters of the last SET_PARAMS.
+    BenchmarkSettings benchmark{};
+    // START_CAPTURE.
+    CaptureSettings capture{};
+};
+
+// Statistics of the step that produced a generation, sent back to the UI after every step.
+struct StepSample {
+    std::uint64_t generation{}, cells{};
+    StepStats stats;
+};
+
+// Sent back to the UI whenever the benchmark of a MEASURE_STEPS command is done.
+struct MeasurementResult {
+    BenchmarkResult result;
+    // No further MEASURE_STEPS commands are queued.
+    bool last{};
+};
+
+// Cluster size distribution of a generation, sent back to the UI after MEASURE_CLUSTERS and every cluster interval.
+struct ClusterResult {
+    std::uint64_t generation{};
+    double ms{};
+    ClusterHistogram histogram;
+    // Answers a MEASURE_CLUSTERS command rather than the interval.
+    bool requested{};
+};
+
+// Sent back to the UI when the cross-check of a VERIFY_KERNELS command is done.
+struct VerificationResult {
+    bool matches{};
+    BitplaneIsa isa{};
+    double ms{};
+};
+
+enum RecordingEventType {
+    RECORDING_STARTED,
+    RECORDING_STOPPED,
+    RECORDING_FAILED,
+    REPLAY_OPENED,
+    REPLAY_FAILED,
+    REPLAY_CLOSED,
+    CAPTURE_STARTED,
+    CAPTURE_STOPPED,
+    CAPTURE_FAILED
+};
+
+// Sent back to the UI whenever a recording, a replay or a capture starts or ends, including a recording the worker
+// stopped because the grid was reset or resized and a capture it stopped because the grid was resized.
+struct RecordingEvent {
+    RecordingEventType type;
+    // REPLAY_OPENED: the first and last recorded generations and the size of the recorded grid.
+    std::uint64_t first{}, last{};
+    int width{}, height{};
+    // RECORDING_STOPPED: generations written and dropped and the size of the file. CAPTURE_STOPPED: the same of the
+    // frames and all their files.
+    std::uint64_t recorded{}, dropped{}, bytes{};
+};
+
+// Owns the forest and steps it on its own thread, as fast as the pace allows and independent of the frame rate.
+// Everything the UI wants changed goes through the command queue and every completed generation the renderer has
+// caught up with is published through the snapshot buffer, so neither thread ever blocks the other.
+struct SimulationWorker {
+    void start(int width, int height, const StepParams &stepParams) {
+        params = stepParams;
+        thread = std::thread(&SimulationWorker::run, this, width, height);
+    }
+
+    void stop() {
+        if (!thread.joinable())
+            return;
+
+        while (!send({QUIT_WORKER}))
+            std::this_thread::yield();
+
+        thread.join();
+    }
+
+    // Called from the UI thread only. False when the queue is full, the command is dropped then.
+    bool send(const SimulationCommand &command) {
+        return commands.push(command);
+    }
+
+    bool receive(MeasurementResult &result) {
+        return results.pop(result);
+    }
+
+    bool receive(StepSample &sample) {
+        return samples.pop(sample);
+    }
+
+    bool receive(ClusterResult &result) {
+        return clusterResults.pop(result);
+    }
+
+    bool receive(VerificationResult &result) {
+        return verificationResults.pop(result);
+    }
+
+    bool receive(RecordingEvent &event) {
+        return recordingEvents.pop(event);
+    }
+
+    const ForestSnapshot &latest() {
+        return snapshots.latest();
+    }
+
+    [[nodiscard]] int measuredSteps() const {
+        return measured.load(std::memory_order_relaxed);
+    }
+
+    // Generations written and dropped by the recording in progress.
+    [[nodiscard]] std::uint64_t recordedSteps() const {
+        return recorder.recorded.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] std::uint64_t droppedSteps() const {
+        return recorder.dropped.load(std::memory_order_relaxed);
+    }
+
+    // Frames written and dropped by the capture in progress.
+    [[nodiscard]] std::uint64_t capturedFrames() const {
+        return capture.captured.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] std::uint64_t droppedFrames() const {
+        return capture.dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    // The forest is allocated here, once the team of this thread is pinned, so its pages are first touched by the
+    // threads that step it and not by those of the UI thread.
+    void run(int width, int height) {
+        using namespace std::chrono;
+        bool changed = true;
+
+        tracing.nameThread("simulation");
+        applyPlacement();
+        grid.resize(width, height);
+        initGrid(grid, params.seed);
+
+        while (true) {
+            SimulationCommand command;
+
+            while (commands.pop(command)) {
+                if (command.type == QUIT_WORKER)
+                    return;
+
+                changed |= apply(command);
+            }
+
+            // A benchmark holds the forest still and steps a grid of its own, nothing is published meanwhile.
+            if (!benchmarks.empty()) {
+                benchmarkStep();
+                continue;
+            }
+
+            bool advanced = false;
+
+            // A replay plays its records at the pace of the simulation, one record per step.
+            if (replay.opened()) {
+                advanced = dueForStep() && replay.shownRecord() + 1 < static_cast<std::ptrdiff_t>(replay.records()) &&
+                           showReplay(replay.shownRecord() + 1);
+            } else if (dueForStep()) {
+                StepStats stats;
+                stepGrid(grid, params, generation, &stats);
+                generation += params.stepLength();
+
+                // Dropped while the UI is not keeping up, the plots just get a gap then.
+                samples.push({generation, grid.size(), stats});
+
+                // A step of the temporal kernel may jump over the generation that is due.
+                if (clusterInterval > 0 && generation % clusterInterval < params.stepLength())
+                    measureClusters(false);
+
+                // Dropped rather than waited for while the disk is not keeping up.
+                recorder.record(grid, generation);
+                advanced = true;
+            }
+
+            if (advanced) {
+                changed = true;
+
+                // Replays are captured as well, so a recorded run can be turned into a video afterwards.
+                capture.capture(grid, generation);
+
+                // Only copy a generation once the renderer took the previous one, at most one per frame.
+                if (!snapshots.pending()) {
+                    publish();
+                    changed = false;
+                }
+            } else {
+                if (changed) {
+                    publish();
+                    changed = false;
+                }
+
+                std::this_thread::sleep_for(microseconds(500));
+            }
+        }
+    }
+
+    bool apply(const SimulationCommand &command) {
+        switch (command.type) {
+            case RESET_FOREST:
+                stopRecording();
+                closeReplay();
+                params.seed = command.params.seed;
+                initGrid(grid, params.seed);
+                generation = 0;
+                return true;
+            case RESIZE_FOREST:
+                if (command.x != grid.width || command.y != grid.height) {
+                    stopRecording();
+                    closeReplay();
+                    stopCapture();
+                }
+
+                grid.resize(command.x, command.y);
+                return true;
+            case SET_PARAMS:
+                params = command.params;
+                return false;
+            case SET_PACE:
+                pace = command.pace;
+                stepsPerSecond = command.stepsPerSecond;
+                nextStep = std::chrono::steady_clock::now();
+                pendingSteps = 0;
+                return false;
+            case MAKE_STEP:
+                pendingSteps++;
+                return false;
+            case IGNITE_CELL:
+                if (command.x < 0 || command.x >= grid.width || command.y < 0 || command.y >= grid.height ||
+                    grid.at(command.x, command.y) != TREE)
+                    return false;
+
+                grid.at(command.x, command.y) = FIRE;
+                grid.markEdited();
+                return true;
+            case MEASURE_STEPS: {
+                if (benchmarks.empty())
+                    measured.store(0, std::memory_order_relaxed);
+
+                BenchmarkSettings settings = command.benchmark;
+                settings.width = std::max(settings.width, 1);
+                settings.height = std::max(settings.height, 1);
+                settings.warmup = std::max(settings.warmup, 0);
+                settings.steps = std::max(settings.steps, 1);
+                settings.trials = std::max(settings.trials, 1);
+                benchmarks.push_back(settings);
+                return false;
+            }
+            case STOP_MEASURE:
+                benchmarks.clear();
+                benchmarkIndex = 0;
+                trialRates.clear();
+                benchmarkGrid.resize(0, 0);
+                measured.store(0, std::memory_order_relaxed);
+                return false;
+            case VERIFY_KERNELS:
+                checkKernels();
+                return false;
+            case MEASURE_CLUSTERS:
+                measureClusters(true);
+                return false;
+            case SET_CLUSTER_INTERVAL:
+                clusterInterval = std::max(command.x, 0);
+                return false;
+            case SET_VIEW:
+                view = command.view;
+                return true;
+            case START_RECORDING:
+                if (replay.opened() || !recorder.start(command.path.c_str(), grid, params)) {
+                    sendEvent({RECORDING_FAILED});
+                    return false;
+                }
+
+                // The generation shown when recording starts is the first keyframe.
+                recorder.record(grid, generation, true);
+                sendEvent({RECORDING_STARTED});
+                return false;
+            case STOP_RECORDING:
+                stopRecording();
+                return false;
+            case OPEN_REPLAY:
+                stopRecording();
+
+                if (!replay.open(command.path.c_str()) || !showReplay(0)) {
+                    replay.close();
+                    sendEvent({REPLAY_FAILED});
+                    return false;
+                }
+
+                sendEvent({REPLAY_OPENED, replay.firstGeneration(), replay.lastGeneration(), grid.width, grid.height});
+                return true;
+            case SEEK_REPLAY:
+                if (!replay.opened() || !replay.seek(grid, command.generation))
+                    return false;
+
+                generation = replay.shownGeneration();
+                return true;
+            case STEP_REPLAY:
+                return replay.opened() && showReplay(replay.shownRecord() + command.x);
+            case CLOSE_REPLAY:
+                // The simulation goes on from the generation shown last.
+                closeReplay();
+                return false;
+            case START_CAPTURE:
+                if (!capture.start(command.capture, grid)) {
+                    sendEvent({CAPTURE_FAILED});
+                    return false;
+                }
+
+                capture.capture(grid, generation);
+                sendEvent({CAPTURE_STARTED});
+                return false;
+            case STOP_CAPTURE:
+                stopCapture();
+                return false;
+            case QUIT_WORKER:
+                return false;
+        }
+
+        return false;
+    }
+
+    bool dueForStep() {
+        switch (pace) {
+            case FREE_RUNNING:
+                return true;
+            case LIMITED_RATE: {
+                auto now = std::chrono::steady_clock::now();
+
+                if (now < nextStep)
+                    return false;
+
+                auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                        std::chrono::duration<double>(1.0 / std::max(stepsPerSecond, 1.0)));
+
+                // A worker that fell behind does not try to catch up with a burst of steps.
+                nextStep = std::max(nextStep + interval, now);
+                return true;
+            }
+            case STEPWISE:
+                if (pendingSteps == 0)
+                    return false;
+
+                pendingSteps--;
+                return true;
+        }
+
+        return false;
+    }
+
+    // One step of the benchmark at the front of the queue, so commands are still handled between two steps. Every
+    // trial starts a fresh forest with the parameters the benchmark started with and a seed of its own, and only
+    // the steps after the warmup are timed.
+    void benchmarkStep() {
+        const auto &settings = benchmarks.front();
+
+        if (benchmarkIndex == 0) {
+            if (trialRates.empty())
+                benchmarkParams = params;
+
+            benchmarkParams.seed = params.seed + trialRates.size();
+            benchmarkGrid.resize(settings.width, settings.height);
+            initGrid(benchmarkGrid, benchmarkParams.seed);
+            trialMs = 0.0;
+            trialGenerations = 0;
+        }
+
+        StepStats stats;
+        auto start = std::chrono::steady_clock::now();
+        auto step = static_cast<std::uint64_t>(benchmarkIndex) * benchmarkParams.stepLength();
+        stepGrid(benchmarkGrid, benchmarkParams, step, &stats);
+        auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        // A step of instant burning covers a varying number of generations.
+        if (benchmarkIndex >= settings.warmup) {
+            trialMs += ms;
+            trialGenerations += stats.generations;
+        }
+
+        measured.fetch_add(1, std::memory_order_relaxed);
+
+        if (++benchmarkIndex < settings.warmup + settings.steps)
+            return;
+
+        benchmarkIndex = 0;
+        trialRates.push_back(static_cast<double>(trialGenerations) / (std::max(trialMs, 1e-6) / 1000.0));
+
+        if (static_cast<int>(trialRates.size()) < settings.trials)
+            return;
+
+        const auto cells = static_cast<double>(settings.width) * settings.height;
+        auto generations = summarizeTrials(trialRates);
+        MeasurementResult result{{describeParams(benchmarkParams), settings.width, settings.height, settings.steps,
+                                  settings.trials, generations, {generations.mean * cells, generations.ci * cells}}};
+
+        trialRates.clear();
+        benchmarks.pop_front();
+        result.last = benchmarks.empty();
+
+        if (result.last)
+            benchmarkGrid.resize(0, 0);
+
+        while (!results.push(result))
+            std::this_thread::yield();
+    }
+
+    // Copies the requested view into the back snapshot, from the pyramid when it is zoomed out, and hands it over.
+    // The view may lag behind a resize, so it is clamped to the grid first.
+    void publish() {
+        TraceScope trace("publish");
+        ViewRegion clamped = view;
+        clamped.level = std::clamp(clamped.level, 0, topLevel(grid.width, grid.height));
+
+        int levelWidth = levelSize(grid.width, clamped.level), levelHeight = levelSize(grid.height, clamped.level);
+        clamped.x = std::clamp(clamped.x, 0, levelWidth);
+        clamped.y = std::clamp(clamped.y, 0, levelHeight);
+        clamped.width = std::clamp(clamped.width, 0, levelWidth - clamped.x);
+        clamped.height = std::clamp(clamped.height, 0, levelHeight - clamped.y);
+
+        if (clamped.level > 0)
+            pyramid.update(grid, generation, clamped);
+
+        snapshots.back().copy(grid, pyramid, clamped, generation);
+        snapshots.publish();
+    }
+
+    bool showReplay(std::ptrdiff_t record) {
+        if (!replay.show(grid, record))
+            return false;
+
+        generation = replay.shownGeneration();
+        return true;
+    }
+
+    void stopRecording() {
+        if (!recorder.active())
+            return;
+
+        RecordingEvent event{RECORDING_STOPPED};
+        event.dropped = recorder.dropped.load(std::memory_order_relaxed);
+
+        if (!recorder.stop())
+            event.type = RECORDING_FAILED;
+
+        event.recorded = recorder.recorded.load(std::memory_order_relaxed);
+        event.bytes = recorder.bytes.load(std::memory_order_relaxed);
+        sendEvent(event);
+    }
+
+    void stopCapture() {
+        if (!capture.active())
+            return;
+
+        RecordingEvent event{CAPTURE_STOPPED};
+
+        if (!capture.stop())
+            event.type = CAPTURE_FAILED;
+
+        event.recorded = capture.captured.load(std::memory_order_relaxed);
+        event.dropped = capture.dropped.load(std::memory_order_relaxed);
+        event.bytes = capture.bytes.load(std::memory_order_relaxed);
+        sendEvent(event);
+    }
+
+    void closeReplay() {
+        if (!replay.opened())
+            return;
+
+        replay.close();
+        sendEvent({REPLAY_CLOSED});
+    }
+
+    // Unlike samples, events are never dropped, there are only a few of them.
+    void sendEvent(const RecordingEvent &event) {
+        while (!recordingEvents.push(event))
+            std::this_thread::yield();
+    }
+
+    // Labels only the tiles that changed since the last measurement, so measuring every few steps stays cheap.
+    void measureClusters(bool requested) {
+        TraceScope trace("clusters");
+        auto start = std::chrono::steady_clock::now();
+        ClusterResult result{generation, 0.0, clusters.update(grid, params.logic), requested};
+        result.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        // Dropped while the UI is not keeping up, like the step samples.
+        clusterResults.push(result);
+    }
+
+    // Cross-checks the kernels on grids of their own, which holds the forest still meanwhile but not the UI.
+    void checkKernels() {
+        auto start = std::chrono::steady_clock::now();
+        VerificationResult result{verifyKernels(333, 197, 50, 0.01, 0.05, params.seed), detectBitplaneIsa()};
+        result.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        while (!verificationResults.push(result))
+            std::this_thread::yield();
+    }
+
+    // Worker thread only.
+    ForestGrid grid{0, 0};
+    StepParams params;
+    std::uint64_t generation{0};
+    SimulationPace pace{FREE_RUNNING};
+    double stepsPerSecond{};
+    std::chrono::steady_clock::time_point nextStep;
+    int pendingSteps{0};
+    std::deque<BenchmarkSettings> benchmarks;
+    ForestGrid benchmarkGrid{0, 0};
+    StepParams benchmarkParams;
+    int benchmarkIndex{0};
+    double trialMs{};
+    std::uint64_t trialGenerations{};
+    std::vector<double> trialRates;
+    ClusterLabeling clusters;
+    int clusterInterval{0};
+    ViewRegion view;
+    ForestPyramid pyramid;
+    RunRecorder recorder;
+    RunReplay replay;
+    FrameCapture capture;
+
+    // Shared with the UI thread.
+    SpscQueue<SimulationCommand, 256> commands;
+    SpscQueue<MeasurementResult, 16> results;
+    SpscQueue<StepSample, 4096> samples;
+    SpscQueue<ClusterResult, 64> clusterResults;
+    SpscQueue<VerificationResult, 16> verificationResults;
+    SpscQueue<RecordingEvent, 16> recordingEvents;
+    SnapshotBuffer snapshots;
+    std::atomic<int> measured{0};
+
+    std::thread thread;
+};
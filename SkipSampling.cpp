@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#include <omp.h>
+
+#include "ForestGrid.cpp"
+#include "Random.cpp"
+#include "Tracing.cpp"
+
+// Cells per independently seeded stream. Fixed, so the events do not depend on the thread count, and small enough
+// to give every thread several chunks on the default grid.
+const std::uint64_t SKIP_CHUNK = 1 << 14;
+
+// Philox keys of the lightning and growth streams are derived from the seed with these, so they never coincide
+// with the per-cell draws.
+const std::uint64_t IGNITION_STREAM = 0x5851F42D4C957F2Dull;
+const std::uint64_t GROWTH_STREAM = 0x14057B7EF767814Full;
+
+// Uniform doubles in (0, 1] for one chunk of one generation, two per Philox block. Blocks are computed
+// STREAM_BLOCKS at a time with the rounds running over all of them side by side, like cellRandomRange, so the
+// compiler can vectorize them.
+struct ChunkStream {
+    static constexpr int STREAM_BLOCKS = 4;
+
+    ChunkStream(std::uint64_t key, std::uint64_t step, std::uint64_t chunk) : key(key), step(step), chunk(chunk) {}
+
+    double next() {
+        if (used == 2 * STREAM_BLOCKS)
+            refill();
+
+        return draws[used++];
+    }
+
+private:
+    void refill() {
+        std::uint32_t c0[STREAM_BLOCKS], c1[STREAM_BLOCKS], c2[STREAM_BLOCKS], c3[STREAM_BLOCKS];
+
+        for (int b = 0; b < STREAM_BLOCKS; ++b) {
+            c0[b] = static_cast<std::uint32_t>(counter + b);
+            c1[b] = static_cast<std::uint32_t>(chunk);
+            c2[b] = static_cast<std::uint32_t>(step);
+            c3[b] = static_cast<std::uint32_t>(step >> 32);
+        }
+
+        auto k0 = static_cast<std::uint32_t>(key), k1 = static_cast<std::uint32_t>(key >> 32);
+
+        for (int round = 0; round < 10; ++round) {
+            for (int b = 0; b < STREAM_BLOCKS; ++b) {
+                std::uint64_t product0 = static_cast<std::uint64_t>(0xD2511F53u) * c0[b];
+                std::uint64_t product1 = static_cast<std::uint64_t>(0xCD9E8D57u) * c2[b];
+
+                c0[b] = static_cast<std::uint32_t>(product1 >> 32) ^ c1[b] ^ k0;
+                c1[b] = static_cast<std::uint32_t>(product1);
+                c2[b] = static_cast<std::uint32_t>(product0 >> 32) ^ c3[b] ^ k1;
+                c3[b] = static_cast<std::uint32_t>(product0);
+            }
+
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
+
+        for (int b = 0; b < STREAM_BLOCKS; ++b) {
+            auto first = (static_cast<std::uint64_t>(c0[b]) << 21) ^ (c1[b] >> 11);
+            auto second = (static_cast<std::uint64_t>(c2[b]) << 21) ^ (c3[b] >> 11);
+            draws[2 * b] = static_cast<double>(first + 1) * 0x1.0p-53;
+            draws[2 * b + 1] = static_cast<double>(second + 1) * 0x1.0p-53;
+        }
+
+        counter += STREAM_BLOCKS;
+        used = 0;
+    }
+
+    std::uint64_t key, step, chunk;
+    std::uint64_t counter{};
+    double draws[2 * STREAM_BLOCKS]{};
+    int used{2 * STREAM_BLOCKS};
+};
+
+// Calls hit(index) for exactly the indices in [begin, end) that independent Bernoulli(q) trials would select. The
+// gap to the next hit is geometric, so it is drawn directly and only O(q * (end - begin)) draws are needed.
+template<typename Hit>
+void forEachHit(double q, std::uint64_t key, std::uint64_t step, std::uint64_t chunk, std::uint64_t begin,
+                std::uint64_t end, Hit hit) {
+    if (q <= 0.0)
+        return;
+
+    if (q >= 1.0) {
+        for (auto index = begin; index < end; ++index)
+            hit(index);
+        return;
+    }
+
+    const double logMiss = std::log1p(-q);
+    ChunkStream stream(key, step, chunk);
+
+    for (auto index = begin; index < end; ++index) {
+        double gap = std::floor(std::log(stream.next()) / logMiss);
+
+        if (gap >= static_cast<double>(end - index))
+            break;
+
+        index += static_cast<std::uint64_t>(gap);
+        hit(index);
+    }
+}
+
+// Lightning and growth of a whole generation by skip sampling, to be called by every thread of an enclosing
+// parallel region once the deterministic part of the step is in next. Lightning only hits cells that were TREE in
+// current and growth only cells that were EMPTY, which is the same rule as the per-cell draws. next may be the same
+// buffer as current for kernels that update in place, lightning runs first so a grown tree is never ignited.
+// Returns the strikes and regrown trees of the chunks the calling thread sampled.
+template<typename OnIgnite>
+StepStats sampleEvents(const ForestGrid &grid, const CellState *current, CellState *next, const StepParams &params,
+                       std::uint64_t step, OnIgnite onIgnite) {
+    const auto cells = static_cast<std::uint64_t>(grid.size());
+    const auto chunks = static_cast<std::int64_t>((cells + SKIP_CHUNK - 1) / SKIP_CHUNK);
+    StepStats events;
+    TraceScope work("skip sampling");
+
+#pragma omp for schedule(dynamic) nowait
+    for (std::int64_t chunk = 0; chunk < chunks; ++chunk) {
+        auto begin = static_cast<std::uint64_t>(chunk) * SKIP_CHUNK, end = std::min(begin + SKIP_CHUNK, cells);
+
+        forEachHit(params.p, params.seed ^ IGNITION_STREAM, step, chunk, begin, end, [&](std::uint64_t index) {
+            if (current[index] == TREE && next[index] == TREE) {
+                next[index] = FIRE;
+                events.struck++;
+                onIgnite(index);
+            }
+        });
+
+        forEachHit(params.g, params.seed ^ GROWTH_STREAM, step, chunk, begin, end, [&](std::uint64_t index) {
+            if (current[index] == EMPTY) {
+                next[index] = TREE;
+                events.grown++;
+            }
+        });
+    }
+
+    work.end();
+
+#pragma omp barrier
+
+    return events;
+}
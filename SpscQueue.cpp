@@ -0,0 +1,37 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread. push() fails instead of
+// blocking when the queue is full.
+template<typename T, std::size_t Capacity>
+struct SpscQueue {
+    bool push(const T &item) {
+        auto back = tail.load(std::memory_order_relaxed);
+
+        if (back - head.load(std::memory_order_acquire) == Capacity)
+            return false;
+
+        items[back % Capacity] = item;
+        tail.store(back + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &item) {
+        auto front = head.load(std::memory_order_relaxed);
+
+        if (front == tail.load(std::memory_order_acquire))
+            return false;
+
+        item = items[front % Capacity];
+        head.store(front + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::array<T, Capacity> items{};
+    alignas(64) std::atomic<std::size_t> head{0};
+    alignas(64) std::atomic<std::size_t> tail{0};
+};
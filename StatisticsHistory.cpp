@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cstdint>
+#include <cstdio>
+
+#include <imgui.h>
+
+const int STATISTICS_HISTORY = 2048;
+
+// The statistics of the last STATISTICS_HISTORY steps in a ring buffer, plotted in the Statistics window and exported
+// to CSV. The plotted values are kept as floats next to the raw counts, so ImGui can draw them straight from the
+// ring without copying.
+struct StatisticsHistory {
+    void add(const StepSample &sample) {
+        // A reset forest starts counting generations from the beginning, so does the history.
+        if (count > 0 && sample.generation <= newest().generation)
+            clear();
+
+        auto cells = static_cast<float>(std::max<std::uint64_t>(sample.cells, 1));
+
+        samples[next] = sample;
+        density[next] = static_cast<float>(sample.stats.trees) / cells;
+        fires[next] = static_cast<float>(sample.stats.fires);
+        struck[next] = static_cast<float>(sample.stats.struck);
+        grown[next] = static_cast<float>(sample.stats.grown);
+
+        next = (next + 1) % STATISTICS_HISTORY;
+        count = std::min(count + 1, STATISTICS_HISTORY);
+    }
+
+    void clear() {
+        next = 0;
+        count = 0;
+    }
+
+    // Oldest step first.
+    bool exportCsv(const char *path) const {
+        std::FILE *out = std::fopen(path, "w");
+
+        if (out == nullptr)
+            return false;
+
+        std::fprintf(out, "generation,cells,trees,fires,struck,grown,generations,density\n");
+
+        for (int i = 0; i < count; ++i) {
+            int slot = (first() + i) % STATISTICS_HISTORY;
+            const auto &sample = samples[slot];
+
+            std::fprintf(out, "%llu,%llu,%llu,%llu,%llu,%llu,%llu,%.6f\n",
+                         static_cast<unsigned long long>(sample.generation),
+                         static_cast<unsigned long long>(sample.cells),
+                         static_cast<unsigned long long>(sample.stats.trees),
+                         static_cast<unsigned long long>(sample.stats.fires),
+                         static_cast<unsigned long long>(sample.stats.struck),
+                         static_cast<unsigned long long>(sample.stats.grown),
+                         static_cast<unsigned long long>(sample.stats.generations), density[slot]);
+        }
+
+        return std::fclose(out) == 0;
+    }
+
+    void draw(const char *title, bool *open) {
+        ImGui::SetNextWindowSize(ImVec2(400, 0));
+
+        if (!ImGui::Begin(title, open)) {
+            ImGui::End();
+            return;
+        }
+
+        if (ImGui::SmallButton("Export CSV")) {
+            if (exportCsv(STATISTICS_FILE))
+                measurements.AddLog("[%s] Statistics of %i steps written to %s\n", "info", count, STATISTICS_FILE);
+            else
+                measurements.AddLog("[%s] Could not write %s!\n", "error", STATISTICS_FILE);
+        }
+
+        ImGui::SameLine();
+
+        if (ImGui::SmallButton("Clear"))
+            clear();
+
+        if (count > 0) {
+            const auto &last = newest();
+
+            ImGui::SameLine();
+            ImGui::TextDisabled("Generation %llu: %llu trees, %llu burning",
+                                static_cast<unsigned long long>(last.generation),
+                                static_cast<unsigned long long>(last.stats.trees),
+                                static_cast<unsigned long long>(last.stats.fires));
+        }
+
+        ImGui::Separator();
+
+        const ImVec2 plotSize(-1.0f, 70.0f);
+
+        ImGui::PlotLines("##density", density.data(), count, first(), "Tree density", 0.0f, 1.0f, plotSize);
+        ImGui::PlotLines("##fires", fires.data(), count, first(), "Burning", 0.0f, FLT_MAX, plotSize);
+        ImGui::PlotLines("##struck", struck.data(), count, first(), "Struck by lightning", 0.0f, FLT_MAX, plotSize);
+        ImGui::PlotLines("##grown", grown.data(), count, first(), "Regrown", 0.0f, FLT_MAX, plotSize);
+
+        ImGui::End();
+    }
+
+private:
+    [[nodiscard]] const StepSample &newest() const {
+        return samples[(next + STATISTICS_HISTORY - 1) % STATISTICS_HISTORY];
+    }
+
+    // Slot of the oldest step.
+    [[nodiscard]] int first() const {
+        return count < STATISTICS_HISTORY ? 0 : next;
+    }
+
+    std::array<StepSample, STATISTICS_HISTORY> samples{};
+    std::array<float, STATISTICS_HISTORY> density{}, fires{}, struck{}, grown{};
+    int next{0}, count{0};
+};
+
+static StatisticsHistory statistics;
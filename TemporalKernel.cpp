@@ -0,0 +1,320 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <omp.h>
+
+#include "BitplaneKernel.cpp"
+#include "ForestGrid.cpp"
+#include "Random.cpp"
+#include "SkipSampling.cpp"
+#include "Tracing.cpp"
+
+// Tiles are whole words wide, so their bitplanes line up with the words of the grid rows. With a halo of one word
+// on both sides and MAX_BLOCK_DEPTH rows above and below, both generations of a tile take 200 KiB at most and
+// stay in L2 while it is advanced.
+const int TEMPORAL_TILE_WIDTH = 1024;
+const int TEMPORAL_TILE_HEIGHT = 256;
+const int TEMPORAL_TILE_WORDS = TEMPORAL_TILE_WIDTH / 64;
+
+// Words of a tile row: the halo word on both sides of the tile and a zero word beyond each of them.
+const int TEMPORAL_STRIDE = TEMPORAL_TILE_WORDS + 4;
+
+static_assert(MAX_BLOCK_DEPTH <= 64, "the horizontal halo of a temporal tile is one word");
+static_assert(SKIP_CHUNK <= 65536, "skip-sampled hits are stored as 16-bit offsets into their chunk");
+
+// Skip-sampled hits of one chunk of one generation, as offsets into the chunk in increasing order.
+using ChunkHits = std::vector<std::uint16_t>;
+
+// Bitplanes of one tile with its halo, in two generations. Row r holds grid row y0 - depth + r, word w of a row the
+// 64 cells from x0 + 64 (w - 1), so word 0 and word TEMPORAL_TILE_WORDS + 1 are the halo.
+struct TemporalTile {
+    explicit TemporalTile(int depth) {
+        auto size = static_cast<std::size_t>(TEMPORAL_TILE_HEIGHT + 2 * depth) * TEMPORAL_STRIDE;
+
+        for (int g = 0; g < 2; ++g) {
+            tree[g].assign(size, 0);
+            fire[g].assign(size, 0);
+        }
+    }
+
+    std::uint64_t *treeRow(int g, int r) {
+        return tree[g].data() + static_cast<std::size_t>(r) * TEMPORAL_STRIDE + 1;
+    }
+
+    std::uint64_t *fireRow(int g, int r) {
+        return fire[g].data() + static_cast<std::size_t>(r) * TEMPORAL_STRIDE + 1;
+    }
+
+public:
+    std::vector<std::uint64_t> tree[2], fire[2];
+};
+
+// Draws the skip-sampled lightning and growth of generations step .. step + depth - 1 for every chunk up front, so
+// the tiles can look up the hits of any row in any of their generations. Called by every thread of a parallel region.
+static void sampleHits(const ForestGrid &grid, const StepParams &params, std::uint64_t step, int depth,
+                       std::vector<ChunkHits> &lightning, std::vector<ChunkHits> &growth) {
+    const auto cells = static_cast<std::uint64_t>(grid.size());
+    const auto chunks = static_cast<std::int64_t>((cells + SKIP_CHUNK - 1) / SKIP_CHUNK);
+
+#pragma omp for schedule(dynamic)
+    for (std::int64_t job = 0; job < depth * chunks; ++job) {
+        auto generation = step + job / chunks;
+        auto chunk = job % chunks;
+        auto begin = static_cast<std::uint64_t>(chunk) * SKIP_CHUNK, end = std::min(begin + SKIP_CHUNK, cells);
+
+        lightning[job].clear();
+        growth[job].clear();
+
+        forEachHit(params.p, params.seed ^ IGNITION_STREAM, generation, chunk, begin, end, [&](std::uint64_t index) {
+            lightning[job].push_back(static_cast<std::uint16_t>(index - begin));
+        });
+
+        forEachHit(params.g, params.seed ^ GROWTH_STREAM, generation, chunk, begin, end, [&](std::uint64_t index) {
+            growth[job].push_back(static_cast<std::uint16_t>(index - begin));
+        });
+    }
+}
+
+// Calls hit(x) for the hits in cells [x0, x1) of grid row y, in increasing x.
+template<typename Hit>
+static void forEachRowHit(const std::vector<ChunkHits> &hits, std::uint64_t firstChunk, std::uint64_t row, int x0,
+                          int x1, Hit hit) {
+    auto begin = row + x0, end = row + x1;
+
+    for (auto chunk = begin / SKIP_CHUNK; chunk * SKIP_CHUNK < end; ++chunk) {
+        const auto &offsets = hits[firstChunk + chunk];
+        auto base = chunk * SKIP_CHUNK;
+        auto from = std::lower_bound(offsets.begin(), offsets.end(), begin > base ? begin - base : 0);
+
+        for (auto it = from; it != offsets.end() && base + *it < end; ++it)
+            hit(static_cast<int>(base + *it - row));
+    }
+}
+
+// Advances the tile at (x0, y0) by depth generations and writes the last one to the next generation of the grid.
+// Generation t computes the rows t + 1 .. rows - t - 2 of the tile, so it only reads rows the previous generation
+// computed, and the rows of the tile itself are exact after depth of them. The halo words are computed in every
+// generation; their outer cells are wrong, as the zero words beyond read as empty, but the error moves one cell per
+// generation and never reaches the tile. counts gets the statistics of the cells of the tile only.
+static void advanceTile(ForestGrid &grid, const StepParams &params, std::uint64_t step, int depth, int x0, int y0,
+                        TemporalTile &tile, PackRowFn pack, UnpackRowFn unpack, const std::vector<ChunkHits> &lightning,
+                        const std::vector<ChunkHits> &growth, StepStats &counts) {
+    const int width = grid.width, height = grid.height, words = TEMPORAL_TILE_WORDS + 2;
+    const int x1 = std::min(x0 + TEMPORAL_TILE_WIDTH, width), y1 = std::min(y0 + TEMPORAL_TILE_HEIGHT, height);
+    const int top = y0 - depth, rows = y1 - y0 + 2 * depth;
+    const int haloX0 = std::max(x0 - 64, 0), haloX1 = std::min(x1 + 64, width);
+    const int firstWord = (haloX0 - (x0 - 64)) / 64, lastWord = firstWord + (haloX1 - haloX0 + 63) / 64;
+    const bool moore = params.logic == MOORE;
+    const auto igniteThreshold = params.igniteThreshold(), growThreshold = params.growThreshold();
+    const auto chunks = static_cast<std::uint64_t>((grid.size() + SKIP_CHUNK - 1) / SKIP_CHUNK);
+    std::uint64_t valid[TEMPORAL_TILE_WORDS + 2];
+    std::uint64_t trees = 0, fires = 0, struck = 0, grown = 0;
+
+    for (int w = 0; w < words; ++w) {
+        int x = x0 + 64 * (w - 1);
+        valid[w] = (x < 0 || x >= width) ? 0 : (width - x >= 64) ? ~0ull : (1ull << (width - x)) - 1;
+    }
+
+    for (int r = 0; r < rows; ++r) {
+        std::uint64_t *tree = tile.treeRow(0, r), *fire = tile.fireRow(0, r);
+        int y = top + r;
+
+        if (y < 0 || y >= height) {
+            std::fill_n(tree, words, 0);
+            std::fill_n(fire, words, 0);
+            continue;
+        }
+
+        std::fill(tree, tree + firstWord, 0);
+        std::fill(fire, fire + firstWord, 0);
+        std::fill(tree + lastWord, tree + words, 0);
+        std::fill(fire + lastWord, fire + words, 0);
+        pack(grid.row(y) + haloX0, haloX1 - haloX0, tree + firstWord, fire + firstWord);
+    }
+
+    int current = 0;
+
+    for (int t = 0; t < depth; ++t) {
+        const std::uint64_t generation = step + t;
+
+        for (int r = t + 1; r < rows - 1 - t; ++r) {
+            const int y = top + r;
+            std::uint64_t *nextTree = tile.treeRow(1 - current, r), *nextFire = tile.fireRow(1 - current, r);
+
+            if (y < 0 || y >= height) {
+                std::fill_n(nextTree, words, 0);
+                std::fill_n(nextFire, words, 0);
+                continue;
+            }
+
+            const std::uint64_t *tree = tile.treeRow(current, r);
+            const std::uint64_t *above = tile.fireRow(current, r - 1), *fire = tile.fireRow(current, r);
+            const std::uint64_t *below = tile.fireRow(current, r + 1);
+            const auto row = static_cast<std::uint64_t>(y) * width;
+            const bool counted = y >= y0 && y < y1;
+
+            for (int w = 0; w < words; ++w) {
+                auto spread = tree[w] & fireNearbyWord(above, fire, below, w, moore);
+                auto empty = ~tree[w] & ~fire[w] & valid[w];
+                auto candidates = (igniteThreshold ? tree[w] & ~spread : 0) | (growThreshold ? empty : 0);
+
+                nextFire[w] = spread;
+                nextTree[w] = tree[w] & ~spread;
+
+                if (candidates) {
+                    std::uint32_t draws[RANDOM_BATCH];
+                    int count = std::bit_width(valid[w]);
+                    std::uint64_t ignite = 0, grow = 0;
+
+                    cellRandomRange(params.seed, generation, row + x0 + 64 * (w - 1), count, draws);
+
+                    for (int b = 0; b < count; ++b) {
+                        ignite |= static_cast<std::uint64_t>(draws[b] < igniteThreshold) << b;
+                        grow |= static_cast<std::uint64_t>(draws[b] < growThreshold) << b;
+                    }
+
+                    ignite &= tree[w] & ~spread;
+                    grow &= empty;
+                    nextFire[w] |= ignite;
+                    nextTree[w] = (nextTree[w] & ~ignite) | grow;
+
+                    if (counted && w >= 1 && w <= TEMPORAL_TILE_WORDS) {
+                        struck += std::popcount(ignite);
+                        grown += std::popcount(grow);
+                    }
+                }
+            }
+
+            if (!params.skipSampling)
+                continue;
+
+            // Same rule as sampleEvents: lightning hits trees the fire left standing, growth the empty cells.
+            forEachRowHit(lightning, t * chunks, row, haloX0, haloX1, [&](int x) {
+                int w = (x - x0 + 64) / 64;
+                auto bit = 1ull << (x % 64);
+
+                if (tree[w] & nextTree[w] & bit) {
+                    nextTree[w] &= ~bit;
+                    nextFire[w] |= bit;
+                    struck += counted && x >= x0 && x < x1;
+                }
+            });
+
+            forEachRowHit(growth, t * chunks, row, haloX0, haloX1, [&](int x) {
+                int w = (x - x0 + 64) / 64;
+                auto bit = 1ull << (x % 64);
+
+                if (~tree[w] & ~fire[w] & bit) {
+                    nextTree[w] |= bit;
+                    grown += counted && x >= x0 && x < x1;
+                }
+            });
+        }
+
+        current = 1 - current;
+    }
+
+    for (int y = y0; y < y1; ++y) {
+        const std::uint64_t *tree = tile.treeRow(current, y - top), *fire = tile.fireRow(current, y - top);
+
+        for (int w = 1; w <= TEMPORAL_TILE_WORDS; ++w) {
+            trees += std::popcount(tree[w]);
+            fires += std::popcount(fire[w]);
+        }
+
+        unpack(tree + 1, fire + 1, x1 - x0, grid.nextRow(y) + x0);
+    }
+
+    counts.trees += trees;
+    counts.fires += fires;
+    counts.struck += struck;
+    counts.grown += grown;
+}
+
+// Tiles only carry a halo inside the grid, so a periodic boundary falls back to blockDepth bitplane steps, with the
+// statistics the blocked pass would give.
+static void stepTemporalPeriodic(ForestGrid &grid, const StepParams &params, std::uint64_t step, int depth,
+                                 BitplaneIsa isa, StepStats *stats) {
+    StepStats counts{}, last{};
+
+    for (int generation = 0; generation < depth; ++generation) {
+        stepBitplane(grid, params, step + generation, isa, &last);
+        counts.struck += last.struck;
+        counts.grown += last.grown;
+    }
+
+    const auto cells = static_cast<std::int64_t>(grid.size());
+    std::uint64_t trees = 0;
+
+#pragma omp parallel for default(none) shared(grid, cells) reduction(+ : trees)
+    for (std::int64_t i = 0; i < cells; ++i)
+        trees += grid.cells[i] == TREE;
+
+    if (stats)
+        *stats = {trees, last.fires, counts.struck, counts.grown, static_cast<std::uint64_t>(depth)};
+}
+
+// Temporal blocking of the bitplane rule: every tile is loaded once with a halo of blockDepth cells, advanced by
+// blockDepth generations while it stays in cache and written back once, so the grid goes through memory once per
+// blockDepth generations instead of once per generation. The halo is computed redundantly by the neighboring tiles.
+// Uses the draws of generations step .. step + blockDepth - 1, so it gives exactly the grid and the statistics that
+// many steps of the other kernels would give, except that fires are only those of the last generation.
+void stepTemporal(ForestGrid &grid, const StepParams &params, std::uint64_t step,
+                  BitplaneIsa isa = detectBitplaneIsa(), StepStats *stats = nullptr) {
+    thread_local std::vector<ChunkHits> threadLightning, threadGrowth;
+    std::vector<ChunkHits> &lightning = threadLightning, &growth = threadGrowth;
+    PackRowFn pack;
+    UnpackRowFn unpack;
+
+    const int depth = static_cast<int>(params.stepLength());
+
+    if (params.boundary == PERIODIC_BOUNDARY) {
+        stepTemporalPeriodic(grid, params, step, depth, isa, stats);
+        return;
+    }
+
+    selectBitplaneIsa(isa, pack, unpack);
+
+    const int columns = (grid.width + TEMPORAL_TILE_WIDTH - 1) / TEMPORAL_TILE_WIDTH;
+    const int tiles = columns * ((grid.height + TEMPORAL_TILE_HEIGHT - 1) / TEMPORAL_TILE_HEIGHT);
+    std::uint64_t trees = 0, fires = 0, struck = 0, grown = 0;
+
+    if (params.skipSampling) {
+        auto chunks = (grid.size() + SKIP_CHUNK - 1) / SKIP_CHUNK;
+        lightning.resize(depth * chunks);
+        growth.resize(depth * chunks);
+    }
+
+#pragma omp parallel default(none) shared(grid, params, step, depth, columns, tiles, pack, unpack, lightning, growth) reduction(+ : trees, fires, struck, grown)
+    {
+        TemporalTile tile(depth);
+        StepStats counts{};
+
+        if (params.skipSampling)
+            sampleHits(grid, params, step, depth, lightning, growth);
+
+        TraceScope work("temporal tiles");
+
+#pragma omp for schedule(dynamic) nowait
+        for (int index = 0; index < tiles; ++index)
+            advanceTile(grid, params, step, depth, (index % columns) * TEMPORAL_TILE_WIDTH,
+                        (index / columns) * TEMPORAL_TILE_HEIGHT, tile, pack, unpack, lightning, growth, counts);
+
+        work.end();
+
+        trees += counts.trees;
+        fires += counts.fires;
+        struck += counts.struck;
+        grown += counts.grown;
+    }
+
+    grid.swap();
+
+    if (stats)
+        *stats = {trees, fires, struck, grown, static_cast<std::uint64_t>(depth)};
+}
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <omp.h>
+
+#include "CellKernel.cpp"
+#include "ForestGrid.cpp"
+#include "Random.cpp"
+#include "SkipSampling.cpp"
+#include "Tracing.cpp"
+
+// 64 KiB per generation, so a tile, the one-cell halo around it and the tile of the next generation stay in L2.
+const int TILE_WIDTH = 256;
+const int TILE_HEIGHT = 256;
+
+// Contiguous range of tile indices owned by one thread. The owner takes from the front and thieves from the back;
+// both ends live in one word, so either side claims a tile with a single compare-exchange.
+struct alignas(64) TileQueue {
+    void assign(std::uint32_t front, std::uint32_t back) {
+        range.store(static_cast<std::uint64_t>(front) << 32 | back, std::memory_order_relaxed);
+    }
+
+    bool pop(std::uint32_t &tile) {
+        return take(tile, false);
+    }
+
+    bool steal(std::uint32_t &tile) {
+        return take(tile, true);
+    }
+
+private:
+    bool take(std::uint32_t &tile, bool fromBack) {
+        auto current = range.load(std::memory_order_relaxed);
+
+        while (true) {
+            auto front = static_cast<std::uint32_t>(current >> 32), back = static_cast<std::uint32_t>(current);
+
+            if (front >= back)
+                return false;
+
+            auto claimed = fromBack ? (static_cast<std::uint64_t>(front) << 32 | (back - 1))
+                                    : (static_cast<std::uint64_t>(front + 1) << 32 | back);
+
+            if (range.compare_exchange_weak(current, claimed, std::memory_order_acq_rel)) {
+                tile = fromBack ? back - 1 : front;
+                return true;
+            }
+        }
+    }
+
+    std::atomic<std::uint64_t> range{0};
+};
+
+// What the tiled kernel knows about every tile of the current generation. Like the fire front, it is only valid
+// while the grid has not been edited or stepped by another kernel, otherwise it is rebuilt from a scan.
+struct TileMap {
+    [[nodiscard]] bool tracks(const ForestGrid &grid, std::uint64_t step) const {
+        return editStamp == grid.editStamp && nextStep == step && width == grid.width && height == grid.height;
+    }
+
+    void rebuild(const ForestGrid &grid) {
+        width = grid.width;
+        height = grid.height;
+        columns = (width + TILE_WIDTH - 1) / TILE_WIDTH;
+        rows = (height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+        fires.assign(static_cast<std::size_t>(columns) * rows, 0);
+        empties.assign(fires.size(), 0);
+        settled.assign(fires.size(), 0);
+
+#pragma omp parallel for default(none) shared(grid)
+        for (int tile = 0; tile < columns * rows; ++tile) {
+            int x0 = (tile % columns) * TILE_WIDTH, y0 = (tile / columns) * TILE_HEIGHT;
+
+            for (int y = y0; y < std::min(y0 + TILE_HEIGHT, height); ++y)
+                for (int x = x0; x < std::min(x0 + TILE_WIDTH, width); ++x) {
+                    fires[tile] += grid.at(x, y) == FIRE;
+                    empties[tile] += grid.at(x, y) == EMPTY;
+                }
+        }
+
+        editStamp = grid.editStamp;
+    }
+
+    // No fire in the tile or its halo and nothing that could grow: only lightning can change it. With a periodic
+    // boundary, the halo of an edge tile lies in the tiles on the opposite edge.
+    [[nodiscard]] bool quiescent(int tile, bool canGrow, bool periodic) const {
+        if (empties[tile] != 0 && canGrow)
+            return false;
+
+        int column = tile % columns, row = tile / columns;
+
+        for (int dr = -1; dr <= 1; ++dr)
+            for (int dc = -1; dc <= 1; ++dc) {
+                int r = row + dr, c = column + dc;
+
+                if (periodic) {
+                    r = (r + rows) % rows;
+                    c = (c + columns) % columns;
+                } else if (r < 0 || r >= rows || c < 0 || c >= columns) {
+                    continue;
+                }
+
+                if (fires[r * columns + c] != 0)
+                    return false;
+            }
+
+        return true;
+    }
+
+public:
+    int width{}, height{}, columns{}, rows{};
+    std::vector<int> fires, empties;
+    // Non-zero when the tile holds the same cells in both generations, so a quiescent tile needs no copy.
+    std::vector<std::uint8_t> settled;
+    std::uint64_t editStamp{}, nextStep{};
+};
+
+// A quiescent tile only needs its lightning strikes; without per-cell draws it costs a copy at most. Returns the
+// number of strikes.
+static int stepQuiescentTile(ForestGrid &grid, const StepParams &params, std::uint64_t step, int x0, int y0, int x1,
+                              int y1, TileMap &map, int tile) {
+    const auto igniteThreshold = params.igniteThreshold();
+
+    if (igniteThreshold == 0) {
+        if (!map.settled[tile])
+            for (int y = y0; y < y1; ++y)
+                std::memcpy(grid.nextRow(y) + x0, grid.row(y) + x0, x1 - x0);
+
+        map.settled[tile] = 1;
+        return 0;
+    }
+
+    int fires = 0;
+
+    for (int y = y0; y < y1; ++y) {
+        CellDraws draws(params.seed, step);
+        const CellState *current = grid.row(y);
+        CellState *next = grid.nextRow(y);
+
+        for (int x = x0; x < x1; ++x) {
+            bool strike = current[x] == TREE && draws(grid.index(x, y)) < igniteThreshold;
+            next[x] = strike ? FIRE : current[x];
+            fires += strike;
+        }
+    }
+
+    map.fires[tile] = fires;
+    map.settled[tile] = fires == 0;
+    return fires;
+}
+
+// Own tiles first, then the other threads' tiles, nearest neighbor first.
+static bool claimTile(TileQueue *queues, int thread, int threads, std::uint32_t &tile) {
+    if (queues[thread].pop(tile))
+        return true;
+
+    for (int offset = 1; offset < threads; ++offset)
+        if (queues[(thread + offset) % threads].steal(tile))
+            return true;
+
+    return false;
+}
+
+// The per-cell kernel, computed tile by tile. Threads start on a contiguous share of the tiles and
+// steal from the back of other threads' shares once their own is done, so a fire concentrated in one region does
+// not leave the other threads idle. Tiles with no fire around and nothing to grow are quiescent and are only
+// checked for lightning.
+void stepTiled(ForestGrid &grid, const StepParams &params, std::uint64_t step, StepStats *stats = nullptr) {
+    thread_local TileMap threadMap;
+    TileMap &map = threadMap;
+
+    if (!map.tracks(grid, step))
+        map.rebuild(grid);
+
+    const int tiles = map.columns * map.rows;
+    const bool canGrow = params.g > 0.0, periodic = params.boundary == PERIODIC_BOUNDARY;
+    std::vector<std::uint8_t> quiescent(tiles);
+    auto queues = std::make_unique<TileQueue[]>(omp_get_max_threads());
+    const bool drawn = params.igniteThreshold() || params.growThreshold();
+    const CellBlockFn stepBlock = CELL_BLOCKS[params.logic][params.boundary][drawn];
+    std::uint64_t struck = 0, grown = 0;
+
+    for (int tile = 0; tile < tiles; ++tile)
+        quiescent[tile] = map.quiescent(tile, canGrow, periodic);
+
+#pragma omp parallel default(none) shared(grid, params, step, map, tiles, quiescent, queues, stepBlock) reduction(+ : struck, grown)
+    {
+        const int thread = omp_get_thread_num(), threads = omp_get_num_threads();
+
+        queues[thread].assign(static_cast<std::uint32_t>(static_cast<std::int64_t>(tiles) * thread / threads),
+                              static_cast<std::uint32_t>(static_cast<std::int64_t>(tiles) * (thread + 1) / threads));
+
+#pragma omp barrier
+
+        TraceScope work("tiles");
+        std::uint32_t tile;
+
+        while (claimTile(queues.get(), thread, threads, tile)) {
+            int x0 = static_cast<int>(tile % map.columns) * TILE_WIDTH;
+            int y0 = static_cast<int>(tile / map.columns) * TILE_HEIGHT;
+            int x1 = std::min(x0 + TILE_WIDTH, grid.width), y1 = std::min(y0 + TILE_HEIGHT, grid.height);
+
+            if (quiescent[tile]) {
+                struck += stepQuiescentTile(grid, params, step, x0, y0, x1, y1, map, static_cast<int>(tile));
+                continue;
+            }
+
+            StepStats counts{};
+            stepBlock(grid, params, step, counts, x0, y0, x1, y1, 0);
+
+            // Every fire burns out and only growth fills an empty cell. Trees grown by skip sampling are not
+            // subtracted, which only overestimates the empty cells: at worst the tile is not taken as quiescent.
+            map.empties[tile] += map.fires[tile] - static_cast<int>(counts.grown);
+            map.fires[tile] = static_cast<int>(counts.fires);
+            map.settled[tile] = 0;
+            struck += counts.struck;
+            grown += counts.grown;
+        }
+
+        work.end();
+
+#pragma omp barrier
+
+        if (params.skipSampling) {
+            auto events = sampleEvents(grid, grid.cells, grid.nextCells, params, step, [&](std::uint64_t index) {
+                int ignited = static_cast<int>(index % grid.width) / TILE_WIDTH +
+                              static_cast<int>(index / grid.width) / TILE_HEIGHT * map.columns;
+
+                std::atomic_ref<int>(map.fires[ignited]).fetch_add(1, std::memory_order_relaxed);
+                std::atomic_ref<std::uint8_t>(map.settled[ignited]).store(0, std::memory_order_relaxed);
+            });
+            struck += events.struck;
+            grown += events.grown;
+        }
+    }
+
+    grid.swap();
+    map.nextStep = step + 1;
+
+    if (stats) {
+        std::uint64_t fires = 0;
+
+        for (int tile = 0; tile < tiles; ++tile)
+            fires += map.fires[tile];
+
+        *stats = {0, fires, struck, grown};
+    }
+}
@@ -0,0 +1,320 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "SpscQueue.cpp"
+
+// Threads that can record spans at the same time, every OpenMP thread included. Spans of threads beyond them are not
+// recorded.
+const int TRACE_THREADS = 64;
+
+// Spans a thread can record before they are collected, more are dropped and counted.
+const std::size_t TRACE_RING = 8192;
+
+// Spans a TraceLog keeps for its statistics and the export, the oldest go first.
+const std::size_t TRACE_HISTORY = 1 << 17;
+
+// Nanoseconds from one cached summary of a TraceLog to the next, so a window showing them every frame only sorts the
+// whole history a few times a second.
+const std::uint64_t TRACE_SUMMARY_INTERVAL = 250000000;
+
+// One timed phase on one thread. Times are in nanoseconds of the steady clock, name is a string literal.
+struct TraceSpan {
+    const char *name;
+    std::uint64_t start, end;
+    int thread;
+};
+
+inline std::uint64_t traceNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Every thread records its spans into a ring of its own, which it allocates on its first span, so recording never
+// takes a lock or waits for another thread. A single reader collects the rings. A thread gives its ring back when it
+// exits, and the reader frees it once it has collected what is left in it, so threads that come and go, like the
+// writers of recordings and captures, do not use up the slots.
+struct TraceRegistry {
+    ~TraceRegistry() {
+        for (auto &ring: rings)
+            delete ring.load(std::memory_order_acquire);
+    }
+
+    void record(const char *name, std::uint64_t start, std::uint64_t end) {
+        auto &self = threadSlot();
+
+        if (self.registry == nullptr)
+            claimSlot(self);
+
+        if (self.registry == nullptr ||
+            !rings[self.slot].load(std::memory_order_relaxed)->push({name, start, end, self.slot}))
+            dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Names the calling thread in the export. Threads without a name are numbered. A thread that never records a
+    // span takes no slot for its name.
+    void nameThread(const char *name) {
+        auto &self = threadSlot();
+        self.name = name;
+
+        if (self.registry != nullptr)
+            names[self.slot].store(name, std::memory_order_relaxed);
+    }
+
+    // Appends the spans recorded since the last call and frees the rings of threads that exited. Only one thread may
+    // collect.
+    void collect(std::deque<TraceSpan> &spans) {
+        for (int slot = 0; slot < TRACE_THREADS; ++slot) {
+            Ring *ring = rings[slot].load(std::memory_order_acquire);
+            TraceSpan span{};
+
+            if (ring == nullptr)
+                continue;
+
+            // Read before the ring is emptied, so every span of a thread that exited is in it by then.
+            const bool exited = states[slot].load(std::memory_order_acquire) == SLOT_EXITED;
+
+            while (ring->pop(span))
+                spans.push_back(span);
+
+            if (exited) {
+                rings[slot].store(nullptr, std::memory_order_relaxed);
+                delete ring;
+                states[slot].store(SLOT_FREE, std::memory_order_release);
+            }
+        }
+    }
+
+    [[nodiscard]] const char *threadName(int thread) const {
+        return names[thread].load(std::memory_order_relaxed);
+    }
+
+public:
+    std::atomic<bool> enabled{false};
+    std::atomic<std::uint64_t> dropped{0};
+
+private:
+    using Ring = SpscQueue<TraceSpan, TRACE_RING>;
+
+    enum SlotState {
+        SLOT_FREE,
+        SLOT_ACTIVE,
+        // Its thread exited, the reader has yet to collect the rest of its ring.
+        SLOT_EXITED
+    };
+
+    // The slot of the calling thread, given back when it exits. No registry while it has none.
+    struct ThreadSlot {
+        ~ThreadSlot() {
+            if (registry != nullptr)
+                registry->states[slot].store(SLOT_EXITED, std::memory_order_release);
+        }
+
+        TraceRegistry *registry{};
+        int slot{};
+        const char *name{};
+    };
+
+    static ThreadSlot &threadSlot() {
+        thread_local ThreadSlot self;
+        return self;
+    }
+
+    // Takes the first free slot for the calling thread. While all are taken, its spans are dropped and it tries again
+    // with the next one.
+    void claimSlot(ThreadSlot &self) {
+        for (int slot = 0; slot < TRACE_THREADS; ++slot) {
+            int expected = SLOT_FREE;
+
+            if (states[slot].compare_exchange_strong(expected, SLOT_ACTIVE, std::memory_order_acquire)) {
+                names[slot].store(self.name, std::memory_order_relaxed);
+                rings[slot].store(new Ring, std::memory_order_release);
+                self.registry = this;
+                self.slot = slot;
+                return;
+            }
+        }
+    }
+
+    std::array<std::atomic<Ring *>, TRACE_THREADS> rings{};
+    std::array<std::atomic<const char *>, TRACE_THREADS> names{};
+    std::array<std::atomic<int>, TRACE_THREADS> states{};
+};
+
+static TraceRegistry tracing;
+
+// Times the scope it lives in while tracing is enabled, or up to end(). Otherwise it costs one relaxed load.
+struct TraceScope {
+    explicit TraceScope(const char *phase) : name(tracing.enabled.load(std::memory_order_relaxed) ? phase : nullptr),
+                                             start(name != nullptr ? traceNow() : 0) {}
+
+    ~TraceScope() {
+        end();
+    }
+
+    // Ends the span early, such as the work of an OpenMP thread before it waits at a barrier for the others.
+    void end() {
+        if (name != nullptr)
+            tracing.record(name, start, traceNow());
+
+        name = nullptr;
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    const char *name;
+    std::uint64_t start;
+};
+
+// Durations of the spans of one phase, in milliseconds.
+struct PhaseSummary {
+    std::string name;
+    std::size_t count{};
+    double p50{}, p99{}, mean{};
+    // For a phase recorded on several threads, like the work of every OpenMP thread in a step: the total of the
+    // busiest thread over that of the average one, 1 when the work is spread evenly.
+    int threads{};
+    double imbalance{1.0};
+};
+
+// The recent spans of every thread, collected from the registry.
+struct TraceLog {
+    void collect() {
+        const auto collected = spans.size();
+        tracing.collect(spans);
+        changed |= spans.size() != collected;
+
+        while (spans.size() > TRACE_HISTORY)
+            spans.pop_front();
+    }
+
+    void clear() {
+        spans.clear();
+        summaries.clear();
+        changed = false;
+    }
+
+    // Same as summarize(), but only computed again once new spans were collected, and at most every
+    // TRACE_SUMMARY_INTERVAL.
+    const std::vector<PhaseSummary> &cachedSummaries() {
+        const auto now = traceNow();
+
+        if (changed && now - summarizedAt >= TRACE_SUMMARY_INTERVAL) {
+            summaries = summarize();
+            summarizedAt = now;
+            changed = false;
+        }
+
+        return summaries;
+    }
+
+    // One summary per phase, in the order the phases were first recorded in.
+    [[nodiscard]] std::vector<PhaseSummary> summarize() const {
+        struct Phase {
+            const char *name;
+            std::vector<double> ms;
+            std::array<double, TRACE_THREADS> threadMs{};
+        };
+
+        std::vector<Phase> phases;
+
+        for (const auto &span: spans) {
+            auto phase = std::find_if(phases.begin(), phases.end(), [&](const Phase &p) {
+                return p.name == span.name || std::strcmp(p.name, span.name) == 0;
+            });
+
+            if (phase == phases.end())
+                phase = phases.insert(phases.end(), {span.name, {}, {}});
+
+            double ms = static_cast<double>(span.end - span.start) / 1e6;
+            phase->ms.push_back(ms);
+            phase->threadMs[span.thread] += ms;
+        }
+
+        std::vector<PhaseSummary> summaries;
+
+        for (auto &phase: phases) {
+            PhaseSummary summary{phase.name, phase.ms.size()};
+            std::sort(phase.ms.begin(), phase.ms.end());
+
+            auto at = [&](double q) {
+                return phase.ms[static_cast<std::size_t>(q * static_cast<double>(phase.ms.size() - 1) + 0.5)];
+            };
+
+            double total = 0.0, busiest = 0.0;
+
+            for (double ms: phase.threadMs) {
+                summary.threads += ms > 0.0;
+                total += ms;
+                busiest = std::max(busiest, ms);
+            }
+
+            summary.p50 = at(0.5);
+            summary.p99 = at(0.99);
+            summary.mean = total / static_cast<double>(phase.ms.size());
+            summary.imbalance = total > 0.0 ? busiest * summary.threads / total : 1.0;
+            summaries.push_back(summary);
+        }
+
+        return summaries;
+    }
+
+    // Writes the spans in the Chrome trace event format, which chrome://tracing and Perfetto open. Times start at
+    // the oldest span.
+    bool write(const char *path) const {
+        std::FILE *out = std::fopen(path, "w");
+
+        if (out == nullptr)
+            return false;
+
+        const std::uint64_t origin = spans.empty() ? 0 : std::min_element(spans.begin(), spans.end(),
+                [](const TraceSpan &a, const TraceSpan &b) { return a.start < b.start; })->start;
+        std::array<bool, TRACE_THREADS> used{};
+
+        std::fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+        // Microseconds, the unit of the format.
+        for (const auto &span: spans) {
+            double start = static_cast<double>(span.start - origin) / 1e3;
+            double duration = static_cast<double>(span.end - span.start) / 1e3;
+
+            std::fprintf(out, "{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, "
+                              "\"dur\": %.3f},\n", span.name, span.thread, start, duration);
+            used[span.thread] = true;
+        }
+
+        for (int thread = 0; thread < TRACE_THREADS; ++thread) {
+            if (!used[thread])
+                continue;
+
+            const char *name = tracing.threadName(thread);
+            std::string label = name != nullptr ? name : "thread " + std::to_string(thread);
+            std::fprintf(out, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                              "\"args\": {\"name\": \"%s\"}},\n", thread, label.c_str());
+        }
+
+        // Last, as the format allows no comma after the final event.
+        std::fprintf(out, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, "
+                          "\"args\": {\"name\": \"forest\"}}\n]}\n");
+        return std::fclose(out) == 0;
+    }
+
+public:
+    std::deque<TraceSpan> spans;
+
+private:
+    std::vector<PhaseSummary> summaries;
+    std::uint64_t summarizedAt{};
+    bool changed{false};
+};
@@ -0,0 +1,573 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "ClusterSizes.cpp"
+#include "Decomposition.cpp"
+#include "ForestGrid.cpp"
+#include "ForestPyramid.cpp"
+#include "FrameCapture.cpp"
+#include "KernelVerification.cpp"
+#include "Recording.cpp"
+#include "Simulation.cpp"
+
+// Self-checks of the simulation against plain reference implementations, run by forest_bench --verify. Each one
+// returns false on the first difference.
+
+// Every replica of the bit-sliced kernel has to be the exact forest the per-cell kernel computes for its seed with
+// skip sampling, for both neighborhoods. Returns false on the first replica that differs.
+bool verifyReplicas(int width, int height, int steps, double p, double g, std::uint64_t seed) {
+    ReplicaGrid replicas(width, height);
+    ForestGrid reference(width, height), candidate(width, height);
+
+    for (auto logic: {VON_NEUMANN, MOORE}) {
+        StepParams params{p, g, logic, CELL_KERNEL, seed, true};
+
+        initReplicas(replicas, seed);
+
+        for (int step = 0; step < steps; ++step)
+            stepReplicas(replicas, params, step);
+
+        for (int r = 0; r < REPLICAS; ++r) {
+            StepParams replicaParams = params;
+            replicaParams.seed = seed + r;
+
+            initGrid(reference, replicaParams.seed);
+
+            for (int step = 0; step < steps; ++step)
+                stepCells(reference, replicaParams, step);
+
+            replicas.extract(r, candidate);
+
+            if (std::memcmp(reference.cells, candidate.cells, reference.size()) != 0)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+// Cluster size histogram by a plain breadth-first search, the reference for the parallel union-find. With a periodic
+// boundary, clusters join across the edges of the grid.
+ClusterHistogram serialClusters(const ForestGrid &grid, NeighborhoodLogic logic,
+                                BoundaryMode boundary = FIXED_BOUNDARY) {
+    ClusterHistogram histogram;
+    std::vector<bool> seen(grid.size());
+    std::vector<std::size_t> queue;
+
+    auto visit = [&](std::size_t neighbor) {
+        if (grid.cells[neighbor] == TREE && !seen[neighbor]) {
+            seen[neighbor] = true;
+            queue.push_back(neighbor);
+        }
+    };
+
+    histogram.cells = grid.size();
+
+    for (std::size_t start = 0; start < grid.size(); ++start) {
+        if (grid.cells[start] != TREE || seen[start])
+            continue;
+
+        std::uint64_t size = 0;
+        queue.assign(1, start);
+        seen[start] = true;
+
+        while (!queue.empty()) {
+            auto cell = queue.back();
+            int x = static_cast<int>(cell % grid.width), y = static_cast<int>(cell / grid.width);
+            queue.pop_back();
+            size++;
+
+            if (boundary == PERIODIC_BOUNDARY)
+                forEachNeighbor<PERIODIC_BOUNDARY>(grid.width, grid.height, x, y, logic == MOORE, visit);
+            else
+                forEachNeighbor<FIXED_BOUNDARY>(grid.width, grid.height, x, y, logic == MOORE, visit);
+        }
+
+        histogram.bins[std::bit_width(size) - 1]++;
+        histogram.trees += size;
+        histogram.clusters++;
+        histogram.largest = std::max(histogram.largest, size);
+    }
+
+    return histogram;
+}
+
+// The parallel cluster labeling, updated incrementally after every step, has to give the same histogram as a
+// breadth-first search of the whole grid, for both neighborhoods. The size should not be a multiple of CLUSTER_TILE,
+// so the partial tiles at the edges get checked too.
+bool verifyClusters(int width, int height, int steps, double p, double g, std::uint64_t seed) {
+    ForestGrid grid(width, height);
+
+    for (auto logic: {VON_NEUMANN, MOORE}) {
+        StepParams params{p, g, logic, CELL_KERNEL, seed, true};
+        ClusterLabeling labeling;
+
+        initGrid(grid, seed);
+
+        for (int step = 0; step < steps; ++step) {
+            auto expected = serialClusters(grid, logic), actual = labeling.update(grid, logic);
+
+            if (actual.bins != expected.bins || actual.trees != expected.trees ||
+                actual.clusters != expected.clusters || actual.largest != expected.largest)
+                return false;
+
+            stepGrid(grid, params, step);
+        }
+    }
+
+    return true;
+}
+
+// After every instant-burn step, the burning cells have to be exactly one whole cluster: connected, with no tree left
+// next to them, and as many as the step reports, for both neighborhoods and boundaries. Starts from a full forest, so
+// the first strike burns nearly the whole grid and the parallel levels of the flood fill get exercised too.
+bool verifyInstantBurn(int width, int height, int steps, double p, double g, std::uint64_t seed) {
+    ForestGrid grid(width, height), burning(width, height);
+
+    for (auto [logic, boundary]: {std::pair{VON_NEUMANN, FIXED_BOUNDARY}, std::pair{MOORE, FIXED_BOUNDARY},
+                                  std::pair{VON_NEUMANN, PERIODIC_BOUNDARY}, std::pair{MOORE, PERIODIC_BOUNDARY}}) {
+        StepParams params{p, g, logic, CELL_KERNEL, seed, true, true};
+        params.boundary = boundary;
+
+        std::fill_n(grid.cells, grid.size(), TREE);
+        grid.markEdited();
+
+        for (int step = 0; step < steps; ++step) {
+            StepStats stats;
+            stepGrid(grid, params, step, &stats);
+
+            auto counts = countCells(grid);
+
+            if (stats.fires != counts[FIRE] || stats.trees != counts[TREE] || stats.struck != (stats.fires > 0))
+                return false;
+
+            bool untouched = true;
+            auto check = [&](std::size_t neighbor) { untouched &= grid.cells[neighbor] != FIRE; };
+
+            for (int y = 0; y < height; ++y)
+                for (int x = 0; x < width; ++x) {
+                    burning.at(x, y) = grid.at(x, y) == FIRE ? TREE : EMPTY;
+
+                    if (grid.at(x, y) != TREE)
+                        continue;
+
+                    if (boundary == PERIODIC_BOUNDARY)
+                        forEachNeighbor<PERIODIC_BOUNDARY>(width, height, x, y, logic == MOORE, check);
+                    else
+                        forEachNeighbor<FIXED_BOUNDARY>(width, height, x, y, logic == MOORE, check);
+                }
+
+            auto burned = serialClusters(burning, logic, boundary);
+
+            if (!untouched)
+                return false;
+
+            if (burned.clusters != stats.struck || burned.largest != stats.fires)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+// A pyramid updated incrementally under a view that moves and changes level from step to step, so tiles miss steps
+// and have to catch up, has to match one built from scratch under the view, and a cell of every level has to burn
+// exactly when a cell of its block of the grid does. The size should be odd on some levels, so the clamped last rows
+// and columns get checked too.
+bool verifyPyramid(int width, int height, int steps, double p, double g, std::uint64_t seed) {
+    ForestGrid grid(width, height);
+    ForestPyramid incremental;
+    StepParams params{p, g, MOORE, BITPLANE_KERNEL, seed, true};
+    const int top = topLevel(width, height);
+
+    initGrid(grid, seed);
+
+    for (int step = 0; step < steps; ++step) {
+        // Mostly a small part of the lowest levels, so most tiles miss most steps.
+        int level = step % 4 == 1 ? top : step % 4 == 2 ? std::min(2, top) : 1;
+        int levelWidth = levelSize(width, level), levelHeight = levelSize(height, level);
+        ViewRegion view{level, 0, 0, levelWidth, levelHeight};
+
+        if (step % 4 != 3) {
+            view.x = step * 37 % levelWidth;
+            view.y = step * 53 % levelHeight;
+            view.width = std::min(levelWidth - view.x, 100);
+            view.height = std::min(levelHeight - view.y, 70);
+        }
+
+        ForestPyramid scratch;
+        incremental.update(grid, step, view);
+        scratch.update(grid, step, {level, 0, 0, levelWidth, levelHeight});
+
+        for (int l = 1; l <= level; ++l) {
+            int shift = level - l;
+            int x0 = view.x << shift, x1 = std::min((view.x + view.width) << shift, levelSize(width, l));
+            int y0 = view.y << shift, y1 = std::min((view.y + view.height) << shift, levelSize(height, l));
+
+            for (int y = y0; y < y1; ++y) {
+                if (!std::equal(incremental.row(l, y) + x0, incremental.row(l, y) + x1, scratch.row(l, y) + x0))
+                    return false;
+
+                for (int x = x0; x < x1; ++x) {
+                    bool burning = false;
+
+                    for (int gy = y << l; gy < std::min((y + 1) << l, height); ++gy)
+                        for (int gx = x << l; gx < std::min((x + 1) << l, width); ++gx)
+                            burning |= grid.at(gx, gy) == FIRE;
+
+                    if (burning != (incremental.row(l, y)[x] == FIRE))
+                        return false;
+                }
+            }
+        }
+
+        stepGrid(grid, params, step);
+    }
+
+    return true;
+}
+
+// A run recorded with gaps between the recorded generations and more than one keyframe has to replay exactly, seeking
+// forward one record at a time as well as back and forth at random, where a generation that was not recorded shows
+// the one recorded before it. Cut off inside its last record, the recording has to replay up to the one before.
+bool verifyRecording(int width, int height, int steps, double p, double g, std::uint64_t seed) {
+    const auto path = (std::filesystem::temp_directory_path() / "forest_verify.frec").string();
+    ForestGrid grid(width, height);
+    StepParams params{p, g, MOORE, BITPLANE_KERNEL, seed, true};
+    std::vector<std::vector<CellState>> recorded;
+    std::vector<std::uint64_t> generations;
+    RunRecorder recorder;
+
+    initGrid(grid, seed);
+
+    if (!recorder.start(path.c_str(), grid, params))
+        return false;
+
+    for (int step = 0; step < steps; ++step) {
+        if (step % 3 != 1) {
+            recorder.record(grid, step, true);
+            recorded.emplace_back(grid.cells, grid.cells + grid.size());
+            generations.push_back(step);
+        }
+
+        stepGrid(grid, params, step);
+    }
+
+    if (!recorder.stop() || recorder.dropped != 0)
+        return false;
+
+    RunReplay replay;
+    ForestGrid shown(1, 1);
+
+    auto shows = [&](std::size_t record) {
+        return shown.width == width && shown.height == height &&
+               std::equal(shown.cells, shown.cells + shown.size(), recorded[record].begin());
+    };
+
+    if (!replay.open(path.c_str()) || replay.records() != recorded.size())
+        return false;
+
+    for (std::size_t record = 0; record < recorded.size(); ++record)
+        if (!replay.seek(shown, generations[record]) || !shows(record))
+            return false;
+
+    std::uint64_t state = seed;
+
+    for (int i = 0; i < 50; ++i) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        auto generation = (state >> 33) % static_cast<std::uint64_t>(steps);
+        auto record = std::upper_bound(generations.begin(), generations.end(), generation) - generations.begin() - 1;
+
+        if (!replay.seek(shown, generation) || !shows(record))
+            return false;
+    }
+
+    replay.close();
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+
+    bool cutOff = replay.open(path.c_str()) && replay.records() == recorded.size() - 1 &&
+                  replay.seek(shown, generations.back()) && shows(recorded.size() - 2);
+
+    replay.close();
+    std::filesystem::remove(path);
+    return cutOff;
+}
+
+// Cells of a PNG that encodePng wrote: every chunk has to carry its CRC and the stored deflate blocks their lengths
+// and the Adler-32 of the data. Empty if anything does not check out.
+std::vector<CellState> decodeCapturedPng(const std::vector<std::uint8_t> &png, int width, int height) {
+    const std::uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    auto bigEndian = [&png](std::size_t at) {
+        return std::uint32_t{png[at]} << 24 | std::uint32_t{png[at + 1]} << 16 | std::uint32_t{png[at + 2]} << 8 |
+               png[at + 3];
+    };
+    std::vector<std::uint8_t> stream, raw;
+
+    if (png.size() < sizeof(signature) || !std::equal(signature, signature + sizeof(signature), png.begin()))
+        return {};
+
+    for (std::size_t at = sizeof(signature); at + 12 <= png.size();) {
+        const std::size_t length = bigEndian(at);
+
+        if (at + 12 + length > png.size() || pngCrc(png.data() + at + 4, length + 4) != bigEndian(at + 8 + length))
+            return {};
+
+        if (std::memcmp(png.data() + at + 4, "IDAT", 4) == 0)
+            stream.insert(stream.end(), png.begin() + static_cast<std::ptrdiff_t>(at + 8),
+                          png.begin() + static_cast<std::ptrdiff_t>(at + 8 + length));
+
+        at += 12 + length;
+    }
+
+    for (std::size_t at = 2; at + 5 <= stream.size();) {
+        const std::size_t length = stream[at + 1] | stream[at + 2] << 8;
+        const std::size_t complement = stream[at + 3] | stream[at + 4] << 8;
+        const bool last = stream[at] == 1;
+
+        if ((stream[at] & ~1) != 0 || complement != (~length & 0xFFFF) ||
+            at + 5 + length > stream.size())
+            return {};
+
+        raw.insert(raw.end(), stream.begin() + static_cast<std::ptrdiff_t>(at + 5),
+                   stream.begin() + static_cast<std::ptrdiff_t>(at + 5 + length));
+        at += 5 + length;
+
+        if (last) {
+            std::uint32_t a = 1, b = 0;
+
+            for (auto byte: raw) {
+                a = (a + byte) % 65521;
+                b = (b + a) % 65521;
+            }
+
+            if (at + 4 != stream.size() ||
+                (std::uint32_t{stream[at]} << 24 | std::uint32_t{stream[at + 1]} << 16 |
+                 std::uint32_t{stream[at + 2]} << 8 | stream[at + 3]) != (b << 16 | a))
+                return {};
+
+            break;
+        }
+    }
+
+    const std::size_t rowBytes = (static_cast<std::size_t>(width) + 3) / 4 + 1;
+    std::vector<CellState> cells;
+
+    if (raw.size() != rowBytes * height)
+        return {};
+
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+            cells.push_back(static_cast<CellState>(raw[rowBytes * y + 1 + x / 4] >> (6 - 2 * (x % 4)) & 3));
+
+    return cells;
+}
+
+// A run captured as images and as a video at once, by several encoders and with gaps between the captured
+// generations, has to come back from the files cell for cell: the PNG and PPM images decoded, and the video frame for
+// frame in order. Each capture is compared with the generations it took, as each drops frames on its own.
+bool verifyCapture(int width, int height, int steps, double p, double g, std::uint64_t seed) {
+    const auto prefix = (std::filesystem::temp_directory_path() / "forest_verify_capture").string();
+    ForestGrid grid(width, height);
+    StepParams params{p, g, MOORE, BITPLANE_KERNEL, seed, true};
+    std::vector<std::vector<CellState>> generations;
+    std::vector<std::size_t> taken[3];
+    FrameCapture captures[3];
+    bool succeeded = true;
+
+    initGrid(grid, seed);
+
+    for (int format = CAPTURE_PPM; format <= CAPTURE_Y4M; ++format) {
+        CaptureSettings settings;
+        settings.path = format == CAPTURE_Y4M ? prefix + ".y4m" : prefix + "_" + CAPTURE_FORMAT_NAMES[format];
+        settings.format = static_cast<CaptureFormat>(format);
+        settings.interval = 2;
+        settings.workers = 3;
+
+        if (!captures[format].start(settings, grid))
+            return false;
+    }
+
+    for (int step = 0; step < steps; ++step) {
+        stepGrid(grid, params, step);
+        generations.emplace_back(grid.cells, grid.cells + grid.size());
+
+        for (int format = CAPTURE_PPM; format <= CAPTURE_Y4M; ++format)
+            if (captures[format].capture(grid, step + 1))
+                taken[format].push_back(step);
+    }
+
+    for (int format = CAPTURE_PPM; format <= CAPTURE_Y4M; ++format)
+        succeeded &= captures[format].stop() && captures[format].captured == taken[format].size() &&
+                     !taken[format].empty();
+
+    auto read = [](const std::string &path) {
+        std::vector<std::uint8_t> data;
+        std::FILE *in = std::fopen(path.c_str(), "rb");
+
+        if (in != nullptr) {
+            std::uint8_t buffer[65536];
+
+            for (std::size_t n; (n = std::fread(buffer, 1, sizeof(buffer), in)) > 0;)
+                data.insert(data.end(), buffer, buffer + n);
+
+            std::fclose(in);
+        }
+
+        return data;
+    };
+
+    auto image = [&prefix](int format, std::size_t sequence) {
+        char name[64];
+        std::snprintf(name, sizeof(name), "_%s_%06llu.%s", CAPTURE_FORMAT_NAMES[format],
+                      static_cast<unsigned long long>(sequence), CAPTURE_FORMAT_NAMES[format]);
+        return prefix + name;
+    };
+
+    char header[64];
+    const std::size_t ppmHeader = std::snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+
+    for (std::size_t sequence = 0; sequence < taken[CAPTURE_PPM].size(); ++sequence) {
+        const auto ppm = read(image(CAPTURE_PPM, sequence));
+        const auto &cells = generations[taken[CAPTURE_PPM][sequence]];
+
+        succeeded &= ppm.size() == ppmHeader + 3 * cells.size() && std::equal(header, header + ppmHeader, ppm.begin());
+
+        for (std::size_t i = 0; i < cells.size() && succeeded; ++i)
+            succeeded = std::equal(DEFAULT_CAPTURE_PALETTE[cells[i]].begin(), DEFAULT_CAPTURE_PALETTE[cells[i]].end(),
+                                   ppm.begin() + static_cast<std::ptrdiff_t>(ppmHeader + 3 * i));
+
+        std::filesystem::remove(image(CAPTURE_PPM, sequence));
+    }
+
+    for (std::size_t sequence = 0; sequence < taken[CAPTURE_PNG].size(); ++sequence) {
+        succeeded &= decodeCapturedPng(read(image(CAPTURE_PNG, sequence)), width, height) ==
+                     generations[taken[CAPTURE_PNG][sequence]];
+        std::filesystem::remove(image(CAPTURE_PNG, sequence));
+    }
+
+    const auto video = read(prefix + ".y4m");
+    const std::size_t videoHeader = std::snprintf(header, sizeof(header),
+                                                  "YUV4MPEG2 W%d H%d F30:1 Ip A1:1 C420jpeg\n", width, height);
+    std::vector<std::uint8_t> frame;
+    std::size_t at = videoHeader;
+
+    succeeded &= video.size() >= videoHeader && std::equal(header, header + videoHeader, video.begin());
+
+    for (std::size_t generation: taken[CAPTURE_Y4M]) {
+        encodeY4mFrame(generations[generation].data(), width, height, DEFAULT_CAPTURE_PALETTE, frame);
+        succeeded = succeeded && at + frame.size() <= video.size() &&
+                    std::equal(frame.begin(), frame.end(), video.begin() + static_cast<std::ptrdiff_t>(at));
+        at += frame.size();
+    }
+
+    std::filesystem::remove(prefix + ".y4m");
+    return succeeded && at == video.size();
+}
+
+double treeDensity(const ForestGrid &grid) {
+    return static_cast<double>(countCells(grid)[TREE]) / static_cast<double>(grid.size());
+}
+
+// Statistical check that skip sampling behaves like independent per-cell Bernoulli draws: the number of hits, their
+// spread over the positions inside a chunk and the tree density of a whole run have to agree with the per-cell
+// draws. The bounds are several standard deviations wide, so a correct implementation practically never fails.
+bool verifySkipSampling(std::uint64_t seed) {
+    const std::uint64_t chunks = 1024, bins = 32;
+
+    for (double q: {1e-4, 0.03, 0.5}) {
+        std::vector<double> binHits(bins);
+        double hits = 0.0;
+
+        for (std::uint64_t chunk = 0; chunk < chunks; ++chunk)
+            forEachHit(q, seed, 0, chunk, chunk * SKIP_CHUNK, (chunk + 1) * SKIP_CHUNK, [&](std::uint64_t index) {
+                hits++;
+                binHits[(index % SKIP_CHUNK) * bins / SKIP_CHUNK]++;
+            });
+
+        double trials = static_cast<double>(chunks * SKIP_CHUNK);
+
+        if (std::abs(hits - trials * q) > 5.0 * std::sqrt(trials * q * (1.0 - q)))
+            return false;
+
+        // Chi-square with 31 degrees of freedom, 80 is far out in the tail.
+        double expected = hits / bins, chiSquare = 0.0;
+        for (auto binHit: binHits)
+            chiSquare += (binHit - expected) * (binHit - expected) / expected;
+
+        if (chiSquare > 80.0)
+            return false;
+    }
+
+    ForestGrid perCell(256, 256), skipSampled(256, 256);
+    double perCellDensity = 0.0, skipSampledDensity = 0.0;
+
+    initGrid(perCell, seed);
+    initGrid(skipSampled, seed);
+
+    for (int step = 0; step < 400; ++step) {
+        stepCells(perCell, {0.001, 0.03, VON_NEUMANN, CELL_KERNEL, seed}, step);
+        stepCells(skipSampled, {0.001, 0.03, VON_NEUMANN, CELL_KERNEL, seed, true}, step);
+
+        if (step >= 200) {
+            perCellDensity += treeDensity(perCell) / 200.0;
+            skipSampledDensity += treeDensity(skipSampled) / 200.0;
+        }
+    }
+
+    return std::abs(perCellDensity - skipSampledDensity) < 0.03 * perCellDensity;
+}
+
+// A forest split into strips that exchange their halos after every step has to step exactly like the whole forest
+// with the per-cell kernel, cells and statistics, for both neighborhoods and boundaries and with lightning and growth
+// drawn per cell as well as skip-sampled. With as many strips as rows, every row borders on both halos.
+bool verifyStrips(int width, int height, int count, int steps, double p, double g, std::uint64_t seed) {
+    for (auto logic: {VON_NEUMANN, MOORE})
+        for (auto boundary: {FIXED_BOUNDARY, PERIODIC_BOUNDARY})
+            for (bool skipSampling: {false, true}) {
+                StepParams params{p, g, logic, CELL_KERNEL, seed, skipSampling, false, 1, boundary};
+                ForestGrid whole(width, height);
+                std::deque<ForestStrip> strips;
+
+                initGrid(whole, seed);
+
+                for (int i = 0; i < count; ++i) {
+                    auto [y0, y1] = stripRows(height, count, i);
+                    initStrip(strips.emplace_back(width, height, y0, y1), seed);
+                }
+
+                for (int step = 0; step < steps; ++step) {
+                    StepStats expected, total{0, 0, 0, 0};
+
+                    stepGrid(whole, params, step, &expected);
+                    copyHalos(strips, boundary == PERIODIC_BOUNDARY);
+
+                    for (auto &strip: strips) {
+                        auto stats = stepStrip(strip, params, step, [] {});
+                        total.fires += stats.fires;
+                        total.struck += stats.struck;
+                        total.grown += stats.grown;
+
+                        for (int y = strip.y0; y < strip.y1; ++y)
+                            if (std::memcmp(strip.row(y), whole.row(y), width) != 0)
+                                return false;
+                    }
+
+                    if (total.fires != expected.fires || total.struck != expected.struck ||
+                        total.grown != expected.grown)
+                        return false;
+                }
+            }
+
+    return true;
+}
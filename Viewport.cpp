@@ -0,0 +1,78 @@
+#include <algorithm>
+#include <cmath>
+
+#include "ForestPyramid.cpp"
+
+const double MIN_ZOOM = 1.0 / 1024.0;
+const double MAX_ZOOM = 32.0;
+
+// Cells beyond the visible ones that are copied along, so a view that moves by a little still has them while the
+// worker catches up with it.
+const int VIEW_MARGIN = 16;
+
+// Which part of the grid the window shows: the grid position at the center of the window and the zoom in window
+// pixels per cell. Positions are in cells, fractional between them.
+struct Viewport {
+    void fit(int gridWidth, int gridHeight, int windowWidth, int windowHeight) {
+        centerX = gridWidth / 2.0;
+        centerY = gridHeight / 2.0;
+        zoom = std::clamp(std::min(static_cast<double>(windowWidth) / std::max(gridWidth, 1),
+                                   static_cast<double>(windowHeight) / std::max(gridHeight, 1)), MIN_ZOOM, MAX_ZOOM);
+    }
+
+    // Moves the grid along with the mouse, by a distance in window pixels.
+    void pan(double dx, double dy, int gridWidth, int gridHeight) {
+        centerX = std::clamp(centerX - dx / zoom, 0.0, static_cast<double>(gridWidth));
+        centerY = std::clamp(centerY - dy / zoom, 0.0, static_cast<double>(gridHeight));
+    }
+
+    // Zooms by factor, keeping the cell under the window position (px, py) where it is.
+    void zoomAt(double px, double py, double factor, int windowWidth, int windowHeight) {
+        double x = cellX(px, windowWidth), y = cellY(py, windowHeight);
+        zoom = std::clamp(zoom * factor, MIN_ZOOM, MAX_ZOOM);
+        centerX = x - (px - windowWidth / 2.0) / zoom;
+        centerY = y - (py - windowHeight / 2.0) / zoom;
+    }
+
+    [[nodiscard]] double cellX(double px, int windowWidth) const {
+        return centerX + (px - windowWidth / 2.0) / zoom;
+    }
+
+    [[nodiscard]] double cellY(double py, int windowHeight) const {
+        return centerY + (py - windowHeight / 2.0) / zoom;
+    }
+
+    [[nodiscard]] double windowX(double x, int windowWidth) const {
+        return (x - centerX) * zoom + windowWidth / 2.0;
+    }
+
+    [[nodiscard]] double windowY(double y, int windowHeight) const {
+        return (y - centerY) * zoom + windowHeight / 2.0;
+    }
+
+    // The level whose cells are the smallest ones still at least a pixel wide, and the part of it in the window.
+    [[nodiscard]] ViewRegion region(int gridWidth, int gridHeight, int windowWidth, int windowHeight) const {
+        ViewRegion view;
+        view.level = std::clamp(static_cast<int>(std::floor(std::log2(1.0 / zoom))), 0,
+                                topLevel(gridWidth, gridHeight));
+
+        const double cell = std::ldexp(1.0, view.level);
+        const int levelWidth = levelSize(gridWidth, view.level), levelHeight = levelSize(gridHeight, view.level);
+
+        auto first = [&](double position, int size) {
+            return std::clamp(static_cast<int>(std::floor(position / cell)) - VIEW_MARGIN, 0, size);
+        };
+        auto last = [&](double position, int size) {
+            return std::clamp(static_cast<int>(std::ceil(position / cell)) + VIEW_MARGIN, 0, size);
+        };
+
+        view.x = first(cellX(0, windowWidth), levelWidth);
+        view.y = first(cellY(0, windowHeight), levelHeight);
+        view.width = last(cellX(windowWidth, windowWidth), levelWidth) - view.x;
+        view.height = last(cellY(windowHeight, windowHeight), levelHeight) - view.y;
+        return view;
+    }
+
+public:
+    double centerX{}, centerY{}, zoom{1.0};
+};
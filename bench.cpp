@@ -0,0 +1,631 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#include "CommandLine.cpp"
+#include "Decomposition.cpp"
+#include "FrameCapture.cpp"
+#include "Placement.cpp"
+#include "Simulation.cpp"
+#include "Verification.cpp"
+
+// Headless benchmark of the simulation core. Sweeps every combination of the list options below, warms each
+// forest up untimed and then times every step of every repeat individually.
+const char *USAGE =
+        "usage: forest_bench [options]\n"
+        "  --sizes 256,1024       square grid sizes\n"
+        "  --threads 1,4          OpenMP thread counts (default: omp_get_max_threads())\n"
+        "  --logic von-neumann,moore\n"
+        "  --kernel cell,bitplane,frontier,tiled,temporal\n"
+        "  --depth 8              generations per pass of the temporal kernel, 1 to 64\n"
+        "  --p 0.0001             spontaneous fire probabilities, from:to:count[:log] for ranges\n"
+        "  --g 0.03               tree growth probabilities\n"
+        "  --sampling cell,skip   per-cell draws or skip-sampled lightning and growth\n"
+        "  --boundary fixed,periodic\n"
+        "  --warmup 20            untimed steps before every repeat\n"
+        "  --steps 100            timed steps per repeat\n"
+        "  --repeats 5            independent runs per configuration\n"
+        "  --seed 1\n"
+        "  --format json|csv\n"
+        "  --output FILE          default: stdout\n"
+        "  --replicas             also time the bit-sliced kernel, 64 skip-sampled forests per step\n"
+        "  --clusters             also time the cluster size labeling after every step\n"
+        "  --instant              also time instant burning, counting every generation a step covers\n"
+        "  --record FILE          also time the bitplane kernel while recording every step to FILE\n"
+        "  --capture PATH         also time the bitplane kernel while capturing frames to PATH_000000.png and on,\n"
+        "                         or to the video PATH with y4m\n"
+        "  --capture-format png|ppm|y4m\n"
+        "  --capture-every 1      generations from one captured frame to the next\n"
+        "  --capture-policy drop|throttle\n"
+        "                         when the encoders fall behind, drop frames, or also capture less often until\n"
+        "                         they have caught up\n"
+        "  --capture-workers 2    encoder threads\n"
+        "  --trace FILE           write the phases of every step as a Chrome trace to FILE\n"
+        "  --pin none|compact|spread|0,2,4-7\n"
+        "                         pin the OpenMP threads to CPUs: packed node by node, round robin over the NUMA\n"
+        "                         nodes, or thread i to the i-th CPU of the list\n"
+        "  --huge-pages           back grids with transparent huge pages\n"
+        "  --bandwidth            measure the copy bandwidth of every NUMA node first, 2 x 256 MB per node\n"
+        "  --verify               cross-check the kernels and exit\n";
+
+struct BenchOptions {
+    std::vector<int> sizes{256, 1024};
+    std::vector<int> threads{omp_get_max_threads()};
+    std::vector<NeighborhoodLogic> logics{VON_NEUMANN, MOORE};
+    std::vector<StepKernel> kernels{CELL_KERNEL, BITPLANE_KERNEL, FRONTIER_KERNEL, TILED_KERNEL};
+    std::vector<double> fires{0.0001};
+    std::vector<double> growths{0.03};
+    std::vector<bool> samplings{false};
+    std::vector<int> depths{8};
+    std::vector<BoundaryMode> boundaries{FIXED_BOUNDARY};
+    int warmup{20}, steps{100}, repeats{5};
+    std::uint64_t seed{1};
+    bool csv{false}, verify{false}, replicas{false}, clusters{false}, instant{false}, bandwidth{false};
+    const char *output{nullptr};
+    const char *record{nullptr};
+    const char *trace{nullptr};
+    CaptureSettings capture;
+};
+
+struct BenchResult {
+    int size{}, threads{};
+    StepParams params;
+    // Set for rows that do not time a step kernel.
+    const char *engine{};
+    double cellsPerSecond{}, nsPerCell{};
+    double minMs{}, medianMs{}, p99Ms{};
+};
+
+bool parseArguments(int argc, char **argv, BenchOptions &options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        if (arg == "--verify") {
+            options.verify = true;
+            continue;
+        }
+
+        if (arg == "--replicas") {
+            options.replicas = true;
+            continue;
+        }
+
+        if (arg == "--clusters") {
+            options.clusters = true;
+            continue;
+        }
+
+        if (arg == "--instant") {
+            options.instant = true;
+            continue;
+        }
+
+        if (arg == "--bandwidth") {
+            options.bandwidth = true;
+            continue;
+        }
+
+        if (arg == "--huge-pages") {
+            placement.hugePages = true;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+            return false;
+
+        const char *value = argv[++i];
+        bool parsed = true;
+
+        if (arg == "--sizes")
+            parsed = parseNumbers(value, options.sizes);
+        else if (arg == "--threads")
+            parsed = parseNumbers(value, options.threads);
+        else if (arg == "--logic")
+            options.logics = parseList<NeighborhoodLogic>(value, [](const std::string &s) {
+                return static_cast<NeighborhoodLogic>(parseName(s, NEIGHBORHOOD_NAMES));
+            });
+        else if (arg == "--kernel")
+            options.kernels = parseList<StepKernel>(value, [](const std::string &s) {
+                return static_cast<StepKernel>(parseName(s, STEP_KERNEL_NAMES));
+            });
+        else if (arg == "--depth")
+            parsed = parseNumbers(value, options.depths);
+        else if (arg == "--p")
+            parsed = parseRange(value, options.fires);
+        else if (arg == "--g")
+            parsed = parseRange(value, options.growths);
+        else if (arg == "--sampling")
+            options.samplings = parseList<bool>(value, [](const std::string &s) {
+                return parseName(s, SAMPLING_NAMES) == 1;
+            });
+        else if (arg == "--boundary")
+            options.boundaries = parseList<BoundaryMode>(value, [](const std::string &s) {
+                return static_cast<BoundaryMode>(parseName(s, BOUNDARY_NAMES));
+            });
+        else if (arg == "--warmup")
+            parsed = parseNumber(value, options.warmup);
+        else if (arg == "--steps")
+            parsed = parseNumber(value, options.steps);
+        else if (arg == "--repeats")
+            parsed = parseNumber(value, options.repeats);
+        else if (arg == "--seed")
+            parsed = parseNumber(value, options.seed);
+        else if (arg == "--format")
+            options.csv = std::strcmp(value, "csv") == 0;
+        else if (arg == "--output")
+            options.output = value;
+        else if (arg == "--record")
+            options.record = value;
+        else if (arg == "--capture")
+            options.capture.path = value;
+        else if (arg == "--capture-format")
+            options.capture.format = static_cast<CaptureFormat>(parseName(value, CAPTURE_FORMAT_NAMES));
+        else if (arg == "--capture-every")
+            parsed = parseNumber(value, options.capture.interval);
+        else if (arg == "--capture-policy")
+            options.capture.policy = static_cast<CapturePolicy>(parseName(value, CAPTURE_POLICY_NAMES));
+        else if (arg == "--capture-workers")
+            parsed = parseNumber(value, options.capture.workers);
+        else if (arg == "--trace")
+            options.trace = value;
+        else if (arg == "--pin")
+            parsed = parsePinning(value, placement);
+        else
+            return false;
+
+        if (!parsed)
+            return false;
+    }
+
+    auto positive = [](int value) { return value > 0; };
+
+    return !options.sizes.empty() && !options.threads.empty() && !options.depths.empty() &&
+           !options.boundaries.empty() && options.steps > 0 && options.repeats > 0 &&
+           std::all_of(options.sizes.begin(), options.sizes.end(), positive) &&
+           std::all_of(options.threads.begin(), options.threads.end(), positive);
+}
+
+double percentile(const std::vector<double> &sorted, double q) {
+    auto rank = static_cast<std::size_t>(q * static_cast<double>(sorted.size() - 1) + 0.5);
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+// Times every step of every repeat individually. init(seed) starts a repeat, step(seed, step) advances it, and
+// untimed(seed, step) runs before every step without being timed.
+template<typename Init, typename Step, typename Untimed>
+std::vector<double> timeSteps(const BenchOptions &options, Init init, Step step, Untimed untimed) {
+    std::vector<double> stepMs;
+    stepMs.reserve(static_cast<std::size_t>(options.steps) * options.repeats);
+
+    for (int repeat = 0; repeat < options.repeats; ++repeat) {
+        std::uint64_t seed = options.seed + repeat, generation = 0;
+
+        init(seed);
+
+        for (int i = 0; i < options.warmup; ++i) {
+            untimed(seed, generation);
+            step(seed, generation++);
+        }
+
+        for (int i = 0; i < options.steps; ++i) {
+            untimed(seed, generation);
+            auto start = std::chrono::steady_clock::now();
+            step(seed, generation++);
+            auto stop = std::chrono::steady_clock::now();
+
+            stepMs.push_back(std::chrono::duration<double, std::milli>(stop - start).count());
+        }
+    }
+
+    return stepMs;
+}
+
+// cells is the number of cells one step computes, over all replicas.
+void summarize(BenchResult &result, std::vector<double> stepMs, double cells) {
+    double totalMs = 0.0;
+    for (auto ms: stepMs)
+        totalMs += ms;
+
+    std::sort(stepMs.begin(), stepMs.end());
+
+    result.cellsPerSecond = cells * static_cast<double>(stepMs.size()) / (totalMs / 1000.0);
+    result.minMs = stepMs.front();
+    result.medianMs = percentile(stepMs, 0.5);
+    result.p99Ms = percentile(stepMs, 0.99);
+    result.nsPerCell = result.medianMs * 1e6 / cells;
+}
+
+// Pins the new team before a grid is allocated, so the grid is first touched by the threads that step it.
+void useThreads(int threads) {
+    omp_set_num_threads(threads);
+    applyPlacement();
+}
+
+BenchResult runBenchmark(const BenchOptions &options, int size, int threads, const StepParams &params) {
+    useThreads(threads);
+    ForestGrid grid(size, size);
+    StepParams runParams = params;
+
+    // A step of the temporal kernel advances several generations, and uses up as many step indices.
+    auto stepMs = timeSteps(options, [&](std::uint64_t seed) {
+        runParams.seed = seed;
+        initGrid(grid, seed);
+    }, [&](std::uint64_t, std::uint64_t step) {
+        stepGrid(grid, runParams, step * runParams.stepLength());
+    }, [](std::uint64_t, std::uint64_t) {});
+
+    BenchResult result{size, threads, params};
+    summarize(result, stepMs, static_cast<double>(size) * size * static_cast<double>(params.stepLength()));
+    return result;
+}
+
+// Cells per second count every replica, so they compare directly to REPLICAS separate runs of the other kernels.
+BenchResult runReplicaBenchmark(const BenchOptions &options, int size, int threads, const StepParams &params) {
+    useThreads(threads);
+    ReplicaGrid grid(size, size);
+    StepParams runParams = params;
+
+    auto stepMs = timeSteps(options, [&](std::uint64_t seed) {
+        runParams.seed = seed;
+        initReplicas(grid, seed);
+    }, [&](std::uint64_t, std::uint64_t step) {
+        stepReplicas(grid, runParams, step);
+    }, [](std::uint64_t, std::uint64_t) {});
+
+    BenchResult result{size, threads, params, "replicas"};
+    summarize(result, stepMs, static_cast<double>(size) * size * REPLICAS);
+    return result;
+}
+
+// Times the cluster labeling of the forest after every step, which is stepped untimed. Every tile is labeled again:
+// with any growth, a step changes the trees of every tile, so keeping the labels of unchanged ones gains nothing.
+BenchResult runClusterBenchmark(const BenchOptions &options, int size, int threads, const StepParams &params) {
+    useThreads(threads);
+    ForestGrid grid(size, size);
+    ClusterLabeling labeling;
+    StepParams runParams = params;
+
+    auto stepMs = timeSteps(options, [&](std::uint64_t seed) {
+        runParams.seed = seed;
+        initGrid(grid, seed);
+        labeling.invalidate();
+    }, [&](std::uint64_t, std::uint64_t) {
+        labeling.update(grid, runParams.logic);
+    }, [&](std::uint64_t, std::uint64_t step) {
+        stepGrid(grid, runParams, step);
+        labeling.invalidate();
+    });
+
+    BenchResult result{size, threads, params, "clusters"};
+    summarize(result, stepMs, static_cast<double>(size) * size);
+    return result;
+}
+
+// A step of instant burning runs up to the next lightning strike, so cells per second are those of all the
+// generations the steps covered, which makes them comparable to the other kernels at the same p and g.
+BenchResult runInstantBenchmark(const BenchOptions &options, int size, int threads, const StepParams &params) {
+    useThreads(threads);
+    ForestGrid grid(size, size);
+    StepParams runParams = params;
+    std::uint64_t generations = 0, steps = 0;
+
+    auto stepMs = timeSteps(options, [&](std::uint64_t seed) {
+        runParams.seed = seed;
+        initGrid(grid, seed);
+    }, [&](std::uint64_t, std::uint64_t step) {
+        StepStats stats;
+        stepGrid(grid, runParams, step, &stats);
+
+        generations += stats.generations;
+        steps++;
+    }, [](std::uint64_t, std::uint64_t) {});
+
+    BenchResult result{size, threads, params, "instant-burn"};
+    summarize(result, stepMs, static_cast<double>(size) * size * static_cast<double>(generations) /
+                              static_cast<double>(std::max<std::uint64_t>(steps, 1)));
+    return result;
+}
+
+// Times the steps together with handing every generation to the recorder, which packs it on the stepping thread
+// and writes it on its own. Generations the writer could not keep up with are dropped and counted, not waited for.
+BenchResult runRecordingBenchmark(const BenchOptions &options, int size, int threads, const StepParams &params) {
+    useThreads(threads);
+    ForestGrid grid(size, size);
+    StepParams runParams = params;
+    RunRecorder recorder;
+    std::uint64_t recorded = 0, dropped = 0, bytes = 0;
+
+    auto finish = [&]() {
+        if (!recorder.active())
+            return;
+
+        dropped += recorder.dropped;
+
+        if (!recorder.stop())
+            std::perror(options.record);
+
+        recorded += recorder.recorded;
+        bytes += recorder.bytes;
+    };
+
+    auto stepMs = timeSteps(options, [&](std::uint64_t seed) {
+        finish();
+        runParams.seed = seed;
+        initGrid(grid, seed);
+
+        if (!recorder.start(options.record, grid, runParams))
+            std::perror(options.record);
+    }, [&](std::uint64_t, std::uint64_t step) {
+        stepGrid(grid, runParams, step);
+        recorder.record(grid, step + 1);
+    }, [](std::uint64_t, std::uint64_t) {});
+
+    finish();
+    std::fprintf(stderr, "recorded %llu generations, dropped %llu, %.1f bytes per generation\n",
+                 static_cast<unsigned long long>(recorded), static_cast<unsigned long long>(dropped),
+                 static_cast<double>(bytes) / static_cast<double>(std::max<std::uint64_t>(recorded, 1)));
+
+    BenchResult result{size, threads, params, "recorded"};
+    summarize(result, stepMs, static_cast<double>(size) * size);
+    return result;
+}
+
+// Times the steps together with handing due generations to the capture, which only copies them on the stepping
+// thread. How many frames its encoders could not keep up with shows whether capturing would slow a run down.
+BenchResult runCaptureBenchmark(const BenchOptions &options, int size, int threads, const StepParams &params) {
+    useThreads(threads);
+    ForestGrid grid(size, size);
+    StepParams runParams = params;
+    FrameCapture capture;
+    std::uint64_t captured = 0, dropped = 0, bytes = 0;
+    int interval = options.capture.interval;
+
+    auto finish = [&]() {
+        if (!capture.active())
+            return;
+
+        interval = std::max(interval, capture.currentInterval());
+
+        if (!capture.stop())
+            std::perror(options.capture.path.c_str());
+
+        captured += capture.captured;
+        dropped += capture.dropped;
+        bytes += capture.bytes;
+    };
+
+    auto stepMs = timeSteps(options, [&](std::uint64_t seed) {
+        finish();
+        runParams.seed = seed;
+        initGrid(grid, seed);
+
+        if (!capture.start(options.capture, grid))
+            std::perror(options.capture.path.c_str());
+    }, [&](std::uint64_t, std::uint64_t step) {
+        stepGrid(grid, runParams, step);
+        capture.capture(grid, step + 1);
+    }, [](std::uint64_t, std::uint64_t) {});
+
+    finish();
+    std::fprintf(stderr, "captured %llu %s frames, dropped %llu, %.1f bytes per frame, every %d generations at most\n",
+                 static_cast<unsigned long long>(captured), CAPTURE_FORMAT_NAMES[options.capture.format],
+                 static_cast<unsigned long long>(dropped),
+                 static_cast<double>(bytes) / static_cast<double>(std::max<std::uint64_t>(captured, 1)), interval);
+
+    BenchResult result{size, threads, params, "captured"};
+    summarize(result, stepMs, static_cast<double>(size) * size);
+    return result;
+}
+
+const char *kernelName(const BenchResult &result) {
+    return result.engine ? result.engine : STEP_KERNEL_NAMES[result.params.kernel];
+}
+
+void writeResults(std::FILE *out, const BenchOptions &options, const std::vector<BenchResult> &results,
+                  const std::vector<NodeBandwidth> &bandwidths) {
+    if (options.csv) {
+        std::fprintf(out, "size,threads,logic,kernel,sampling,depth,boundary,p,g,cells_per_second,ns_per_cell,min_ms,"
+                          "median_ms,p99_ms\n");
+
+        for (const auto &r: results)
+            std::fprintf(out, "%d,%d,%s,%s,%s,%llu,%s,%g,%g,%.6e,%.4f,%.4f,%.4f,%.4f\n", r.size, r.threads,
+                         NEIGHBORHOOD_NAMES[r.params.logic], kernelName(r), SAMPLING_NAMES[r.params.skipSampling],
+                         static_cast<unsigned long long>(r.params.stepLength()), BOUNDARY_NAMES[r.params.boundary],
+                         r.params.p, r.params.g,
+                         r.cellsPerSecond, r.nsPerCell, r.minMs, r.medianMs, r.p99Ms);
+        return;
+    }
+
+    std::fprintf(out, "{\n  \"seed\": %llu,\n  \"warmup\": %d,\n  \"steps\": %d,\n  \"repeats\": %d,\n",
+                 static_cast<unsigned long long>(options.seed), options.warmup, options.steps, options.repeats);
+    std::fprintf(out, "  \"bitplane_isa\": \"%s\",\n", BITPLANE_ISA_NAMES[detectBitplaneIsa()]);
+    std::fprintf(out, "  \"pin\": \"%s\",\n  \"huge_pages\": %s,\n", PIN_NAMES[placement.pin],
+                 placement.hugePages ? "true" : "false");
+
+    // Only measured with --bandwidth.
+    if (!bandwidths.empty()) {
+        std::fprintf(out, "  \"numa_nodes\": [\n");
+
+        for (std::size_t i = 0; i < bandwidths.size(); ++i)
+            std::fprintf(out, "    {\"node\": %d, \"threads\": %d, \"copy_gb_per_second\": %.2f}%s\n",
+                         bandwidths[i].node, bandwidths[i].threads, bandwidths[i].gigabytesPerSecond,
+                         i + 1 < bandwidths.size() ? "," : "");
+
+        std::fprintf(out, "  ],\n");
+    }
+
+    std::fprintf(out, "  \"results\": [\n");
+
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const auto &r = results[i];
+
+        std::fprintf(out, "    {\"size\": %d, \"threads\": %d, \"logic\": \"%s\", \"kernel\": \"%s\", "
+                          "\"sampling\": \"%s\", \"depth\": %llu, \"boundary\": \"%s\", \"p\": %g, \"g\": %g, "
+                          "\"cells_per_second\": %.6e, \"ns_per_cell\": %.4f, \"min_ms\": %.4f, \"median_ms\": %.4f, "
+                          "\"p99_ms\": %.4f}%s\n",
+                     r.size, r.threads, NEIGHBORHOOD_NAMES[r.params.logic], kernelName(r),
+                     SAMPLING_NAMES[r.params.skipSampling], static_cast<unsigned long long>(r.params.stepLength()),
+                     BOUNDARY_NAMES[r.params.boundary], r.params.p, r.params.g, r.cellsPerSecond, r.nsPerCell,
+                     r.minMs, r.medianMs, r.p99Ms,
+                     i + 1 < results.size() ? "," : "");
+    }
+
+    std::fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char **argv) {
+    BenchOptions options;
+
+    if (!parseArguments(argc, argv, options)) {
+        std::fputs(USAGE, stderr);
+        return EXIT_FAILURE;
+    }
+
+    if (options.verify) {
+        // The wide grid spans several tiles of the temporal kernel and gets a block as deep as their halo. The last
+        // grid is a dense forest with a single fire, so most tiles are quiescent.
+        bool matches = verifyKernels(333, 197, 50, 0.01, 0.05, options.seed) &&
+                       verifyKernels(1024, 64, 30, 0.001, 0.03, options.seed) &&
+                       verifyKernels(2113, 40, 64, 0.001, 0.03, options.seed) &&
+                       verifyKernels(1024, 512, 20, 0.00001, 0.01, options.seed, 0.000002, 1.0);
+        bool sampling = verifySkipSampling(options.seed);
+        bool replicas = verifyReplicas(201, 87, 40, 0.001, 0.05, options.seed);
+        bool clusters = verifyClusters(301, 203, 60, 0.001, 0.05, options.seed);
+        bool instant = verifyInstantBurn(1031, 1029, 100, 0.00001, 0.05, options.seed);
+        bool pyramid = verifyPyramid(1000, 777, 60, 0.000001, 0.0, options.seed);
+        bool recording = verifyRecording(301, 203, 150, 0.001, 0.05, options.seed);
+        bool strips = verifyStrips(203, 157, 5, 40, 0.001, 0.05, options.seed) &&
+                      verifyStrips(97, 6, 6, 40, 0.01, 0.05, options.seed);
+        bool capture = verifyCapture(301, 203, 60, 0.001, 0.05, options.seed);
+
+        std::fprintf(stderr, "kernels (bitplane: %s): %s\n", BITPLANE_ISA_NAMES[detectBitplaneIsa()],
+                     matches ? "all match the per-cell kernel" : "one DIFFERS from the per-cell kernel");
+        std::fprintf(stderr, "skip sampling: %s\n",
+                     sampling ? "consistent with per-cell draws" : "INCONSISTENT with per-cell draws");
+        std::fprintf(stderr, "replicas: %s\n",
+                     replicas ? "all match their single-forest runs" : "one DIFFERS from its single-forest run");
+        std::fprintf(stderr, "clusters: %s\n",
+                     clusters ? "match a breadth-first search" : "DIFFER from a breadth-first search");
+        std::fprintf(stderr, "instant burn: %s\n",
+                     instant ? "every strike burns one whole cluster" : "a strike did NOT burn one whole cluster");
+        std::fprintf(stderr, "pyramid: %s\n",
+                     pyramid ? "incremental updates match a rebuild" : "an incremental update DIFFERS from a rebuild");
+        std::fprintf(stderr, "recording: %s\n",
+                     recording ? "every seek replays the recorded generation" : "a seek DIFFERS from the recorded run");
+        std::fprintf(stderr, "strips: %s\n",
+                     strips ? "step like the whole forest" : "one DIFFERS from the whole forest");
+        std::fprintf(stderr, "capture: %s\n",
+                     capture ? "every frame decodes to its generation" : "a frame DIFFERS from its generation");
+        return matches && sampling && replicas && clusters && instant && pyramid && recording && strips && capture
+               ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    std::vector<BenchResult> results;
+    TraceLog traceLog;
+
+    // Memory bandwidth bounds the kernels on large grids, per node, as the threads of every node step the rows whose
+    // pages they touched first. Measuring it copies half a gigabyte per node several times, so only on request.
+    std::vector<NodeBandwidth> bandwidths;
+
+    if (options.bandwidth)
+        bandwidths = measureNodeBandwidth();
+
+    for (const auto &b: bandwidths)
+        std::fprintf(stderr, "NUMA node %d: %2d threads, %.2f GB/s copy bandwidth\n", b.node, b.threads,
+                     b.gigabytesPerSecond);
+
+    tracing.enabled = options.trace != nullptr;
+    tracing.nameThread("bench");
+
+    // The rings of the threads only hold the spans of a few configurations, so they are emptied after each.
+    auto report = [&traceLog](const BenchResult &r) {
+        std::fprintf(stderr, "%5d^2 %2d threads %-11s %-8s %-4s k=%-2llu %-8s p=%g g=%g: %8.2f Mcells/s\n", r.size,
+                     r.threads, NEIGHBORHOOD_NAMES[r.params.logic], kernelName(r),
+                     SAMPLING_NAMES[r.params.skipSampling], static_cast<unsigned long long>(r.params.stepLength()),
+                     BOUNDARY_NAMES[r.params.boundary], r.params.p, r.params.g, r.cellsPerSecond / 1e6);
+
+        if (tracing.enabled)
+            traceLog.collect();
+    };
+
+    for (auto size: options.sizes)
+        for (auto threads: options.threads)
+            for (auto logic: options.logics)
+                for (auto p: options.fires)
+                    for (auto g: options.growths) {
+                        for (auto kernel: options.kernels)
+                            for (bool skipSampling: options.samplings)
+                                for (auto depth: kernel == TEMPORAL_KERNEL ? options.depths : std::vector<int>{1})
+                                    for (auto boundary: options.boundaries) {
+                                        StepParams params{p, g, logic, kernel, options.seed, skipSampling, false,
+                                                          depth, boundary};
+                                        results.push_back(runBenchmark(options, size, threads, params));
+                                        report(results.back());
+                                    }
+
+                        if (options.replicas) {
+                            StepParams params{p, g, logic, CELL_KERNEL, options.seed, true};
+                            results.push_back(runReplicaBenchmark(options, size, threads, params));
+                            report(results.back());
+                        }
+
+                        if (options.instant)
+                            for (auto boundary: options.boundaries) {
+                                StepParams params{p, g, logic, CELL_KERNEL, options.seed, true, true, 1, boundary};
+                                results.push_back(runInstantBenchmark(options, size, threads, params));
+                                report(results.back());
+                            }
+
+                        if (options.record) {
+                            StepParams params{p, g, logic, BITPLANE_KERNEL, options.seed, true};
+                            results.push_back(runRecordingBenchmark(options, size, threads, params));
+                            report(results.back());
+                        }
+
+                        if (!options.capture.path.empty()) {
+                            StepParams params{p, g, logic, BITPLANE_KERNEL, options.seed, true};
+                            results.push_back(runCaptureBenchmark(options, size, threads, params));
+                            report(results.back());
+                        }
+
+                        if (options.clusters) {
+                            StepParams params{p, g, logic, BITPLANE_KERNEL, options.seed, true};
+                            results.push_back(runClusterBenchmark(options, size, threads, params));
+                            report(results.back());
+                        }
+                    }
+
+    std::FILE *out = options.output ? std::fopen(options.output, "w") : stdout;
+
+    if (out == nullptr) {
+        std::perror(options.output);
+        return EXIT_FAILURE;
+    }
+
+    writeResults(out, options, results, bandwidths);
+
+    if (out != stdout)
+        std::fclose(out);
+
+    if (options.trace) {
+        for (const auto &phase: traceLog.summarize())
+            std::fprintf(stderr, "%-16s %8zu spans  p50 %8.3f ms  p99 %8.3f ms  %2d threads  busiest/mean %.2f\n",
+                         phase.name.c_str(), phase.count, phase.p50, phase.p99, phase.threads, phase.imbalance);
+
+        if (tracing.dropped > 0)
+            std::fprintf(stderr, "%llu spans dropped\n", static_cast<unsigned long long>(tracing.dropped.load()));
+
+        if (!traceLog.write(options.trace)) {
+            std::perror(options.trace);
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -2,22 +2,67 @@
 #include <SDL_error.h>
 #include <SDL_events.h>
 
+#include <bit>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
 #include <backends/imgui_impl_sdl2.h>
 #include <backends/imgui_impl_sdlrenderer2.h>
 
 #include "MeasurementsLog.cpp"
 #include "Forest.cpp"
+#include "ForestTexture.cpp"
+#include "StatisticsHistory.cpp"
 #include "GUI.cpp"
 
-int main(int, char **) {
+// --record FILE records the run from the start, --replay FILE opens a recorded run instead. --capture PATH captures
+// frames from the start, of the replay as well, in the format --capture-format names. --pin and --huge-pages place
+// the simulation threads and the forest like they do for forest_bench.
+void parseArguments(int argc, char **argv, bool &record, bool &replay, bool &capture) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            if (!parseNumber(argv[++i], simulationSeed))
+                SDL_Log("Ignoring invalid seed: %s\n", argv[i]);
+        } else if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record = true;
+            std::snprintf(recordingFile, sizeof(recordingFile), "%s", argv[++i]);
+        } else if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay = true;
+            std::snprintf(recordingFile, sizeof(recordingFile), "%s", argv[++i]);
+        } else if (std::strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            capture = true;
+            std::snprintf(captureFile, sizeof(captureFile), "%s", argv[++i]);
+        } else if (std::strcmp(argv[i], "--capture-format") == 0 && i + 1 < argc) {
+            captureFormat = static_cast<CaptureFormat>(parseName(argv[++i], CAPTURE_FORMAT_NAMES));
+        } else if (std::strcmp(argv[i], "--pin") == 0 && i + 1 < argc) {
+            if (!parsePinning(argv[++i], placement))
+                SDL_Log("Ignoring unknown pinning: %s\n", argv[i]);
+        } else if (std::strcmp(argv[i], "--huge-pages") == 0) {
+            placement.hugePages = true;
+        } else {
+            SDL_Log("Ignoring unknown argument: %s\n", argv[i]);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
     auto treeColor = DEFAULT_TREE_COLOR;
     auto fireColor = DEFAULT_FIRE_COLOR;
-    auto calculateForest = true;
-    auto lastHeight = currentHeight, lastWidth = currentWidth, lastSize = currentSize;
-    auto start = std::chrono::high_resolution_clock::now();
-
-    lastFrame = 0;
-    lastUpdate = SDL_GetTicks();
+    auto lastHeight = currentHeight, lastWidth = currentWidth;
+    ViewRegion sentView;
+    auto sentParams = currentParams();
+    auto sentPace = FREE_RUNNING;
+    auto sentSpeed = currentSpeed;
+    auto sentClusterInterval = clusterInterval;
+    ClusterResult latestClusters;
+    bool recordOnStart = false, replayOnStart = false, captureOnStart = false;
+
+    std::snprintf(recordingFile, sizeof(recordingFile), "%s", RECORDING_FILE);
+    std::snprintf(captureFile, sizeof(captureFile), "%s", CAPTURE_PATH);
+    std::snprintf(benchmarkSizes, sizeof(benchmarkSizes), "%s", DEFAULT_BENCHMARK_SIZES);
+    baselineResults = loadBaseline(BASELINE_FILE);
+    parseArguments(argc, argv, recordOnStart, replayOnStart, captureOnStart);
 
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) != 0) {
         SDL_Log("Error: %s\n", SDL_GetError());
@@ -31,7 +76,19 @@ int main(int, char **) {
         return EXIT_FAILURE;
     }
 
-    initForest();
+    tracing.nameThread("main");
+
+    sentParams = currentParams();
+    simulation.start(currentWidth, currentHeight, sentParams);
+
+    if (recordOnStart)
+        toggleRecording();
+    else if (replayOnStart)
+        openReplay();
+
+    // After a replay is opened, so the capture starts with the size of the recording.
+    if (captureOnStart)
+        toggleCapture();
 
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -42,14 +99,16 @@ int main(int, char **) {
     ImGui_ImplSDL2_InitForSDLRenderer(window, renderer);
     ImGui_ImplSDLRenderer2_Init(renderer);
 
-    // Main loop
-    unsigned int totalFrameTicks = 0;
+    // Main loop. Frames are timed with the performance counter, milliseconds are too coarse at high frame rates.
+    const auto counterFrequency = static_cast<double>(SDL_GetPerformanceFrequency());
+    Uint64 totalFramePerf = 0;
     unsigned int totalFrames = 0;
     while (running) {
+        TraceScope frame("frame");
         totalFrames++;
-        Uint32 startTicks = SDL_GetTicks();
         Uint64 startPerf = SDL_GetPerformanceCounter();
         SDL_Event event;
+        TraceScope events("events");
         while (SDL_PollEvent(&event)) {
             ImGui_ImplSDL2_ProcessEvent(&event);
             if (event.type == SDL_QUIT)
@@ -57,72 +116,275 @@ int main(int, char **) {
             if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_CLOSE &&
                 event.window.windowID == SDL_GetWindowID(window))
                 running = false;
-            if (event.type == SDL_MOUSEBUTTONDOWN)
-                if (event.button.button == SDL_BUTTON_LEFT) {
-                    int x, y;
-                    SDL_GetMouseState(&x, &y);
 
-                    auto gridX = x / currentSize, gridY = y / currentSize;
+            // The mouse only moves the view or sets fires while it is not over one of the windows.
+            if (io.WantCaptureMouse)
+                continue;
 
-                    if (gridX >= 0 && gridX < currentWidth && gridY >= 0 && gridY < currentHeight)
-                        if (forest[gridX][gridY] == TREE)
-                            forest[gridX][gridY] = FIRE;
-                }
+            int windowWidth, windowHeight;
+            SDL_GetWindowSize(window, &windowWidth, &windowHeight);
+
+            if (event.type == SDL_MOUSEBUTTONDOWN && event.button.button == SDL_BUTTON_LEFT) {
+                auto x = std::floor(viewport.cellX(event.button.x, windowWidth));
+                auto y = std::floor(viewport.cellY(event.button.y, windowHeight));
+
+                simulation.send({IGNITE_CELL, {}, static_cast<int>(x), static_cast<int>(y)});
+            }
+
+            if (event.type == SDL_MOUSEMOTION && (event.motion.state & (SDL_BUTTON_RMASK | SDL_BUTTON_MMASK)))
+                viewport.pan(event.motion.xrel, event.motion.yrel, lastWidth, lastHeight);
+
+            if (event.type == SDL_MOUSEWHEEL) {
+                int x, y;
+                SDL_GetMouseState(&x, &y);
+                viewport.zoomAt(x, y, std::pow(1.25, event.wheel.y), windowWidth, windowHeight);
+            }
+        }
+
+        events.end();
+
+        int windowWidth, windowHeight;
+        SDL_GetWindowSize(window, &windowWidth, &windowHeight);
+
+        if (fitViewport) {
+            viewport.fit(lastWidth, lastHeight, windowWidth, windowHeight);
+            fitViewport = false;
+        }
+
+        // The worker only copies what the window shows, from the pyramid level that matches the zoom.
+        auto view = viewport.region(lastWidth, lastHeight, windowWidth, windowHeight);
+
+        if (view != sentView) {
+            SimulationCommand command{SET_VIEW};
+            command.view = view;
+
+            if (simulation.send(command))
+                sentView = view;
         }
 
+        TraceScope build("imgui build");
         ImGui_ImplSDLRenderer2_NewFrame();
         ImGui_ImplSDL2_NewFrame();
         ImGui::NewFrame();
 
         mainMenu();
-        initSettings(lastHeight, lastWidth, lastSize);
+        initSettings(lastHeight, lastWidth);
+        replayControls(simulation.latest().generation);
+        framePhases();
+
+        // Settings only reach the simulation worker as commands. A command that did not fit into the queue is sent
+        // again next frame.
+        if (currentParams() != sentParams && simulation.send({SET_PARAMS, currentParams()}))
+            sentParams = currentParams();
+
+        if (currentPace() != sentPace || currentSpeed != sentSpeed) {
+            SimulationCommand command{SET_PACE};
+            command.pace = currentPace();
+            command.stepsPerSecond = currentSpeed;
+
+            if (simulation.send(command)) {
+                sentPace = command.pace;
+                sentSpeed = currentSpeed;
+            }
+        }
+
+        if (clusterInterval != sentClusterInterval && simulation.send({SET_CLUSTER_INTERVAL, {}, clusterInterval}))
+            sentClusterInterval = clusterInterval;
 
-        if ((currentStep == maxSteps) && startMeasure) {
-            auto stop = std::chrono::high_resolution_clock::now();
-            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
+        if (animationStep) {
+            simulation.send({MAKE_STEP});
+            animationStep = false;
+        }
 
-            measurements.AddLog("[%s] Time taken for %i steps: %lld ms\n", "info", maxSteps, duration.count());
+        MeasurementResult result;
 
-            if (!measureSteps.empty()) {
-                nextSteps();
-                start = std::chrono::high_resolution_clock::now();
-            } else {
+        while (simulation.receive(result)) {
+            if (!startMeasure)
+                continue;
+
+            const auto &r = result.result;
+            benchmarkResults.push_back(r);
+            measurements.AddLog("[%s] %dx%d: %.1f +/- %.1f generations/s, %.2f +/- %.2f Mcells/s (%d trials of %d "
+                                "steps, 95%% confidence)\n", "info", r.width, r.height, r.generationsPerSecond.mean,
+                                r.generationsPerSecond.ci, r.cellsPerSecond.mean / 1e6, r.cellsPerSecond.ci / 1e6,
+                                r.trials, r.steps);
+
+            if (const auto *baseline = findBaseline(baselineResults, r))
+                measurements.AddLog("[%s]   %+.1f%% against the baseline, %s\n", "info",
+                                    100.0 * (r.cellsPerSecond.mean / baseline->cellsPerSecond.mean - 1.0),
+                                    significantlyDifferent(r.cellsPerSecond, baseline->cellsPerSecond)
+                                    ? "beyond the noise" : "within the noise");
+
+            if (result.last) {
                 resetMeasure();
                 measurements.AddLog("[%s] Measurement finished!\n", "info");
             }
         }
 
+        if (startMeasure)
+            progressCurrentStep = static_cast<float>(simulation.measuredSteps());
+
+        StepSample sample;
+
+        while (simulation.receive(sample))
+            statistics.add(sample);
+
+        VerificationResult verification;
+
+        while (simulation.receive(verification)) {
+            if (verification.matches)
+                measurements.AddLog("[%s] All kernels match the per-cell kernel (bitplane: %s, %.0f ms)\n", "info",
+                                    BITPLANE_ISA_NAMES[verification.isa], verification.ms);
+            else
+                measurements.AddLog("[%s] A kernel differs from the per-cell kernel!\n", "error");
+        }
+
+        ClusterResult clusters;
+
+        while (simulation.receive(clusters)) {
+            const auto &histogram = clusters.histogram;
+
+            if (!saveClusters(clusters))
+                measurements.AddLog("[%s] Could not write %s!\n", "error", CLUSTERS_FILE);
+
+            // Measurements every few steps only go to the file and the plot, the log would be flooded otherwise.
+            if (clusters.requested) {
+                measurements.AddLog("[%s] Generation %llu: %llu clusters, largest %llu trees (%.1f ms, %d of %d "
+                                    "tiles labeled)\n", "info", static_cast<unsigned long long>(clusters.generation),
+                                    static_cast<unsigned long long>(histogram.clusters),
+                                    static_cast<unsigned long long>(histogram.largest), clusters.ms,
+                                    histogram.relabeledTiles, histogram.tiles);
+
+                for (int b = 0; b < CLUSTER_BINS; ++b)
+                    if (histogram.bins[b] > 0)
+                        measurements.AddLog("[%s]   %llu-%llu trees: %llu\n", "info", 1ull << b, (2ull << b) - 1,
+                                            static_cast<unsigned long long>(histogram.bins[b]));
+            }
+
+            latestClusters = clusters;
+        }
+
+        RecordingEvent recordingEvent;
+
+        while (simulation.receive(recordingEvent)) {
+            switch (recordingEvent.type) {
+                case RECORDING_STARTED:
+                    recording = true;
+                    measurements.AddLog("[%s] Recording to %s\n", "info", recordingFile);
+                    break;
+                case RECORDING_STOPPED:
+                    recording = false;
+                    measurements.AddLog("[%s] Recorded %llu generations (%.1f MB), %llu dropped\n", "info",
+                                        static_cast<unsigned long long>(recordingEvent.recorded),
+                                        static_cast<double>(recordingEvent.bytes) / 1e6,
+                                        static_cast<unsigned long long>(recordingEvent.dropped));
+                    break;
+                case RECORDING_FAILED:
+                    recording = false;
+                    measurements.AddLog("[%s] Could not record to %s!\n", "error", recordingFile);
+                    break;
+                case REPLAY_OPENED:
+                    // The grid takes the size of the recording.
+                    replaying = true;
+                    replayFirst = recordingEvent.first;
+                    replayLast = recordingEvent.last;
+                    currentWidth = lastWidth = recordingEvent.width;
+                    currentHeight = lastHeight = recordingEvent.height;
+                    fitViewport = true;
+                    measurements.AddLog("[%s] Replaying generations %llu to %llu of %s\n", "info",
+                                        static_cast<unsigned long long>(replayFirst),
+                                        static_cast<unsigned long long>(replayLast), recordingFile);
+                    break;
+                case REPLAY_FAILED:
+                    measurements.AddLog("[%s] Could not replay %s!\n", "error", recordingFile);
+                    break;
+                case REPLAY_CLOSED:
+                    replaying = false;
+                    break;
+                case CAPTURE_STARTED:
+                    capturing = true;
+                    measurements.AddLog("[%s] Capturing %s frames to %s\n", "info",
+                                        CAPTURE_FORMAT_NAMES[captureFormat], captureFile);
+                    break;
+                case CAPTURE_STOPPED:
+                    capturing = false;
+                    measurements.AddLog("[%s] Captured %llu frames (%.1f MB), %llu dropped\n", "info",
+                                        static_cast<unsigned long long>(recordingEvent.recorded),
+                                        static_cast<double>(recordingEvent.bytes) / 1e6,
+                                        static_cast<unsigned long long>(recordingEvent.dropped));
+                    break;
+                case CAPTURE_FAILED:
+                    capturing = false;
+                    measurements.AddLog("[%s] Could not capture to %s!\n", "error", captureFile);
+                    break;
+            }
+        }
+
         if (measurementWindow) {
-            ImGui::SetNextWindowSize(ImVec2(400, 300));
+            ImGui::SetNextWindowSize(ImVec2(520, 480));
 
             ImGui::Begin("Measurements", &measurementWindow);
 
             if (!startMeasure) {
+                // Simulation steps only: the forest on screen holds still while the benchmark steps its own grids.
+                ImGui::InputText("Grid sizes", benchmarkSizes, sizeof(benchmarkSizes));
+                ImGui::SameLine();
+                ImGui::TextDisabled("1024 or 2048x512");
+
+                if (ImGui::InputInt("Warmup steps", &benchmarkWarmup, 10, 100))
+                    benchmarkWarmup = std::max(benchmarkWarmup, 0);
+
+                if (ImGui::InputInt("Timed steps", &benchmarkSteps, 10, 100))
+                    benchmarkSteps = std::max(benchmarkSteps, 1);
+
+                if (ImGui::InputInt("Trials", &benchmarkTrials, 1, 5))
+                    benchmarkTrials = std::max(benchmarkTrials, 1);
+
                 ImGui::PushStyleColor(ImGuiCol_Button, IM_COL32(0, 128, 0, 255));
                 ImGui::PushStyleColor(ImGuiCol_ButtonHovered, IM_COL32(0, 100, 0, 255));
                 ImGui::PushStyleColor(ImGuiCol_ButtonActive, IM_COL32(0, 90, 0, 255));
 
                 if (ImGui::SmallButton("Start")) {
-                    if (!startMeasure) {
-                        start = std::chrono::high_resolution_clock::now();
-                        measureSteps = std::priority_queue<int, std::vector<int>, std::greater<>>(MEASUREMENT_STEPS,
-                                                                                                  MEASUREMENT_STEPS +
-                                                                                                  sizeof(MEASUREMENT_STEPS) /
-                                                                                                  sizeof(MEASUREMENT_STEPS[0]));
+                    if (startBenchmark()) {
                         startMeasure = true;
-                        nextSteps();
-                        measurements.AddLog("[%s] Measurement started!\n", "info");
+                        measurements.AddLog("[%s] Benchmark of %s started, rendering paused\n", "info",
+                                            describeParams(currentParams()).c_str());
                     } else {
-                        measurements.AddLog("[%s] Measurement already started!\n", "warn");
+                        measurements.AddLog("[%s] No grid size between %d and %d to measure!\n", "warn",
+                                            MIN_GRID_SIDE, MAX_GRID_SIDE);
                     }
                 }
                 ImGui::PopStyleColor(3);
+                ImGui::SameLine();
+
+                if (ImGui::SmallButton("Cluster sizes"))
+                    simulation.send({MEASURE_CLUSTERS});
+
+                ImGui::SameLine();
+
+                if (ImGui::SmallButton("Verify kernels"))
+                    simulation.send({VERIFY_KERNELS});
+
+                ImGui::BeginDisabled(benchmarkResults.empty());
+
+                if (ImGui::SmallButton("Save as baseline")) {
+                    if (saveBenchmarkBaseline())
+                        measurements.AddLog("[%s] Saved %zu results as the baseline in %s\n", "info",
+                                            benchmarkResults.size(), BASELINE_FILE);
+                    else
+                        measurements.AddLog("[%s] Could not write %s!\n", "error", BASELINE_FILE);
+                }
+
+                ImGui::EndDisabled();
+                ImGui::SameLine();
+                ImGui::Checkbox(" Compare with baseline", &compareBaseline);
             } else {
                 ImGui::PushStyleColor(ImGuiCol_Button, IM_COL32(128, 0, 0, 255));
                 ImGui::PushStyleColor(ImGuiCol_ButtonHovered, IM_COL32(100, 0, 0, 255));
                 ImGui::PushStyleColor(ImGuiCol_ButtonActive, IM_COL32(90, 0, 0, 255));
 
                 if (ImGui::SmallButton("Stop")) {
+                    simulation.send({STOP_MEASURE});
                     resetMeasure();
                     measurements.AddLog("[%s] Measurement aborted!\n", "warn");
                 }
@@ -133,10 +395,64 @@ int main(int, char **) {
                 ImGui::ProgressBar(progressCurrentStep / progressAllSteps, ImVec2(0.0f, 0.0f));
             }
 
+            if (compareBaseline && !benchmarkResults.empty() &&
+                ImGui::BeginTable("baseline", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+                ImGui::TableSetupColumn("Grid");
+                ImGui::TableSetupColumn("Mcells/s");
+                ImGui::TableSetupColumn("Baseline");
+                ImGui::TableSetupColumn("Change");
+                ImGui::TableHeadersRow();
+
+                for (const auto &r: benchmarkResults) {
+                    const auto *baseline = findBaseline(baselineResults, r);
+
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%dx%d", r.width, r.height);
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.2f +/- %.2f", r.cellsPerSecond.mean / 1e6, r.cellsPerSecond.ci / 1e6);
+                    ImGui::TableNextColumn();
+
+                    if (baseline == nullptr) {
+                        ImGui::TextDisabled("none saved");
+                        continue;
+                    }
+
+                    ImGui::Text("%.2f +/- %.2f", baseline->cellsPerSecond.mean / 1e6,
+                                baseline->cellsPerSecond.ci / 1e6);
+                    ImGui::TableNextColumn();
+
+                    // Changes the intervals explain are greyed out.
+                    double change = 100.0 * (r.cellsPerSecond.mean / baseline->cellsPerSecond.mean - 1.0);
+
+                    if (significantlyDifferent(r.cellsPerSecond, baseline->cellsPerSecond))
+                        ImGui::Text("%+.1f%%", change);
+                    else
+                        ImGui::TextDisabled("%+.1f%%", change);
+                }
+
+                ImGui::EndTable();
+            }
+
+            // Clusters per size bin on a log scale, bin b holding 2^b to 2^(b+1) - 1 trees.
+            if (latestClusters.histogram.clusters > 0) {
+                float bins[CLUSTER_BINS];
+                int used = std::bit_width(latestClusters.histogram.largest);
+
+                for (int b = 0; b < used; ++b)
+                    bins[b] = std::log10(1.0f + static_cast<float>(latestClusters.histogram.bins[b]));
+
+                ImGui::PlotHistogram("##clusters", bins, used, 0, "log10 clusters per size bin", 0.0f, FLT_MAX,
+                                     ImVec2(-1.0f, 60.0f));
+            }
+
             ImGui::End();
             measurements.Draw("Measurements", &measurementWindow);
         }
 
+        if (statisticsWindow)
+            statistics.draw("Statistics", &statisticsWindow);
+
         if (colorWindow) {
             static ImVec4 pickerTreeColor{static_cast<float>(treeColor.r / 255.0),
                                           static_cast<float>(treeColor.g / 255.0),
@@ -169,19 +485,9 @@ int main(int, char **) {
             ImGui::End();
         }
 
-        if (!limitAnimation)
-            calculateForest = true;
-
-        if (stepwiseAnimation && !animationStep)
-            calculateForest = false;
-
-        if (calculateForest) {
-            stepForest(fire, growth);
-            calculateForest = false;
-        }
-
         // Rendering
         ImGui::Render();
+        build.end();
 
         SDL_RenderSetScale(renderer, io.DisplayFramebufferScale.x, io.DisplayFramebufferScale.y);
         SDL_SetRenderDrawColor(renderer, (Uint8) (clearColor.x * 255), (Uint8) (clearColor.y * 255),
@@ -189,50 +495,48 @@ int main(int, char **) {
 
         SDL_RenderClear(renderer);
 
-        for (int i = 0; i < currentWidth; ++i)
-            for (int j = 0; j < currentHeight; ++j)
-                if (forest[i][j] == TREE)
-                    drawSquare(i, j, treeColor); // Green for tree
-                else if (forest[i][j] == FIRE)
-                    drawSquare(i, j, fireColor); // Red for fire
+        SDL_Color emptyColor = {(Uint8) (clearColor.x * 255), (Uint8) (clearColor.y * 255),
+                                (Uint8) (clearColor.z * 255), (Uint8) (clearColor.w * 255)};
+        capturePalette = {{{treeColor.r, treeColor.g, treeColor.b}, {fireColor.r, fireColor.g, fireColor.b},
+                           {emptyColor.r, emptyColor.g, emptyColor.b}}};
 
-        // End frame timing
-        auto endTicks = SDL_GetTicks();
-        auto endPerf = SDL_GetPerformanceCounter();
+        const auto &snapshot = simulation.latest();
 
-        measurements.framePerf = endPerf - startPerf;
-        measurements.fps = 1 / (((float) endTicks - (float) startTicks) / 1000.0f);
-        totalFrameTicks += endTicks - startTicks;
-        measurements.avg = 1000.0f / ((float) totalFrameTicks / (float) totalFrames);
+        TraceScope cells("cell rendering");
+        // Nothing changes on screen during a benchmark, so the texture is left alone to keep the CPU for it.
+        if (!startMeasure)
+            forestTexture.update(renderer, snapshot, treeColor, fireColor, emptyColor);
 
-        if (limitAnimation) {
-            auto dT = ((float) endTicks - (float) lastUpdate) / 1000.0f;
-            auto framesToUpdate = static_cast<int>(floor(dT / (1.0f / currentSpeed)));
+        forestTexture.draw(renderer, viewport, windowWidth, windowHeight);
+        cells.end();
 
-            if (framesToUpdate > 0) {
-                lastFrame += framesToUpdate;
-                lastUpdate = endTicks;
-                calculateForest = true;
-            }
-        }
+        // End frame timing
+        auto endPerf = SDL_GetPerformanceCounter();
 
+        measurements.frameMs = static_cast<float>((endPerf - startPerf) * 1000.0 / counterFrequency);
+        measurements.fps = static_cast<float>(counterFrequency / static_cast<double>(endPerf - startPerf));
+        totalFramePerf += endPerf - startPerf;
+        measurements.avg = static_cast<float>(counterFrequency * totalFrames / static_cast<double>(totalFramePerf));
+        measurements.generation = snapshot.generation;
+
+        TraceScope present("present");
         ImGui_ImplSDLRenderer2_RenderDrawData(ImGui::GetDrawData());
         SDL_RenderPresent(renderer);
+        present.end();
+        frame.end();
 
-        if (startMeasure) {
-            currentStep++;
-            progressCurrentStep++;
-        }
-
-        if (animationStep)
-            animationStep = false;
+        if (tracing.enabled.load(std::memory_order_relaxed))
+            traceLog.collect();
     }
 
     // Cleanup
+    simulation.stop();
+
     ImGui_ImplSDLRenderer2_Shutdown();
     ImGui_ImplSDL2_Shutdown();
     ImGui::DestroyContext();
 
+    forestTexture.destroy();
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -0,0 +1,308 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <mpi.h>
+#include <omp.h>
+
+#include "CommandLine.cpp"
+#include "Decomposition.cpp"
+#include "Recording.cpp"
+#include "Simulation.cpp"
+
+// One forest split into horizontal strips, one per MPI rank, which step with the per-cell rule and exchange one-row
+// halos every generation, so a forest can use the memory and bandwidth of several processes or machines. Every rank
+// runs its OpenMP threads on its own strip; bind the ranks with mpirun, for example --bind-to socket on a two-socket
+// machine. Rank 0 gathers a downsampled view of the forest every few steps and can record it for the viewer.
+const char *USAGE =
+        "usage: mpirun -np N forest_mpi [options]\n"
+        "  --width 4096\n"
+        "  --height 4096          at least one row per rank\n"
+        "  --steps 200\n"
+        "  --p 0.0001             spontaneous fire probability\n"
+        "  --g 0.03               tree growth probability\n"
+        "  --logic von-neumann\n"
+        "  --sampling cell        per-cell draws or skip-sampled lightning and growth\n"
+        "  --boundary fixed\n"
+        "  --seed 1\n"
+        "  --view 1024            longest side of the downsampled view rank 0 gathers\n"
+        "  --view-every 10        steps between two gathered views\n"
+        "  --record FILE          rank 0 records the views, open FILE with forest --replay FILE\n"
+        "  --verify               check every step against one process stepping the whole forest and exit\n";
+
+struct MpiOptions {
+    int width{4096}, height{4096}, steps{200}, view{1024}, viewEvery{10};
+    StepParams params{0.0001, 0.03, VON_NEUMANN, CELL_KERNEL, 1};
+    const char *record{nullptr};
+    bool verify{false};
+};
+
+bool parseArguments(int argc, char **argv, MpiOptions &options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        if (arg == "--verify") {
+            options.verify = true;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+            return false;
+
+        const char *value = argv[++i];
+        bool parsed = true;
+
+        if (arg == "--width")
+            parsed = parseNumber(value, options.width);
+        else if (arg == "--height")
+            parsed = parseNumber(value, options.height);
+        else if (arg == "--steps")
+            parsed = parseNumber(value, options.steps);
+        else if (arg == "--p")
+            parsed = parseNumber(value, options.params.p);
+        else if (arg == "--g")
+            parsed = parseNumber(value, options.params.g);
+        else if (arg == "--logic")
+            options.params.logic = static_cast<NeighborhoodLogic>(parseName(value, NEIGHBORHOOD_NAMES));
+        else if (arg == "--sampling")
+            options.params.skipSampling = parseName(value, SAMPLING_NAMES) == 1;
+        else if (arg == "--boundary")
+            options.params.boundary = static_cast<BoundaryMode>(parseName(value, BOUNDARY_NAMES));
+        else if (arg == "--seed")
+            parsed = parseNumber(value, options.params.seed);
+        else if (arg == "--view")
+            parsed = parseNumber(value, options.view);
+        else if (arg == "--view-every")
+            parsed = parseNumber(value, options.viewEvery);
+        else if (arg == "--record")
+            options.record = value;
+        else
+            return false;
+
+        if (!parsed)
+            return false;
+    }
+
+    return options.width > 0 && options.height > 0 && options.steps > 0 && options.view > 0 &&
+           options.viewEvery > 0;
+}
+
+// Tags of the edge rows, by the direction they travel in.
+const int UPWARD = 1, DOWNWARD = 2;
+
+// The halo exchange of one rank with the ranks of the strips above and below it. Beyond the edges of a forest with a
+// fixed boundary, the neighbor is MPI_PROC_NULL, which leaves those halos EMPTY.
+struct HaloExchange {
+    HaloExchange(int rank, int ranks, bool periodic) :
+            above(rank > 0 || periodic ? (rank + ranks - 1) % ranks : MPI_PROC_NULL),
+            below(rank < ranks - 1 || periodic ? (rank + 1) % ranks : MPI_PROC_NULL) {}
+
+    // Receives both halos and sends both edge rows of the current generation, which the step does not write.
+    void start(ForestStrip &strip) {
+        MPI_Irecv(strip.haloAbove(), strip.width, MPI_BYTE, above, DOWNWARD, MPI_COMM_WORLD, &requests[0]);
+        MPI_Irecv(strip.haloBelow(), strip.width, MPI_BYTE, below, UPWARD, MPI_COMM_WORLD, &requests[1]);
+        MPI_Isend(strip.row(strip.y0), strip.width, MPI_BYTE, above, UPWARD, MPI_COMM_WORLD, &requests[2]);
+        MPI_Isend(strip.row(strip.y1 - 1), strip.width, MPI_BYTE, below, DOWNWARD, MPI_COMM_WORLD, &requests[3]);
+    }
+
+    void wait() {
+        auto start = std::chrono::steady_clock::now();
+        MPI_Waitall(4, requests, MPI_STATUSES_IGNORE);
+        waitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+public:
+    int above, below;
+    MPI_Request requests[4]{};
+    // Spent in wait(), the part of the exchange the rows away from the halos did not hide.
+    double waitSeconds{};
+};
+
+// Gathers rows of width cells from every rank into gathered on rank 0, counts[r] of them from rank r, in rank order.
+void gatherRows(const CellState *rows, int count, int width, CellState *gathered, const std::vector<int> &counts) {
+    std::vector<int> bytes(counts.size()), offsets(counts.size());
+
+    for (std::size_t r = 0; r < counts.size(); ++r) {
+        bytes[r] = counts[r] * width;
+        offsets[r] = r > 0 ? offsets[r - 1] + bytes[r - 1] : 0;
+    }
+
+    MPI_Gatherv(rows, count * width, MPI_BYTE, gathered, bytes.data(), offsets.data(), MPI_BYTE, 0, MPI_COMM_WORLD);
+}
+
+// Rows of every rank, as stripRows deals them out.
+std::vector<int> rowCounts(int height, int ranks, int align) {
+    std::vector<int> counts;
+
+    for (int r = 0; r < ranks; ++r) {
+        auto [y0, y1] = stripRows(height, ranks, r, align);
+        counts.push_back(viewSize(y1 - y0, align));
+    }
+
+    return counts;
+}
+
+// Every rank steps its strip while rank 0 also steps the whole forest with the per-cell kernel, for both
+// neighborhoods and boundaries and with lightning and growth drawn per cell as well as skip-sampled. After every step,
+// rank 0 gathers the strips and compares them and the summed statistics to the whole forest.
+bool verifyRun(int rank, int ranks, std::uint64_t seed) {
+    const int width = 263, height = std::max(157, 2 * ranks), steps = 60;
+    const auto counts = rowCounts(height, ranks, 1);
+    auto [y0, y1] = stripRows(height, ranks, rank);
+    bool matches = true;
+
+    for (auto logic: {VON_NEUMANN, MOORE})
+        for (auto boundary: {FIXED_BOUNDARY, PERIODIC_BOUNDARY})
+            for (bool skipSampling: {false, true}) {
+                StepParams params{0.001, 0.05, logic, CELL_KERNEL, seed, skipSampling, false, 1, boundary};
+                ForestStrip strip(width, height, y0, y1);
+                HaloExchange halos(rank, ranks, boundary == PERIODIC_BOUNDARY);
+                ForestGrid whole(rank == 0 ? width : 0, rank == 0 ? height : 0);
+                std::vector<CellState> gathered(rank == 0 ? whole.size() : 0);
+
+                initStrip(strip, seed);
+
+                if (rank == 0)
+                    initGrid(whole, seed);
+
+                for (int step = 0; step < steps && matches; ++step) {
+                    halos.start(strip);
+                    auto stats = stepStrip(strip, params, step, [&] { halos.wait(); });
+                    std::uint64_t local[3] = {stats.fires, stats.struck, stats.grown}, total[3] = {};
+
+                    MPI_Reduce(local, total, 3, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+                    gatherRows(strip.row(y0), strip.rows(), width, gathered.data(), counts);
+
+                    if (rank == 0) {
+                        StepStats expected;
+                        stepGrid(whole, params, step, &expected);
+
+                        matches = std::memcmp(gathered.data(), whole.cells, whole.size()) == 0 &&
+                                  total[0] == expected.fires && total[1] == expected.struck &&
+                                  total[2] == expected.grown;
+                    }
+
+                    MPI_Bcast(&matches, 1, MPI_CXX_BOOL, 0, MPI_COMM_WORLD);
+                }
+            }
+
+    return matches;
+}
+
+// Smallest power of two that downsamples the longer side of the forest to at most view cells.
+int viewFactor(const MpiOptions &options) {
+    int factor = 1;
+
+    while (viewSize(std::max(options.width, options.height), factor) > options.view)
+        factor *= 2;
+
+    return factor;
+}
+
+int run(const MpiOptions &options, int rank, int ranks) {
+    const int factor = viewFactor(options);
+    const int viewWidth = viewSize(options.width, factor), viewHeight = viewSize(options.height, factor);
+    const auto viewCounts = rowCounts(options.height, ranks, factor);
+
+    // Every rank needs at least one block of rows, which every rank finds out the same.
+    if (viewHeight < ranks) {
+        if (rank == 0)
+            std::fprintf(stderr, "%d rows in blocks of %d are too few for %d ranks\n", options.height, factor, ranks);
+
+        return EXIT_FAILURE;
+    }
+
+    auto [y0, y1] = stripRows(options.height, ranks, rank, factor);
+    ForestStrip strip(options.width, options.height, y0, y1);
+    HaloExchange halos(rank, ranks, options.params.boundary == PERIODIC_BOUNDARY);
+    std::vector<CellState> view(static_cast<std::size_t>(viewCounts[rank]) * viewWidth);
+    ForestGrid viewGrid(rank == 0 ? viewWidth : 0, rank == 0 ? viewHeight : 0);
+    RunRecorder recorder;
+    double gatherSeconds = 0.0;
+
+    initStrip(strip, options.params.seed);
+
+    auto gatherView = [&](std::uint64_t generation) {
+        auto start = std::chrono::steady_clock::now();
+
+        downsampleStrip(strip, factor, view.data());
+        gatherRows(view.data(), viewCounts[rank], viewWidth, viewGrid.cells, viewCounts);
+
+        if (rank == 0 && recorder.active())
+            recorder.record(viewGrid, generation, true);
+
+        gatherSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    if (rank == 0 && options.record && !recorder.start(options.record, viewGrid, options.params))
+        std::perror(options.record);
+
+    gatherView(0);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    auto start = std::chrono::steady_clock::now();
+
+    for (int step = 0; step < options.steps; ++step) {
+        halos.start(strip);
+        stepStrip(strip, options.params, step, [&] { halos.wait(); });
+
+        if ((step + 1) % options.viewEvery == 0)
+            gatherView(step + 1);
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double waits[2] = {halos.waitSeconds, gatherSeconds}, maxWaits[2] = {};
+
+    MPI_Reduce(waits, maxWaits, 2, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    if (rank == 0 && recorder.active() && !recorder.stop())
+        std::perror(options.record);
+
+    if (rank == 0)
+        std::fprintf(stderr, "%dx%d on %d ranks x %d threads, %d steps: %.2f ms per step, %.2f Mcells/s, "
+                             "halo wait %.3f ms and views %.3f ms per step on the slowest rank, view %dx%d\n",
+                     options.width, options.height, ranks, omp_get_max_threads(), options.steps,
+                     seconds * 1e3 / options.steps,
+                     static_cast<double>(options.width) * options.height * options.steps / seconds / 1e6,
+                     maxWaits[0] * 1e3 / options.steps, maxWaits[1] * 1e3 / options.steps, viewWidth, viewHeight);
+
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    int provided = 0, rank = 0, ranks = 1;
+
+    // Only the thread that calls stepStrip talks to MPI, from the master thread of its parallel region.
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+    MpiOptions options;
+    int status;
+
+    if (!parseArguments(argc, argv, options)) {
+        if (rank == 0)
+            std::fputs(USAGE, stderr);
+
+        status = EXIT_FAILURE;
+    } else if (options.verify) {
+        bool matches = verifyRun(rank, ranks, options.params.seed);
+
+        if (rank == 0)
+            std::fprintf(stderr, "strips of %d ranks: %s\n", ranks,
+                         matches ? "step like the whole forest" : "one DIFFERS from the whole forest");
+
+        status = matches ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else {
+        status = run(options, rank, ranks);
+    }
+
+    MPI_Finalize();
+    return status;
+}
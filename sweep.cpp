@@ -0,0 +1,336 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#include "CommandLine.cpp"
+#include "Placement.cpp"
+#include "Simulation.cpp"
+
+// Batch runs over a grid of (p, g, neighborhood, size) points for phase diagrams. Every point is simulated by
+// several independent replicates, and the replicates of all points are scheduled over the cores as whole runs, each
+// on a single thread, so there is no synchronization inside a run at all.
+const char *USAGE =
+        "usage: forest_sweep [options]\n"
+        "  --p 1e-5:1e-2:7:log    spontaneous fire probabilities, from:to:count[:log] for ranges\n"
+        "  --g 0.01:0.1:10        tree growth probabilities, same syntax\n"
+        "  --logic von-neumann,moore\n"
+        "  --sizes 256            square grid sizes\n"
+        "  --kernel bitplane      step kernel of every run, or replicas to run all replicates of a point at once\n"
+        "                         with the bit-sliced kernel (skip sampling, at most 64 replicates)\n"
+        "  --depth 8              generations per step of the temporal kernel\n"
+        "  --sampling skip        per-cell draws or skip-sampled lightning and growth\n"
+        "  --burn spread          fires spreading one cell per step, or instant to burn a struck cluster at once;\n"
+        "                         a step then lasts until the next strike and samples are taken per strike\n"
+        "  --boundary fixed       no forest beyond the edge, or periodic to wrap the grid into a torus; the\n"
+        "                         bit-sliced replicas only support a fixed boundary\n"
+        "  --replicates 4         independent runs per point\n"
+        "  --warmup 1000          burn-in steps before sampling\n"
+        "  --steps 2000           sampled steps per run\n"
+        "  --interval 10          steps between two samples\n"
+        "  --threads N            runs in parallel (default: omp_get_max_threads())\n"
+        "  --pin none             pin the runs to CPUs: compact, spread over the NUMA nodes or a list like 0,2,4-7\n"
+        "  --seed 1\n"
+        "  --output FILE          CSV, default: stdout\n";
+
+struct SweepOptions {
+    std::vector<double> fires{0.00001, 0.0001, 0.001, 0.01};
+    std::vector<double> growths{0.01, 0.03, 0.1};
+    std::vector<NeighborhoodLogic> logics{VON_NEUMANN, MOORE};
+    std::vector<int> sizes{256};
+    StepKernel kernel{BITPLANE_KERNEL};
+    bool replicas{false}, skipSampling{true}, instantBurn{false};
+    BoundaryMode boundary{FIXED_BOUNDARY};
+    int depth{8}, replicates{4}, warmup{1000}, steps{2000}, interval{10};
+    int threads{omp_get_max_threads()};
+    std::uint64_t seed{1};
+    const char *output{nullptr};
+};
+
+struct SweepPoint {
+    int size{};
+    StepParams params;
+};
+
+// Mean and variance in one pass (Welford), mergeable across runs (Chan et al.).
+struct RunningStats {
+    void add(double value) {
+        count++;
+        double delta = value - mean;
+        mean += delta / static_cast<double>(count);
+        m2 += delta * (value - mean);
+    }
+
+    void merge(const RunningStats &other) {
+        if (other.count == 0)
+            return;
+
+        auto total = count + other.count;
+        double delta = other.mean - mean;
+
+        mean += delta * static_cast<double>(other.count) / static_cast<double>(total);
+        m2 += other.m2 + delta * delta * static_cast<double>(count) * static_cast<double>(other.count) /
+                         static_cast<double>(total);
+        count = total;
+    }
+
+    [[nodiscard]] double variance() const {
+        return count > 1 ? m2 / static_cast<double>(count - 1) : 0.0;
+    }
+
+public:
+    std::uint64_t count{};
+    double mean{}, m2{};
+};
+
+struct RunResult {
+    RunningStats density, fires;
+    double seconds{};
+};
+
+bool parseArguments(int argc, char **argv, SweepOptions &options) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        const char *value = argv[i + 1];
+        bool parsed = true;
+
+        if (arg == "--p")
+            parsed = parseRange(value, options.fires);
+        else if (arg == "--g")
+            parsed = parseRange(value, options.growths);
+        else if (arg == "--logic")
+            options.logics = parseList<NeighborhoodLogic>(value, [](const std::string &s) {
+                return static_cast<NeighborhoodLogic>(parseName(s, NEIGHBORHOOD_NAMES));
+            });
+        else if (arg == "--sizes")
+            parsed = parseNumbers(value, options.sizes);
+        else if (arg == "--kernel" && std::strcmp(value, "replicas") == 0)
+            options.replicas = true;
+        else if (arg == "--kernel")
+            options.kernel = static_cast<StepKernel>(parseName(value, STEP_KERNEL_NAMES));
+        else if (arg == "--depth")
+            parsed = parseNumber(value, options.depth);
+        else if (arg == "--sampling")
+            options.skipSampling = parseName(value, SAMPLING_NAMES) == 1;
+        else if (arg == "--burn")
+            options.instantBurn = parseName(value, BURN_NAMES) == 1;
+        else if (arg == "--boundary")
+            options.boundary = static_cast<BoundaryMode>(parseName(value, BOUNDARY_NAMES));
+        else if (arg == "--replicates")
+            parsed = parseNumber(value, options.replicates);
+        else if (arg == "--warmup")
+            parsed = parseNumber(value, options.warmup);
+        else if (arg == "--steps")
+            parsed = parseNumber(value, options.steps);
+        else if (arg == "--interval")
+            parsed = parseNumber(value, options.interval);
+        else if (arg == "--threads")
+            parsed = parseNumber(value, options.threads);
+        else if (arg == "--seed")
+            parsed = parseNumber(value, options.seed);
+        else if (arg == "--pin")
+            parsed = parsePinning(value, placement);
+        else if (arg == "--output")
+            options.output = value;
+        else
+            return false;
+
+        if (!parsed)
+            return false;
+    }
+
+    auto positive = [](int size) { return size > 0; };
+
+    return argc % 2 == 1 && !options.fires.empty() && !options.growths.empty() && !options.logics.empty() &&
+           !options.sizes.empty() && std::all_of(options.sizes.begin(), options.sizes.end(), positive) &&
+           options.replicates > 0 && options.steps > 0 && options.interval > 0 && options.threads > 0 &&
+           (!options.replicas ||
+            (options.replicates <= REPLICAS && !options.instantBurn && options.boundary == FIXED_BOUNDARY));
+}
+
+// One replicate of one point, on the calling thread only. Replicate r of every point uses seed + r, so neighboring
+// points of the diagram see the same random numbers and differ only by their parameters.
+RunResult runReplicate(const SweepOptions &options, const SweepPoint &point, int replicate) {
+    auto start = std::chrono::steady_clock::now();
+    ForestGrid grid(point.size, point.size);
+    StepParams params = point.params;
+    RunResult result;
+
+    params.seed = options.seed + replicate;
+    initGrid(grid, params.seed);
+
+    std::uint64_t step = 0;
+
+    // A step of the temporal kernel advances several generations at once, warmup and steps count its steps.
+    for (int i = 0; i < options.warmup; ++i, step += params.stepLength())
+        stepGrid(grid, params, step);
+
+    const auto cells = static_cast<double>(grid.size());
+
+    // The kernel counts trees and fires while it steps, so sampling costs no extra pass over the grid.
+    for (int i = 0; i < options.steps; ++i, step += params.stepLength()) {
+        StepStats stats;
+        stepGrid(grid, params, step, &stats);
+
+        if ((i + 1) % options.interval != 0)
+            continue;
+
+        result.density.add(static_cast<double>(stats.trees) / cells);
+        result.fires.add(static_cast<double>(stats.fires));
+    }
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+// All replicates of one point at once with the bit-sliced kernel. Replica r is seeded like replicate r of the other
+// kernels with skip sampling, so both give the same results, the run time is split evenly between the replicates.
+void runReplicaPoint(const SweepOptions &options, const SweepPoint &point, RunResult *results) {
+    auto start = std::chrono::steady_clock::now();
+    ReplicaGrid grid(point.size, point.size);
+    StepParams params = point.params;
+
+    params.seed = options.seed;
+    params.skipSampling = true;
+    initReplicas(grid, params.seed);
+
+    std::uint64_t step = 0;
+
+    for (int i = 0; i < options.warmup; ++i)
+        stepReplicas(grid, params, step++);
+
+    const auto cells = static_cast<double>(grid.size());
+
+    for (int i = 0; i < options.steps; ++i) {
+        stepReplicas(grid, params, step++);
+
+        if ((i + 1) % options.interval != 0)
+            continue;
+
+        auto counts = countReplicaCells(grid);
+
+        for (int r = 0; r < options.replicates; ++r) {
+            results[r].density.add(static_cast<double>(counts.trees[r]) / cells);
+            results[r].fires.add(static_cast<double>(counts.fires[r]));
+        }
+    }
+
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (int r = 0; r < options.replicates; ++r)
+        results[r].seconds = seconds / options.replicates;
+}
+
+void reportRun(std::size_t done, std::size_t total, const SweepPoint &point, int replicate, int replicates,
+               double seconds, double elapsed) {
+    std::fprintf(stderr, "[%zu/%zu] %5d^2 %-11s p=%g g=%g replicates %d-%d: %.2f s, %.0f s elapsed\n", done, total,
+                 point.size, NEIGHBORHOOD_NAMES[point.params.logic], point.params.p, point.params.g, replicate,
+                 replicate + replicates - 1, seconds, elapsed);
+}
+
+int main(int argc, char **argv) {
+    SweepOptions options;
+
+    if (!parseArguments(argc, argv, options)) {
+        std::fputs(USAGE, stderr);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<SweepPoint> points;
+
+    for (auto size: options.sizes)
+        for (auto logic: options.logics)
+            for (auto p: options.fires)
+                for (auto g: options.growths)
+                    points.push_back({size, {p, g, logic, options.kernel, options.seed, options.skipSampling,
+                                              options.instantBurn, options.depth, options.boundary}});
+
+    // A job is one replicate, or all replicates of a point for the bit-sliced kernel. Largest grids first, so the
+    // longest jobs do not end up as the stragglers at the end of the sweep.
+    const int perJob = options.replicas ? options.replicates : 1;
+    std::vector<std::int64_t> order(points.size() * options.replicates / perJob);
+
+    for (std::size_t job = 0; job < order.size(); ++job)
+        order[job] = static_cast<std::int64_t>(job) * perJob;
+
+    std::stable_sort(order.begin(), order.end(), [&](std::int64_t a, std::int64_t b) {
+        return points[a / options.replicates].size > points[b / options.replicates].size;
+    });
+
+    std::vector<RunResult> runs(points.size() * options.replicates);
+    std::atomic<std::size_t> finished{0};
+    const auto jobCount = static_cast<std::int64_t>(order.size());
+    auto start = std::chrono::steady_clock::now();
+
+    // Jobs are the unit of parallelism, the parallel regions of the kernels inside them stay single-threaded.
+    // Every run allocates its grid on the thread it runs on, which therefore first touches it on its own node.
+    omp_set_max_active_levels(1);
+    omp_set_num_threads(options.threads);
+    applyPlacement();
+
+#pragma omp parallel for schedule(dynamic, 1) default(none) shared(options, points, order, runs, finished, jobCount, start, perJob)
+    for (std::int64_t i = 0; i < jobCount; ++i) {
+        auto run = order[i];
+        const auto &point = points[run / options.replicates];
+        auto replicate = static_cast<int>(run % options.replicates);
+
+        if (options.replicas)
+            runReplicaPoint(options, point, &runs[run]);
+        else
+            runs[run] = runReplicate(options, point, replicate);
+
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+#pragma omp critical
+        reportRun(++finished, order.size(), point, replicate, perJob, runs[run].seconds * perJob, elapsed);
+    }
+
+    std::FILE *out = options.output ? std::fopen(options.output, "w") : stdout;
+
+    if (out == nullptr) {
+        std::perror(options.output);
+        return EXIT_FAILURE;
+    }
+
+    std::fprintf(out, "size,logic,kernel,sampling,burn,boundary,p,g,replicates,warmup,steps,interval,samples,density_mean,"
+                      "density_var,density_sem,fires_mean,fires_var,seconds\n");
+
+    for (std::size_t i = 0; i < points.size(); ++i) {
+        RunningStats density, fires, replicateDensity;
+        double seconds = 0.0;
+
+        // Merged in replicate order, so the output does not depend on which thread finished first.
+        for (int r = 0; r < options.replicates; ++r) {
+            const auto &run = runs[i * options.replicates + r];
+            density.merge(run.density);
+            fires.merge(run.fires);
+            replicateDensity.add(run.density.mean);
+            seconds += run.seconds;
+        }
+
+        // Samples of one run are correlated, so the error of the mean is estimated from the independent replicates.
+        double sem = std::sqrt(replicateDensity.variance() / options.replicates);
+        const auto &point = points[i];
+
+        std::fprintf(out, "%d,%s,%s,%s,%s,%s,%g,%g,%d,%d,%d,%d,%llu,%.6f,%.6e,%.6e,%.3f,%.6e,%.3f\n", point.size,
+                     NEIGHBORHOOD_NAMES[point.params.logic],
+                     options.replicas ? "replicas" : STEP_KERNEL_NAMES[point.params.kernel],
+                     SAMPLING_NAMES[options.replicas || point.params.skipSampling],
+                     BURN_NAMES[point.params.instantBurn], BOUNDARY_NAMES[point.params.boundary], point.params.p,
+                     point.params.g, options.replicates, options.warmup, options.steps, options.interval,
+                     static_cast<unsigned long long>(density.count), density.mean, density.variance(), sem, fires.mean,
+                     fires.variance(), seconds);
+    }
+
+    if (out != stdout)
+        std::fclose(out);
+
+    return EXIT_SUCCESS;
+}